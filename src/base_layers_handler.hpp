@@ -0,0 +1,232 @@
+#ifndef BASE_LAYERS_HANDLER_HPP
+#define BASE_LAYERS_HANDLER_HPP
+
+/*
+
+  Handler writing the layers of a LayerConfig, used by osmium_toogr and
+  osmium_export_all. With the builtin config these are places, peaks,
+  roads, railways and boundaries.
+
+*/
+
+#include <gdalcpp.hpp>
+
+#include <osmium/geom/ogr.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/way.hpp>
+
+#include "layer_config.hpp"
+#include "ogr_output.hpp"
+#include "progress.hpp"
+#include "stage_time.hpp"
+#include "tag_dispatch.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Set the fields of a feature from the attribute values found by the
+ * dispatcher. Fields are set by their index, which is their position in
+ * the layer definition. TFeature can be a gdalcpp::Feature or anything
+ * else with set_field(int, int), set_field(int, double) and
+ * set_field(int, const char*).
+ */
+template <typename TFeature>
+void set_layer_fields(TFeature& feature, const LayerConfig::layer& layer, const char* const* values, osmium::object_id_type id) {
+    int n = 0;
+    for (const auto& field : layer.fields) {
+        if (field.attribute == LayerConfig::object_id) {
+            if (field.type == LayerConfig::field_type::real) {
+                feature.set_field(n, static_cast<double>(id));
+            } else {
+                feature.set_field(n, std::to_string(id).c_str());
+            }
+            ++n;
+            continue;
+        }
+
+        const char* value = values[static_cast<std::size_t>(field.attribute)];
+        if (!value) {
+            if (!field.has_default) {
+                if (field.type == LayerConfig::field_type::string) {
+                    feature.set_field(n, "");
+                }
+                ++n;
+                continue;
+            }
+            value = field.default_value.c_str();
+        }
+
+        switch (field.type) {
+            case LayerConfig::field_type::integer:
+                feature.set_field(n, std::atoi(value));
+                break;
+            case LayerConfig::field_type::real:
+                feature.set_field(n, std::atof(value));
+                break;
+            case LayerConfig::field_type::string:
+                feature.set_field(n, value);
+                break;
+        }
+        ++n;
+    }
+}
+
+/**
+ * Create an OGR layer with the geometry type and fields of a layer
+ * definition.
+ */
+inline std::unique_ptr<gdalcpp::Layer> create_config_layer(gdalcpp::Dataset& dataset, const LayerConfig::layer& layer, const std::vector<std::string>& options) {
+    const OGRwkbGeometryType geometry = layer.geometry == LayerConfig::geometry_type::point ? wkbPoint : wkbLineString;
+    std::unique_ptr<gdalcpp::Layer> ogr_layer{new gdalcpp::Layer(dataset, layer.name, geometry, options)};
+    for (const auto& field : layer.fields) {
+        OGRFieldType type = OFTString;
+        if (field.type == LayerConfig::field_type::integer) {
+            type = OFTInteger;
+        } else if (field.type == LayerConfig::field_type::real) {
+            type = OFTReal;
+        }
+        ogr_layer->add_field(field.name, type, field.width);
+    }
+    return ogr_layer;
+}
+
+// Writes all layers into one OGR dataset.
+class OGRBaseLayersOutput {
+
+    // One OGR layer for every layer of the config.
+    std::vector<std::unique_ptr<gdalcpp::Layer>> m_layers;
+
+    osmium::geom::OGRFactory<> m_factory;
+
+public:
+
+    OGRBaseLayersOutput(gdalcpp::Dataset& dataset, const LayerConfig& config, bool defer_index) {
+        const auto options = layer_options(defer_index);
+        for (const auto& layer : config.layers()) {
+            m_layers.push_back(create_config_layer(dataset, layer, options));
+        }
+    }
+
+    void add_point(std::size_t index, const LayerConfig::layer& layer, const osmium::Node& node, const char* const* values) {
+        gdalcpp::Feature feature{*m_layers[index], m_factory.create_point(node)};
+        set_layer_fields(feature, layer, values, node.id());
+        feature.add_to_layer();
+    }
+
+    void add_linestring(std::size_t index, const LayerConfig::layer& layer, const osmium::Way& way, const char* const* values) {
+        gdalcpp::Feature feature{*m_layers[index], m_factory.create_linestring(way)};
+        set_layer_fields(feature, layer, values, way.id());
+        feature.add_to_layer();
+    }
+
+    void create_spatial_indexes(gdalcpp::Dataset& dataset) {
+        for (const auto& layer : m_layers) {
+            create_spatial_index(dataset, *layer);
+        }
+    }
+
+}; // class OGRBaseLayersOutput
+
+template <typename TOutput>
+class BaseLayersHandler : public osmium::handler::Handler {
+
+    const LayerConfig& m_config;
+    TOutput& m_output;
+
+    // The attribute values found by the dispatchers.
+    std::vector<const char*> m_values;
+
+    std::uint64_t m_features = 0;
+    std::vector<std::uint64_t> m_layer_features;
+    std::uint64_t m_geometry_errors = 0;
+
+    // Features written per layer for the progress reporter, empty if
+    // progress isn't reported.
+    std::vector<ProgressCounter*> m_progress;
+
+    StageTime* m_write_time = nullptr;
+
+    void count_feature(std::size_t index) noexcept {
+        ++m_features;
+        ++m_layer_features[index];
+        if (!m_progress.empty()) {
+            m_progress[index]->add();
+        }
+    }
+
+public:
+
+    BaseLayersHandler(const LayerConfig& config, TOutput& output) :
+        m_config(config),
+        m_output(output),
+        m_values(config.max_attributes()),
+        m_layer_features(config.layers().size(), 0) {
+    }
+
+    std::uint64_t features() const noexcept {
+        return m_features;
+    }
+
+    // Features written to the layer with the given index in the config.
+    std::uint64_t layer_features(std::size_t index) const noexcept {
+        return m_layer_features[index];
+    }
+
+    std::uint64_t geometry_errors() const noexcept {
+        return m_geometry_errors;
+    }
+
+    // Measure the time spent writing features for --stats.
+    void set_write_time(StageTime* time) noexcept {
+        m_write_time = time;
+    }
+
+    // Add a counter for every layer to the progress reporter.
+    void add_progress_counters(ProgressReporter& progress) {
+        for (const auto& layer : m_config.layers()) {
+            m_progress.push_back(&progress.add_layer(layer.name));
+        }
+    }
+
+    void node(const osmium::Node& node) {
+        const int index = m_config.node_dispatcher().classify(node.tags(), m_values.data());
+        if (index == TagDispatcher::no_target) {
+            return;
+        }
+
+        const auto i = static_cast<std::size_t>(index);
+        {
+            StageTime::scope timer{m_write_time};
+            m_output.add_point(i, m_config.layers()[i], node, m_values.data());
+        }
+        count_feature(i);
+    }
+
+    void way(const osmium::Way& way) {
+        const int index = m_config.way_dispatcher().classify(way.tags(), m_values.data());
+        if (index == TagDispatcher::no_target) {
+            return;
+        }
+
+        const auto i = static_cast<std::size_t>(index);
+        try {
+            {
+                StageTime::scope timer{m_write_time};
+                m_output.add_linestring(i, m_config.layers()[i], way, m_values.data());
+            }
+            count_feature(i);
+        } catch (const osmium::geometry_error&) {
+            ++m_geometry_errors;
+            std::cerr << "Ignoring illegal geometry for way " << way.id() << ".\n";
+        }
+    }
+
+}; // class BaseLayersHandler
+
+#endif // BASE_LAYERS_HANDLER_HPP
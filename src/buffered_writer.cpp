@@ -0,0 +1,53 @@
+/*
+
+  Buffered output writer for large text and binary files.
+
+*/
+
+#include "buffered_writer.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/io/writer_options.hpp>
+
+#include <string>
+
+BufferedWriter::BufferedWriter(std::size_t buffer_size) :
+    m_buffer(buffer_size) {
+}
+
+BufferedWriter::~BufferedWriter() noexcept {
+    try {
+        close();
+    } catch (...) {
+        // Ignore any exceptions because destructor must not throw.
+    }
+}
+
+void BufferedWriter::open(const std::string& filename) {
+    close();
+    m_fd = osmium::io::detail::open_for_writing(filename, osmium::io::overwrite::allow);
+    m_bytes_written = 0;
+}
+
+void BufferedWriter::write_out(const char* data, std::size_t size) {
+    osmium::io::detail::reliable_write(m_fd, data, size);
+    m_bytes_written += size;
+}
+
+void BufferedWriter::flush() {
+    if (m_used > 0) {
+        write_out(m_buffer.data(), m_used);
+        m_used = 0;
+    }
+}
+
+void BufferedWriter::close() {
+    if (m_fd >= 0) {
+        flush();
+        const int fd = m_fd;
+        m_fd = -1;
+        if (fd != 1) {
+            osmium::io::detail::reliable_close(fd);
+        }
+    }
+}
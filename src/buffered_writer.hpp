@@ -0,0 +1,119 @@
+#ifndef BUFFERED_WRITER_HPP
+#define BUFFERED_WRITER_HPP
+
+/*
+
+  Buffered output writer for large text and binary files.
+
+  Collects output in a big reusable buffer and only hands it to the
+  operating system when the buffer is full or when flush() or close()
+  are called explicitly. Integers are formatted by hand, so no locale
+  or stream state is involved.
+
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class BufferedWriter {
+
+    std::vector<char> m_buffer;
+    std::size_t m_used = 0;
+    std::size_t m_bytes_written = 0;
+    int m_fd = -1;
+
+    void write_out(const char* data, std::size_t size);
+
+public:
+
+    static constexpr const std::size_t default_buffer_size = 4UL * 1024UL * 1024UL;
+
+    explicit BufferedWriter(std::size_t buffer_size = default_buffer_size);
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    ~BufferedWriter() noexcept;
+
+    /**
+     * Open the named file for writing, truncating it if it exists.
+     * An empty file name or "-" means stdout.
+     */
+    void open(const std::string& filename);
+
+    /**
+     * Flush the buffer and close the file.
+     */
+    void close();
+
+    /**
+     * Hand all buffered data to the operating system.
+     */
+    void flush();
+
+    bool is_open() const noexcept {
+        return m_fd >= 0;
+    }
+
+    /**
+     * Number of bytes written so far, including bytes still in the buffer.
+     */
+    std::size_t bytes_written() const noexcept {
+        return m_bytes_written + m_used;
+    }
+
+    void write(const char* data, std::size_t size) {
+        if (m_used + size > m_buffer.size()) {
+            flush();
+            if (size > m_buffer.size()) {
+                write_out(data, size);
+                return;
+            }
+        }
+        std::memcpy(m_buffer.data() + m_used, data, size);
+        m_used += size;
+    }
+
+    void write(const char* str) {
+        write(str, std::strlen(str));
+    }
+
+    void write(const std::string& str) {
+        write(str.data(), str.size());
+    }
+
+    void put(char c) {
+        if (m_used == m_buffer.size()) {
+            flush();
+        }
+        m_buffer[m_used++] = c;
+    }
+
+    /**
+     * Write the decimal representation of the value.
+     */
+    void write_int(std::int64_t value) {
+        // 19 digits plus sign is enough for any 64 bit value
+        char tmp[20];
+        char* end = tmp + sizeof(tmp);
+        char* p = end;
+
+        std::uint64_t v = value < 0 ? (~static_cast<std::uint64_t>(value) + 1) : static_cast<std::uint64_t>(value);
+        do {
+            *--p = static_cast<char>('0' + (v % 10));
+            v /= 10;
+        } while (v != 0);
+
+        if (value < 0) {
+            *--p = '-';
+        }
+
+        write(p, static_cast<std::size_t>(end - p));
+    }
+
+}; // class BufferedWriter
+
+#endif // BUFFERED_WRITER_HPP
@@ -0,0 +1,574 @@
+/*
+
+  Streaming writer for FlatGeobuf files.
+
+*/
+
+#include "flatgeobuf_writer.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    // FlatGeobuf version 3.0
+    constexpr const char magic[8] = {'f', 'g', 'b', 3, 'f', 'g', 'b', 0};
+
+    constexpr const std::uint8_t wkb_point           = 1;
+    constexpr const std::uint8_t wkb_linestring      = 2;
+    constexpr const std::uint8_t wkb_polygon         = 3;
+    constexpr const std::uint8_t wkb_multipoint      = 4;
+    constexpr const std::uint8_t wkb_multilinestring = 5;
+    constexpr const std::uint8_t wkb_multipolygon    = 6;
+
+    // Field ids from the FlatGeobuf schema (header.fbs, feature.fbs)
+    namespace header_field {
+        constexpr const std::uint16_t name            = 0;
+        constexpr const std::uint16_t envelope        = 1;
+        constexpr const std::uint16_t geometry_type   = 2;
+        constexpr const std::uint16_t columns         = 7;
+        constexpr const std::uint16_t features_count  = 8;
+        constexpr const std::uint16_t index_node_size = 9;
+        constexpr const std::uint16_t crs             = 10;
+    } // namespace header_field
+
+    namespace column_field {
+        constexpr const std::uint16_t name = 0;
+        constexpr const std::uint16_t type = 1;
+    } // namespace column_field
+
+    namespace crs_field {
+        constexpr const std::uint16_t code = 1;
+    } // namespace crs_field
+
+    namespace geometry_field {
+        constexpr const std::uint16_t ends  = 0;
+        constexpr const std::uint16_t xy    = 1;
+        constexpr const std::uint16_t type  = 6;
+        constexpr const std::uint16_t parts = 7;
+    } // namespace geometry_field
+
+    namespace feature_field {
+        constexpr const std::uint16_t geometry   = 0;
+        constexpr const std::uint16_t properties = 1;
+    } // namespace feature_field
+
+    class wkb_reader {
+
+        const char* m_data;
+        const char* m_end;
+
+    public:
+
+        explicit wkb_reader(const std::string& wkb) :
+            m_data(wkb.data()),
+            m_end(wkb.data() + wkb.size()) {
+        }
+
+        template <typename T>
+        T read() {
+            if (m_end - m_data < static_cast<std::ptrdiff_t>(sizeof(T))) {
+                throw std::runtime_error{"Truncated WKB"};
+            }
+            T value;
+            std::memcpy(&value, m_data, sizeof(T));
+            m_data += sizeof(T);
+            return value;
+        }
+
+        std::uint32_t header() {
+            const std::uint16_t one = 1;
+            char native_order;
+            std::memcpy(&native_order, &one, 1);
+            if (read<char>() != native_order) {
+                throw std::runtime_error{"WKB not in native byte order"};
+            }
+            return read<std::uint32_t>();
+        }
+
+        void points(std::vector<double>& xy, std::uint32_t count) {
+            for (std::uint32_t i = 0; i < count; ++i) {
+                xy.push_back(read<double>());
+                xy.push_back(read<double>());
+            }
+        }
+
+        // Read the rings of a polygon, the ends are only needed if there
+        // is more than one ring.
+        void polygon(std::vector<double>& xy, std::vector<std::uint32_t>& ends) {
+            const auto rings = read<std::uint32_t>();
+            for (std::uint32_t i = 0; i < rings; ++i) {
+                points(xy, read<std::uint32_t>());
+                ends.push_back(static_cast<std::uint32_t>(xy.size() / 2));
+            }
+            if (ends.size() < 2) {
+                ends.clear();
+            }
+        }
+
+    }; // class wkb_reader
+
+    // Compute the position on a Hilbert curve of order 16. This is the
+    // algorithm used by the FlatGeobuf reference implementation.
+    std::uint32_t hilbert(std::uint32_t x, std::uint32_t y) noexcept {
+        std::uint32_t a = x ^ y;
+        std::uint32_t b = 0xFFFF ^ a;
+        std::uint32_t c = 0xFFFF ^ (x | y);
+        std::uint32_t d = x & (y ^ 0xFFFF);
+
+        std::uint32_t A = a | (b >> 1);
+        std::uint32_t B = (a >> 1) ^ a;
+        std::uint32_t C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+        std::uint32_t D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+
+        a = A; b = B; c = C; d = D;
+        A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+        B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+        C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+        D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+
+        a = A; b = B; c = C; d = D;
+        A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+        B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+        C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+        D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+
+        a = A; b = B; c = C; d = D;
+        C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+        D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+
+        a = C ^ (C >> 1);
+        b = D ^ (D >> 1);
+
+        std::uint32_t i0 = x ^ y;
+        std::uint32_t i1 = b | (0xFFFF ^ (i0 | a));
+
+        i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+        i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+        i0 = (i0 | (i0 << 2)) & 0x33333333;
+        i0 = (i0 | (i0 << 1)) & 0x55555555;
+
+        i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+        i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+        i1 = (i1 | (i1 << 2)) & 0x33333333;
+        i1 = (i1 | (i1 << 1)) & 0x55555555;
+
+        return (i1 << 1) | i0;
+    }
+
+    // Start and end node of each level of the packed R-tree, leaves
+    // first. The tree is stored with the root first and leaves last.
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> level_bounds(std::uint64_t num_items, std::uint16_t node_size) {
+        std::vector<std::uint64_t> level_num_nodes;
+        std::uint64_t n = num_items;
+        std::uint64_t num_nodes = n;
+        level_num_nodes.push_back(n);
+        do {
+            n = (n + node_size - 1) / node_size;
+            num_nodes += n;
+            level_num_nodes.push_back(n);
+        } while (n != 1);
+
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> bounds;
+        n = num_nodes;
+        for (const auto size : level_num_nodes) {
+            n -= size;
+            bounds.emplace_back(n, n + size);
+        }
+        return bounds;
+    }
+
+} // anonymous namespace
+
+std::size_t FlatbufferEncoder::table(const std::vector<std::pair<std::uint16_t, std::uint8_t>>& fields,
+                                     std::vector<std::size_t>& positions) {
+    std::uint16_t num_slots = 0;
+    bool has_8byte_field = false;
+    for (const auto& field : fields) {
+        num_slots = std::max(num_slots, static_cast<std::uint16_t>(field.first + 1));
+        has_8byte_field = has_8byte_field || field.second == 8;
+    }
+
+    // Lay out the fields after the vtable offset by decreasing size, so
+    // all of them are aligned without padding in between.
+    std::vector<std::uint16_t> offsets(fields.size());
+    std::uint16_t inline_size = has_8byte_field ? 8 : 4;
+    for (std::uint8_t size = 8; size > 0; size /= 2) {
+        for (std::size_t i = 0; i < fields.size(); ++i) {
+            if (fields[i].second == size) {
+                offsets[i] = inline_size;
+                inline_size = static_cast<std::uint16_t>(inline_size + size);
+            }
+        }
+    }
+
+    pad(2);
+    const std::size_t vtable = size();
+    put(static_cast<std::uint16_t>(4 + 2 * num_slots));
+    put(inline_size);
+    const std::size_t slots = size();
+    for (std::uint16_t i = 0; i < num_slots; ++i) {
+        put(std::uint16_t{0});
+    }
+    for (std::size_t i = 0; i < fields.size(); ++i) {
+        put_at(slots + 2 * fields[i].first, offsets[i]);
+    }
+
+    pad(has_8byte_field ? 8 : 4);
+    const std::size_t table = size();
+    put(static_cast<std::int32_t>(table - vtable));
+    m_data.resize(table + inline_size, '\0');
+
+    positions.clear();
+    for (const auto offset : offsets) {
+        positions.push_back(table + offset);
+    }
+    return table;
+}
+
+FlatGeobufWriter::FlatGeobufWriter(const std::string& filename,
+                                   const std::string& layer_name,
+                                   std::uint8_t geometry_type,
+                                   std::vector<column> columns,
+                                   int epsg) :
+    m_filename(filename),
+    m_tmp_filename(filename + ".tmp"),
+    m_layer_name(layer_name),
+    m_geometry_type(geometry_type),
+    m_columns(std::move(columns)),
+    m_epsg(epsg) {
+    m_tmp.open(m_tmp_filename);
+}
+
+FlatGeobufWriter::~FlatGeobufWriter() noexcept {
+    try {
+        close();
+    } catch (...) {
+        // ignore exceptions in destructor
+    }
+}
+
+void FlatGeobufWriter::decode_wkb(const std::string& wkb) {
+    m_geometry.xy.clear();
+    m_geometry.ends.clear();
+    m_geometry.parts.clear();
+
+    wkb_reader reader{wkb};
+    const auto type = reader.header();
+    m_geometry.type = static_cast<std::uint8_t>(type);
+
+    switch (type) {
+        case wkb_point:
+            reader.points(m_geometry.xy, 1);
+            break;
+        case wkb_linestring:
+            reader.points(m_geometry.xy, reader.read<std::uint32_t>());
+            break;
+        case wkb_polygon:
+            reader.polygon(m_geometry.xy, m_geometry.ends);
+            break;
+        case wkb_multipoint: {
+                const auto count = reader.read<std::uint32_t>();
+                for (std::uint32_t i = 0; i < count; ++i) {
+                    reader.header();
+                    reader.points(m_geometry.xy, 1);
+                }
+            }
+            break;
+        case wkb_multilinestring: {
+                const auto count = reader.read<std::uint32_t>();
+                for (std::uint32_t i = 0; i < count; ++i) {
+                    reader.header();
+                    reader.points(m_geometry.xy, reader.read<std::uint32_t>());
+                    m_geometry.ends.push_back(static_cast<std::uint32_t>(m_geometry.xy.size() / 2));
+                }
+                if (m_geometry.ends.size() < 2) {
+                    m_geometry.ends.clear();
+                }
+            }
+            break;
+        case wkb_multipolygon: {
+                const auto count = reader.read<std::uint32_t>();
+                m_geometry.parts.resize(count);
+                for (auto& part : m_geometry.parts) {
+                    reader.header();
+                    part.type = wkb_polygon;
+                    reader.polygon(part.xy, part.ends);
+                }
+            }
+            break;
+        default:
+            throw std::runtime_error{"Unsupported WKB geometry type " + std::to_string(type)};
+    }
+
+    m_bbox.min_x = std::numeric_limits<double>::max();
+    m_bbox.min_y = std::numeric_limits<double>::max();
+    m_bbox.max_x = std::numeric_limits<double>::lowest();
+    m_bbox.max_y = std::numeric_limits<double>::lowest();
+    const auto expand = [this](const std::vector<double>& xy) {
+        for (std::size_t i = 0; i + 1 < xy.size(); i += 2) {
+            m_bbox.min_x = std::min(m_bbox.min_x, xy[i]);
+            m_bbox.min_y = std::min(m_bbox.min_y, xy[i + 1]);
+            m_bbox.max_x = std::max(m_bbox.max_x, xy[i]);
+            m_bbox.max_y = std::max(m_bbox.max_y, xy[i + 1]);
+        }
+    };
+    expand(m_geometry.xy);
+    for (const auto& part : m_geometry.parts) {
+        expand(part.xy);
+    }
+}
+
+void FlatGeobufWriter::write_geometry(const geometry& geom, std::size_t field) {
+    std::vector<std::pair<std::uint16_t, std::uint8_t>> fields{{geometry_field::type, 1}};
+    if (!geom.ends.empty()) {
+        fields.emplace_back(geometry_field::ends, 4);
+    }
+    if (!geom.xy.empty()) {
+        fields.emplace_back(geometry_field::xy, 4);
+    }
+    if (!geom.parts.empty()) {
+        fields.emplace_back(geometry_field::parts, 4);
+    }
+
+    std::vector<std::size_t> positions;
+    m_encoder.set_offset(field, m_encoder.table(fields, positions));
+    m_encoder.put_at(positions[0], geom.type);
+
+    std::size_t next = 1;
+    if (!geom.ends.empty()) {
+        m_encoder.set_offset(positions[next++], m_encoder.vector(static_cast<std::uint32_t>(geom.ends.size()), 4));
+        m_encoder.append(reinterpret_cast<const char*>(geom.ends.data()), geom.ends.size() * sizeof(std::uint32_t));
+    }
+    if (!geom.xy.empty()) {
+        m_encoder.set_offset(positions[next++], m_encoder.vector(static_cast<std::uint32_t>(geom.xy.size()), 8));
+        m_encoder.append(reinterpret_cast<const char*>(geom.xy.data()), geom.xy.size() * sizeof(double));
+    }
+    if (!geom.parts.empty()) {
+        const std::size_t parts = m_encoder.vector(static_cast<std::uint32_t>(geom.parts.size()), 4);
+        m_encoder.set_offset(positions[next], parts);
+        for (std::size_t i = 0; i < geom.parts.size(); ++i) {
+            m_encoder.put(std::uint32_t{0});
+        }
+        for (std::size_t i = 0; i < geom.parts.size(); ++i) {
+            write_geometry(geom.parts[i], parts + 4 + 4 * i);
+        }
+    }
+}
+
+void FlatGeobufWriter::set_geometry(const std::string& wkb) {
+    decode_wkb(wkb);
+}
+
+void FlatGeobufWriter::set_field(int column, double value) {
+    const auto index = static_cast<std::uint16_t>(column);
+    m_properties.append(reinterpret_cast<const char*>(&index), sizeof(index));
+    m_properties.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void FlatGeobufWriter::set_field(int column, std::int64_t value) {
+    const auto index = static_cast<std::uint16_t>(column);
+    m_properties.append(reinterpret_cast<const char*>(&index), sizeof(index));
+    m_properties.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void FlatGeobufWriter::set_field(int column, const char* value) {
+    if (!value) {
+        return;
+    }
+    const auto index = static_cast<std::uint16_t>(column);
+    const auto length = static_cast<std::uint32_t>(std::strlen(value));
+    m_properties.append(reinterpret_cast<const char*>(&index), sizeof(index));
+    m_properties.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    m_properties.append(value, length);
+}
+
+void FlatGeobufWriter::add_feature() {
+    std::vector<std::pair<std::uint16_t, std::uint8_t>> fields{{feature_field::geometry, 4}};
+    if (!m_properties.empty()) {
+        fields.emplace_back(feature_field::properties, 4);
+    }
+
+    const std::size_t root = m_encoder.begin_root();
+    std::vector<std::size_t> positions;
+    m_encoder.set_offset(root, m_encoder.table(fields, positions));
+    const std::size_t properties_field = m_properties.empty() ? 0 : positions[1];
+
+    write_geometry(m_geometry, positions[0]);
+    if (properties_field) {
+        m_encoder.set_offset(properties_field, m_encoder.vector(static_cast<std::uint32_t>(m_properties.size()), 1));
+        m_encoder.append(m_properties.data(), m_properties.size());
+    }
+
+    const auto size = static_cast<std::uint32_t>(m_encoder.size());
+    m_bbox.offset = m_tmp.bytes_written();
+    m_tmp.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    m_tmp.write(m_encoder.data());
+
+    m_items.push_back(m_bbox);
+    m_sizes.push_back(size + sizeof(size));
+    m_properties.clear();
+}
+
+std::string FlatGeobufWriter::encode_header(const node_item& extent) {
+    const bool has_features = !m_items.empty();
+
+    std::vector<std::pair<std::uint16_t, std::uint8_t>> fields{
+        {header_field::name, 4},
+        {header_field::geometry_type, 1},
+        {header_field::columns, 4},
+        {header_field::features_count, 8},
+        {header_field::index_node_size, 2},
+        {header_field::crs, 4}
+    };
+    if (has_features) {
+        fields.emplace_back(header_field::envelope, 4);
+    }
+
+    const std::size_t root = m_encoder.begin_root();
+    std::vector<std::size_t> header;
+    m_encoder.set_offset(root, m_encoder.table(fields, header));
+
+    m_encoder.set_offset(header[0], m_encoder.string(m_layer_name));
+    m_encoder.put_at(header[1], m_geometry_type);
+    m_encoder.put_at(header[3], static_cast<std::uint64_t>(m_items.size()));
+    m_encoder.put_at(header[4], static_cast<std::uint16_t>(has_features ? index_node_size : 0));
+
+    const std::size_t columns = m_encoder.vector(static_cast<std::uint32_t>(m_columns.size()), 4);
+    m_encoder.set_offset(header[2], columns);
+    for (std::size_t i = 0; i < m_columns.size(); ++i) {
+        m_encoder.put(std::uint32_t{0});
+    }
+    std::vector<std::size_t> column;
+    for (std::size_t i = 0; i < m_columns.size(); ++i) {
+        m_encoder.set_offset(columns + 4 + 4 * i, m_encoder.table({{column_field::name, 4}, {column_field::type, 1}}, column));
+        m_encoder.put_at(column[1], static_cast<std::uint8_t>(m_columns[i].type));
+        m_encoder.set_offset(column[0], m_encoder.string(m_columns[i].name));
+    }
+
+    std::vector<std::size_t> crs;
+    m_encoder.set_offset(header[5], m_encoder.table({{crs_field::code, 4}}, crs));
+    m_encoder.put_at(crs[0], static_cast<std::int32_t>(m_epsg));
+
+    if (has_features) {
+        m_encoder.set_offset(header[6], m_encoder.vector(4, 8));
+        m_encoder.put(extent.min_x);
+        m_encoder.put(extent.min_y);
+        m_encoder.put(extent.max_x);
+        m_encoder.put(extent.max_y);
+    }
+
+    return m_encoder.data();
+}
+
+void FlatGeobufWriter::close() {
+    if (!m_tmp.is_open()) {
+        return;
+    }
+    m_tmp.close();
+
+    static_assert(sizeof(node_item) == 40, "index nodes must have 40 bytes");
+
+    node_item extent{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                     std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), 0};
+    for (const auto& item : m_items) {
+        extent.min_x = std::min(extent.min_x, item.min_x);
+        extent.min_y = std::min(extent.min_y, item.min_y);
+        extent.max_x = std::max(extent.max_x, item.max_x);
+        extent.max_y = std::max(extent.max_y, item.max_y);
+    }
+
+    // Sort the features along the Hilbert curve through the centers of
+    // their bounding boxes.
+    const double width = extent.max_x - extent.min_x;
+    const double height = extent.max_y - extent.min_y;
+    constexpr const double hilbert_max = (1U << 16U) - 1;
+    std::vector<std::uint32_t> hilbert_values;
+    hilbert_values.reserve(m_items.size());
+    for (const auto& item : m_items) {
+        std::uint32_t x = 0;
+        std::uint32_t y = 0;
+        if (width != 0.0) {
+            x = static_cast<std::uint32_t>(std::floor(hilbert_max * ((item.min_x + item.max_x) / 2 - extent.min_x) / width));
+        }
+        if (height != 0.0) {
+            y = static_cast<std::uint32_t>(std::floor(hilbert_max * ((item.min_y + item.max_y) / 2 - extent.min_y) / height));
+        }
+        hilbert_values.push_back(hilbert(x, y));
+    }
+
+    std::vector<std::size_t> order(m_items.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&hilbert_values](std::size_t a, std::size_t b) {
+        return hilbert_values[a] > hilbert_values[b];
+    });
+
+    BufferedWriter out;
+    out.open(m_filename);
+    out.write(magic, sizeof(magic));
+
+    const std::string header = encode_header(extent);
+    const auto header_size = static_cast<std::uint32_t>(header.size());
+    out.write(reinterpret_cast<const char*>(&header_size), sizeof(header_size));
+    out.write(header);
+
+    if (!m_items.empty()) {
+        // Build the packed R-tree. The leaves point to the features in
+        // their final order, each parent covers up to index_node_size
+        // nodes of the level below.
+        const auto bounds = level_bounds(m_items.size(), index_node_size);
+        std::vector<node_item> nodes(bounds.front().second);
+        std::uint64_t offset = 0;
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            node_item& leaf = nodes[bounds.front().first + i];
+            leaf = m_items[order[i]];
+            leaf.offset = offset;
+            offset += m_sizes[order[i]];
+        }
+
+        for (std::size_t level = 0; level + 1 < bounds.size(); ++level) {
+            std::uint64_t pos = bounds[level].first;
+            const std::uint64_t end = bounds[level].second;
+            std::uint64_t parent = bounds[level + 1].first;
+            while (pos < end) {
+                node_item node{std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                               std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), pos};
+                for (std::uint16_t j = 0; j < index_node_size && pos < end; ++j, ++pos) {
+                    node.min_x = std::min(node.min_x, nodes[pos].min_x);
+                    node.min_y = std::min(node.min_y, nodes[pos].min_y);
+                    node.max_x = std::max(node.max_x, nodes[pos].max_x);
+                    node.max_y = std::max(node.max_y, nodes[pos].max_y);
+                }
+                nodes[parent++] = node;
+            }
+        }
+        out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(node_item));
+
+        // Copy the features from the temporary file in index order.
+        const int fd = osmium::io::detail::open_for_reading(m_tmp_filename);
+        const std::size_t tmp_size = osmium::file_size(fd);
+        osmium::util::MemoryMapping mapping{tmp_size, osmium::util::MemoryMapping::mapping_mode::readonly, fd};
+        osmium::io::detail::reliable_close(fd);
+        const char* data = mapping.get_addr<char>();
+        for (const auto i : order) {
+            out.write(data + m_items[i].offset, m_sizes[i]);
+        }
+    }
+
+    out.close();
+    std::remove(m_tmp_filename.c_str());
+}
@@ -0,0 +1,236 @@
+#ifndef FLATGEOBUF_WRITER_HPP
+#define FLATGEOBUF_WRITER_HPP
+
+/*
+
+  Streaming writer for FlatGeobuf files (https://flatgeobuf.org/) that
+  doesn't need OGR or the flatbuffers library.
+
+  Features are given with their geometry as WKB in native byte order (as
+  created by the osmium WKBFactory). They are encoded as flatbuffers and
+  written to a temporary file next to the output file, only their
+  bounding boxes are kept in memory. On close() the features are sorted
+  along a Hilbert curve, the packed Hilbert R-tree is built and the
+  final file is written: magic bytes, header, index and the features in
+  index order.
+
+*/
+
+#include "buffered_writer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal flatbuffers encoder. Unlike the builder of the flatbuffers
+ * library it writes front to back: every vtable directly before its
+ * table and all children after the object referencing them. Offsets to
+ * children are filled in once the children are written.
+ */
+class FlatbufferEncoder {
+
+    std::string m_data;
+
+public:
+
+    void clear() {
+        m_data.clear();
+    }
+
+    const std::string& data() const noexcept {
+        return m_data;
+    }
+
+    std::size_t size() const noexcept {
+        return m_data.size();
+    }
+
+    // Pad with zeros until (size + extra) is a multiple of alignment.
+    void pad(std::size_t alignment, std::size_t extra = 0) {
+        while ((m_data.size() + extra) % alignment != 0) {
+            m_data.push_back('\0');
+        }
+    }
+
+    void append(const char* data, std::size_t size) {
+        m_data.append(data, size);
+    }
+
+    template <typename T>
+    void put(T value) {
+        m_data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void put_at(std::size_t pos, T value) {
+        m_data.replace(pos, sizeof(T), reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    /**
+     * Let the offset field at position field point to position target.
+     */
+    void set_offset(std::size_t field, std::size_t target) {
+        put_at(field, static_cast<std::uint32_t>(target - field));
+    }
+
+    /**
+     * Start the buffer with the offset to the root table. Returns the
+     * position of that offset.
+     */
+    std::size_t begin_root() {
+        clear();
+        put(std::uint32_t{0});
+        return 0;
+    }
+
+    /**
+     * Write a table with the given fields as (field id, size in bytes)
+     * pairs, the values are zeroed. Returns the position of the table
+     * and fills positions with the position of each field.
+     */
+    std::size_t table(const std::vector<std::pair<std::uint16_t, std::uint8_t>>& fields,
+                      std::vector<std::size_t>& positions);
+
+    /**
+     * Write the length of a vector with elements of the given size.
+     * Returns the position of the vector. The elements must be appended
+     * with put() directly afterwards.
+     */
+    std::size_t vector(std::uint32_t length, std::size_t element_size) {
+        pad(element_size > 4 ? element_size : 4, 4);
+        const std::size_t pos = m_data.size();
+        put(length);
+        return pos;
+    }
+
+    /**
+     * Write a string. Returns its position.
+     */
+    std::size_t string(const std::string& str) {
+        const std::size_t pos = vector(static_cast<std::uint32_t>(str.size()), 1);
+        m_data.append(str);
+        m_data.push_back('\0');
+        return pos;
+    }
+
+}; // class FlatbufferEncoder
+
+class FlatGeobufWriter {
+
+public:
+
+    // The FlatGeobuf column types used here.
+    enum class column_type : std::uint8_t {
+        long_type   = 7,
+        double_type = 10,
+        string_type = 11
+    };
+
+    struct column {
+        std::string name;
+        column_type type;
+    };
+
+    /**
+     * The node size of the spatial index, the FlatGeobuf default.
+     */
+    static constexpr const std::uint16_t index_node_size = 16;
+
+private:
+
+    // Bounding box and location in the temporary file of one feature,
+    // later a node of the index.
+    struct node_item {
+        double min_x;
+        double min_y;
+        double max_x;
+        double max_y;
+        std::uint64_t offset;
+    };
+
+    // A geometry decoded from WKB in the form FlatGeobuf needs it.
+    struct geometry {
+        std::uint8_t type = 0;
+        std::vector<double> xy;
+        std::vector<std::uint32_t> ends;
+        std::vector<geometry> parts;
+    };
+
+    std::string m_filename;
+    std::string m_tmp_filename;
+    std::string m_layer_name;
+    std::uint8_t m_geometry_type;
+    std::vector<column> m_columns;
+    int m_epsg;
+
+    BufferedWriter m_tmp;
+
+    std::vector<node_item> m_items;
+    std::vector<std::uint32_t> m_sizes;
+
+    // Data for the current feature.
+    geometry m_geometry;
+    node_item m_bbox;
+    std::string m_properties;
+
+    FlatbufferEncoder m_encoder;
+
+    void decode_wkb(const std::string& wkb);
+    void write_geometry(const geometry& geom, std::size_t field);
+    std::string encode_header(const node_item& extent);
+
+public:
+
+    /**
+     * Create writer for a file with one layer. The geometry type is the
+     * WKB type code (2 = LineString, 6 = MultiPolygon etc.).
+     */
+    FlatGeobufWriter(const std::string& filename,
+                     const std::string& layer_name,
+                     std::uint8_t geometry_type,
+                     std::vector<column> columns,
+                     int epsg = 4326);
+
+    FlatGeobufWriter(const FlatGeobufWriter&) = delete;
+    FlatGeobufWriter& operator=(const FlatGeobufWriter&) = delete;
+
+    ~FlatGeobufWriter() noexcept;
+
+    /**
+     * Set the geometry of the current feature from WKB.
+     */
+    void set_geometry(const std::string& wkb);
+
+    /**
+     * Set the column with the given index of the current feature.
+     * Columns not set are NULL.
+     */
+    void set_field(int column, double value);
+    void set_field(int column, std::int64_t value);
+
+    /**
+     * Set the column with the given index of the current feature. A
+     * nullptr means NULL.
+     */
+    void set_field(int column, const char* value);
+
+    /**
+     * Add the current feature.
+     */
+    void add_feature();
+
+    std::uint64_t features() const noexcept {
+        return m_items.size();
+    }
+
+    /**
+     * Build the index and write the final file.
+     */
+    void close();
+
+}; // class FlatGeobufWriter
+
+#endif // FLATGEOBUF_WRITER_HPP
@@ -0,0 +1,155 @@
+#ifndef GEOMETRY_PIPELINE_HPP
+#define GEOMETRY_PIPELINE_HPP
+
+/*
+
+  Pipeline for building feature geometries on several threads.
+
+  The thread running osmium::apply() hands over complete buffers. Worker
+  threads from a thread pool turn the objects in each buffer into a
+  result, usually a list of features ready to be written, with their
+  geometries as WKB or already as OGR geometries. A single writer thread
+  takes the results in the order in which the buffers were submitted
+  and writes them out. So the output is the same as if everything had
+  been done on one thread.
+
+  It is used for the water areas of osmium_toogr2 and osmium_export_all.
+
+*/
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/thread/pool.hpp>
+#include <osmium/thread/queue.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <future>
+#include <thread>
+#include <utility>
+
+template <typename TResult>
+class GeometryPipeline {
+
+public:
+
+    using build_func_type = std::function<TResult(const osmium::memory::Buffer&)>;
+    using write_func_type = std::function<void(TResult&)>;
+
+private:
+
+    using future_type = std::future<TResult>;
+
+    // The task run on the worker threads. It owns the buffer until the
+    // result is built.
+    class build_task {
+
+        osmium::memory::Buffer m_buffer;
+        const build_func_type* m_build;
+
+    public:
+
+        build_task(osmium::memory::Buffer&& buffer, const build_func_type& build) :
+            m_buffer(std::move(buffer)),
+            m_build(&build) {
+        }
+
+        TResult operator()() {
+            return (*m_build)(m_buffer);
+        }
+
+    }; // class build_task
+
+    build_func_type m_build;
+    write_func_type m_write;
+
+    osmium::thread::Pool m_pool;
+
+    // Futures for the results in submission order. An invalid future
+    // marks the end of the input.
+    osmium::thread::Queue<future_type> m_queue;
+
+    std::exception_ptr m_error;
+    std::thread m_writer;
+
+    void write_results() {
+        while (true) {
+            future_type future;
+            m_queue.wait_and_pop(future);
+            if (!future.valid()) {
+                return;
+            }
+
+            // After an error keep taking results from the queue, so the
+            // thread submitting buffers doesn't block forever.
+            try {
+                TResult result = future.get();
+                if (!m_error) {
+                    m_write(result);
+                }
+            } catch (...) {
+                if (!m_error) {
+                    m_error = std::current_exception();
+                }
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Create pipeline with the given number of worker threads (0 for the
+     * osmium default). The build function is called on the worker
+     * threads, the write function always on the one writer thread.
+     */
+    GeometryPipeline(int num_threads, build_func_type build, write_func_type write) :
+        m_build(std::move(build)),
+        m_write(std::move(write)),
+        m_pool(num_threads),
+        m_queue(static_cast<std::size_t>(std::max(m_pool.num_threads() * 2, 8)), "geometry_results"),
+        m_error(),
+        m_writer(&GeometryPipeline::write_results, this) {
+    }
+
+    GeometryPipeline(const GeometryPipeline&) = delete;
+    GeometryPipeline& operator=(const GeometryPipeline&) = delete;
+
+    ~GeometryPipeline() noexcept {
+        try {
+            finish();
+        } catch (...) {
+            // ignore exceptions in destructor
+        }
+    }
+
+    int num_threads() const noexcept {
+        return m_pool.num_threads();
+    }
+
+    /**
+     * Hand over a buffer. Blocks if the workers or the writer fall too
+     * far behind.
+     */
+    void submit(osmium::memory::Buffer&& buffer) {
+        m_queue.push(m_pool.submit(build_task{std::move(buffer), m_build}));
+    }
+
+    /**
+     * Wait until all submitted buffers are written. Rethrows the first
+     * exception thrown by a build or write function.
+     */
+    void finish() {
+        if (m_writer.joinable()) {
+            m_queue.push(future_type{});
+            m_writer.join();
+        }
+        if (m_error) {
+            std::exception_ptr error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+}; // class GeometryPipeline
+
+#endif // GEOMETRY_PIPELINE_HPP
@@ -0,0 +1,226 @@
+/*
+
+  Layer definitions of osmium_toogr, read from a config file.
+
+*/
+
+#include "layer_config.hpp"
+
+#include "util.hpp"
+
+#include <osmium/util/string.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // The layers osmium_toogr had built in before layers were configurable.
+    const char builtin_layers[] =
+        "layer places point\n"
+        "    match place=town,city\n"
+        "    field id real 10 @id\n"
+        "    field type string 32 place\n"
+        "    field name string 32 name\n"
+        "\n"
+        "layer peaks point\n"
+        "    match natural=peak\n"
+        "    field id real 10 @id\n"
+        "    field type string 32 natural\n"
+        "    field name string 32 name\n"
+        "    field importance string 32 importance\n"
+        "    field ele string 12 ele\n"
+        "\n"
+        "layer roads linestring\n"
+        "    match highway=motorway,motorway_link\n"
+        "    field id real 10 @id\n"
+        "    field type string 32 highway\n"
+        "    field name string 32 name\n"
+        "    field ref string 16 ref\n"
+        "\n"
+        "layer railways linestring\n"
+        "    match railway=rail\n"
+        "    field id real 10 @id\n"
+        "\n"
+        "layer boundaries linestring\n"
+        "    match boundary=administrative\n"
+        "    field id real 10 @id\n"
+        "    field level integer 4 admin_level 99\n";
+
+    // Split a key or value of a match expression into the strings it
+    // matches exactly. Returns false if it has wildcards.
+    bool exact_strings(std::string str, std::vector<std::string>& strings) {
+        strip_whitespace(str);
+        strings.clear();
+
+        if (!str.empty() && (str.front() == '*' || str.back() == '*')) {
+            return false;
+        }
+
+        if (str.find(',') == std::string::npos) {
+            strings.push_back(str);
+            return true;
+        }
+
+        strings = osmium::split_string(str, ',');
+        for (auto& s : strings) {
+            strip_whitespace(s);
+        }
+        return true;
+    }
+
+} // anonymous namespace
+
+constexpr const int LayerConfig::object_id;
+
+void LayerConfig::add_match(const std::string& expression, int layer_index, TagDispatcher& dispatcher) {
+    const auto op_pos = expression.find('=');
+    const bool has_value = op_pos != std::string::npos;
+    const std::string key = expression.substr(0, op_pos);
+
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    const bool exact = (key.empty() || key.back() != '!') &&
+                       exact_strings(key, keys) &&
+                       (!has_value || exact_strings(expression.substr(op_pos + 1), values));
+
+    if (!exact) {
+        dispatcher.add_rule(get_tag_matcher(expression), layer_index);
+        return;
+    }
+
+    for (const auto& k : keys) {
+        if (!has_value) {
+            dispatcher.add_rule(k.c_str(), nullptr, layer_index);
+        }
+        for (const auto& v : values) {
+            dispatcher.add_rule(k.c_str(), v.c_str(), layer_index);
+        }
+    }
+}
+
+LayerConfig::LayerConfig(std::istream& in, const std::string& name) {
+    int line_number = 0;
+    const auto error = [&](const std::string& message) {
+        return std::runtime_error{name + ":" + std::to_string(line_number) + ": " + message};
+    };
+
+    for (std::string line; std::getline(in, line);) {
+        ++line_number;
+        const auto pos = line.find_first_of('#');
+        if (pos != std::string::npos) {
+            line.erase(pos);
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.resize(line.size() - 1);
+        }
+
+        std::istringstream tokens{line};
+        std::string keyword;
+        if (!(tokens >> keyword)) {
+            continue;
+        }
+
+        if (keyword == "layer") {
+            layer l;
+            std::string geometry;
+            if (!(tokens >> l.name >> geometry)) {
+                throw error("Expected 'layer NAME point|linestring'");
+            }
+            if (geometry == "point") {
+                l.geometry = geometry_type::point;
+            } else if (geometry == "linestring") {
+                l.geometry = geometry_type::linestring;
+            } else {
+                throw error("Unknown geometry type '" + geometry + "'");
+            }
+            for (const auto& other : m_layers) {
+                if (other.name == l.name) {
+                    throw error("Duplicate layer '" + l.name + "'");
+                }
+            }
+            m_layers.push_back(l);
+            continue;
+        }
+
+        if (m_layers.empty()) {
+            throw error("'" + keyword + "' before the first layer");
+        }
+        layer& current = m_layers.back();
+        TagDispatcher& dispatcher = current.geometry == geometry_type::point ? m_node_dispatcher : m_way_dispatcher;
+
+        if (keyword == "match") {
+            std::string expression;
+            std::getline(tokens, expression);
+            strip_whitespace(expression);
+            if (expression.empty()) {
+                throw error("Expected 'match EXPRESSION'");
+            }
+            add_match(expression, static_cast<int>(m_layers.size() - 1), dispatcher);
+        } else if (keyword == "field") {
+            field f;
+            std::string type;
+            std::string source;
+            if (!(tokens >> f.name >> type >> f.width >> source) || f.width <= 0) {
+                throw error("Expected 'field NAME integer|real|string WIDTH SOURCE [DEFAULT]'");
+            }
+            if (type == "integer") {
+                f.type = field_type::integer;
+            } else if (type == "real") {
+                f.type = field_type::real;
+            } else if (type == "string") {
+                f.type = field_type::string;
+            } else {
+                throw error("Unknown field type '" + type + "'");
+            }
+            if (source == "@id") {
+                if (f.type == field_type::integer) {
+                    throw error("Object ids don't fit into integer fields, use real");
+                }
+                f.attribute = object_id;
+            } else {
+                f.attribute = dispatcher.add_attribute(source.c_str());
+            }
+            f.has_default = static_cast<bool>(tokens >> f.default_value);
+            current.fields.push_back(f);
+        } else {
+            throw error("Unknown keyword '" + keyword + "'");
+        }
+    }
+
+    if (m_layers.empty()) {
+        throw std::runtime_error{name + ": No layers defined"};
+    }
+
+    m_node_dispatcher.build();
+    m_way_dispatcher.build();
+}
+
+LayerConfig LayerConfig::builtin() {
+    std::istringstream in{builtin_layers};
+    return LayerConfig{in, "builtin layers"};
+}
+
+LayerConfig LayerConfig::from_file(const std::string& filename) {
+    std::ifstream in{filename};
+    if (!in.is_open()) {
+        throw std::runtime_error{"Could not open file '" + filename + "'"};
+    }
+    return LayerConfig{in, filename};
+}
+
+const char* LayerConfig::builtin_text() noexcept {
+    return builtin_layers;
+}
+
+std::size_t LayerConfig::max_attributes() const noexcept {
+    return std::max<std::size_t>({m_node_dispatcher.num_attributes(), m_way_dispatcher.num_attributes(), 1});
+}
+
+bool LayerConfig::wanted(const osmium::Way& way) const {
+    return m_way_dispatcher.classify(way.tags(), nullptr) != TagDispatcher::no_target;
+}
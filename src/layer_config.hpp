@@ -0,0 +1,122 @@
+#ifndef LAYER_CONFIG_HPP
+#define LAYER_CONFIG_HPP
+
+/*
+
+  Layer definitions of osmium_toogr, read from a config file:
+
+    # comment
+    layer NAME point|linestring
+        match EXPRESSION
+        field NAME integer|real|string WIDTH SOURCE [DEFAULT]
+
+  EXPRESSION has the syntax of tag filter expressions (see
+  get_tag_matcher() in util.cpp): KEY, KEY=VALUE, KEY=VALUE1,VALUE2,
+  KEY!=VALUE, and * at the start or end of keys and values for substring
+  and prefix matches. An object matching any of the expressions of a
+  layer belongs to it. Point layers get nodes, linestring layers ways.
+
+  SOURCE is a tag key or @id for the object id. DEFAULT is used if the
+  object doesn't have the tag.
+
+  The rules of all layers are compiled into one TagDispatcher per object
+  type, so each object goes through its tags only once, no matter how
+  many layers there are. An object matching several layers only goes
+  into the first one.
+
+*/
+
+#include <osmium/osm/way.hpp>
+
+#include "tag_dispatch.hpp"
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <vector>
+
+class LayerConfig {
+
+public:
+
+    enum class geometry_type {
+        point,
+        linestring
+    };
+
+    enum class field_type {
+        integer,
+        real,
+        string
+    };
+
+    static constexpr const int object_id = -1;
+
+    struct field {
+        std::string name;
+        field_type type;
+        int width;
+        int attribute; // index into the classify() values or object_id
+        bool has_default;
+        std::string default_value;
+    };
+
+    struct layer {
+        std::string name;
+        geometry_type geometry;
+        std::vector<field> fields;
+    };
+
+private:
+
+    std::vector<layer> m_layers;
+
+    // Targets are indexes into m_layers.
+    TagDispatcher m_node_dispatcher;
+    TagDispatcher m_way_dispatcher;
+
+    void add_match(const std::string& expression, int layer_index, TagDispatcher& dispatcher);
+
+public:
+
+    /**
+     * Read the layers from a stream. The name is only used in error
+     * messages.
+     */
+    LayerConfig(std::istream& in, const std::string& name);
+
+    /**
+     * The layers written by osmium_toogr if no config is given: places,
+     * peaks, roads, railways and boundaries.
+     */
+    static LayerConfig builtin();
+
+    static LayerConfig from_file(const std::string& filename);
+
+    static const char* builtin_text() noexcept;
+
+    const std::vector<layer>& layers() const noexcept {
+        return m_layers;
+    }
+
+    const TagDispatcher& node_dispatcher() const noexcept {
+        return m_node_dispatcher;
+    }
+
+    const TagDispatcher& way_dispatcher() const noexcept {
+        return m_way_dispatcher;
+    }
+
+    /**
+     * The number of values needed for classify() with either dispatcher.
+     */
+    std::size_t max_attributes() const noexcept;
+
+    /**
+     * Does the way go into any layer?
+     */
+    bool wanted(const osmium::Way& way) const;
+
+}; // class LayerConfig
+
+#endif // LAYER_CONFIG_HPP
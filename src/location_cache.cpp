@@ -0,0 +1,170 @@
+/*
+
+  Node location cache shared between tool runs.
+
+*/
+
+#include "location_cache.hpp"
+
+#include <osmium/index/index.hpp>
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/util/file.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+    constexpr const char cache_magic[8] = {'L', 'O', 'C', 'C', 'A', 'C', 'H', 1};
+
+    constexpr const std::uint64_t layout_dense  = 0;
+    constexpr const std::uint64_t layout_sparse = 1;
+
+    struct cache_header {
+        char magic[8];
+        std::uint64_t layout;
+    };
+
+    // id and location of one node in the sparse layout
+    constexpr const std::size_t sparse_entry_size = sizeof(std::uint64_t) + 2 * sizeof(std::int32_t);
+
+    // Undefined locations written in one go for gaps in the dense layout.
+    constexpr const std::size_t gap_block_size = 1024;
+
+} // anonymous namespace
+
+LocationCacheWriter::LocationCacheWriter(const std::string& filename, bool dense) :
+    m_dense(dense) {
+    if (dense) {
+        const osmium::Location undefined{};
+        for (std::size_t i = 0; i < gap_block_size; ++i) {
+            m_gap.push_back(undefined.x());
+            m_gap.push_back(undefined.y());
+        }
+    }
+
+    cache_header header;
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.layout = dense ? layout_dense : layout_sparse;
+
+    m_out.open(filename);
+    m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void LocationCacheWriter::write_location(const osmium::Location& location) {
+    const std::int32_t xy[2] = {location.x(), location.y()};
+    m_out.write(reinterpret_cast<const char*>(xy), sizeof(xy));
+}
+
+void LocationCacheWriter::node(const osmium::Node& node) {
+    if (node.id() <= 0) {
+        return;
+    }
+
+    const auto id = static_cast<std::uint64_t>(node.id());
+    if (id < m_next_id) {
+        throw std::runtime_error{"Saving locations needs an input file sorted by id (node " +
+                                 std::to_string(id) + " out of order)"};
+    }
+
+    if (m_dense) {
+        while (id > m_next_id) {
+            const std::uint64_t count = std::min<std::uint64_t>(id - m_next_id, gap_block_size);
+            m_out.write(reinterpret_cast<const char*>(m_gap.data()), count * 2 * sizeof(std::int32_t));
+            m_next_id += count;
+        }
+    } else {
+        m_out.write(reinterpret_cast<const char*>(&id), sizeof(id));
+    }
+
+    write_location(node.location());
+    m_next_id = id + 1;
+    ++m_nodes;
+}
+
+LocationCacheMap::LocationCacheMap(const std::string& filename) {
+    const int fd = osmium::io::detail::open_for_reading(filename);
+    const std::size_t file_size = osmium::file_size(fd);
+
+    if (file_size < sizeof(cache_header)) {
+        osmium::io::detail::reliable_close(fd);
+        throw std::runtime_error(std::string("Location cache too short: ") + filename);
+    }
+
+    m_mapping.reset(new osmium::util::MemoryMapping{file_size, osmium::util::MemoryMapping::mapping_mode::readonly, fd});
+    osmium::io::detail::reliable_close(fd);
+
+    const char* data = m_mapping->get_addr<char>();
+    cache_header header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        (header.layout != layout_dense && header.layout != layout_sparse)) {
+        throw std::runtime_error(std::string("Not a location cache: ") + filename);
+    }
+
+    m_dense = header.layout == layout_dense;
+    const std::size_t entry_size = m_dense ? 2 * sizeof(std::int32_t) : sparse_entry_size;
+    const std::size_t data_size = file_size - sizeof(cache_header);
+    if (data_size % entry_size != 0) {
+        throw std::runtime_error(std::string("Location cache corrupt: ") + filename);
+    }
+    m_size = data_size / entry_size;
+
+    // The header size is a multiple of 8, so the data is aligned.
+    if (m_dense) {
+        m_locations = reinterpret_cast<const std::int32_t*>(data + sizeof(cache_header));
+    } else {
+        m_entries = data + sizeof(cache_header);
+    }
+}
+
+void LocationCacheMap::set(const osmium::unsigned_object_id_type id, const osmium::Location /*value*/) {
+    throw std::runtime_error{"Location cache is read-only (setting node " + std::to_string(id) + ")"};
+}
+
+osmium::Location LocationCacheMap::get(const osmium::unsigned_object_id_type id) const {
+    const osmium::Location location = get_noexcept(id);
+    if (!location.is_defined()) {
+        throw osmium::not_found{id};
+    }
+    return location;
+}
+
+osmium::Location LocationCacheMap::get_noexcept(const osmium::unsigned_object_id_type id) const noexcept {
+    if (m_dense) {
+        if (id >= m_size) {
+            return osmium::Location{};
+        }
+        return osmium::Location{m_locations[id * 2], m_locations[id * 2 + 1]};
+    }
+
+    if (m_size == 0) {
+        return osmium::Location{};
+    }
+
+    // Branchless binary search over the sorted entries, like the one in
+    // RiversystemMap::getName().
+    const auto entry_id = [this](std::size_t index) noexcept -> std::uint64_t {
+        std::uint64_t value;
+        std::memcpy(&value, m_entries + index * sparse_entry_size, sizeof(value));
+        return value;
+    };
+
+    std::size_t base = 0;
+    std::size_t n = m_size;
+    while (n > 1) {
+        const std::size_t half = n / 2;
+        base = (entry_id(base + half) <= id) ? base + half : base;
+        n -= half;
+    }
+
+    if (entry_id(base) != id) {
+        return osmium::Location{};
+    }
+
+    std::int32_t xy[2];
+    std::memcpy(xy, m_entries + base * sparse_entry_size + sizeof(std::uint64_t), sizeof(xy));
+    return osmium::Location{xy[0], xy[1]};
+}
@@ -0,0 +1,154 @@
+#ifndef LOCATION_CACHE_HPP
+#define LOCATION_CACHE_HPP
+
+/*
+
+  Node location cache shared between tool runs.
+
+  One run saves the locations of all nodes while reading the input file,
+  later runs open the cache read-only as location index and don't have to
+  process any nodes. The cache is memory-mapped, so several tools running
+  on the same machine share its pages through the page cache.
+
+  The file is written in native byte order:
+
+    char     magic[8]   "LOCCACH\0" with the version (1) in the last byte
+    uint64   layout     0 = dense, 1 = sparse
+    dense:   int32 x, int32 y   for every id from 0 to the largest id,
+                                undefined for missing nodes
+    sparse:  uint64 id, int32 x, int32 y   for every node, sorted by id
+
+  The dense layout needs 8 bytes for every possible id and is best for
+  planet files, the sparse one needs 16 bytes per node and is best for
+  extracts. Only nodes with positive ids are saved.
+
+*/
+
+#include <osmium/handler.hpp>
+#include <osmium/index/map.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include "buffered_writer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Handler writing the locations of all nodes into a cache file. The
+ * nodes must be sorted by id, as in all planet files and extracts.
+ */
+class LocationCacheWriter : public osmium::handler::Handler {
+
+    BufferedWriter m_out;
+    bool m_dense;
+    std::uint64_t m_next_id = 0;
+    std::uint64_t m_nodes = 0;
+
+    // Undefined locations written for gaps in the dense layout.
+    std::vector<std::int32_t> m_gap;
+
+    void write_location(const osmium::Location& location);
+
+public:
+
+    LocationCacheWriter(const std::string& filename, bool dense);
+
+    void node(const osmium::Node& node);
+
+    std::uint64_t nodes() const noexcept {
+        return m_nodes;
+    }
+
+    std::size_t bytes_written() const noexcept {
+        return m_out.bytes_written();
+    }
+
+    void close() {
+        m_out.close();
+    }
+
+}; // class LocationCacheWriter
+
+/**
+ * Handler wrapping a location handler. If a cache writer is given, all
+ * nodes are also written into the location cache.
+ */
+template <typename TLocationHandler>
+class CachingLocations : public osmium::handler::Handler {
+
+    TLocationHandler& m_location_handler;
+    LocationCacheWriter* m_cache;
+
+public:
+
+    CachingLocations(TLocationHandler& location_handler, LocationCacheWriter* cache) :
+        m_location_handler(location_handler),
+        m_cache(cache) {
+    }
+
+    void node(const osmium::Node& node) {
+        if (m_cache) {
+            m_cache->node(node);
+        }
+        m_location_handler.node(node);
+    }
+
+    void way(osmium::Way& way) {
+        m_location_handler.way(way);
+    }
+
+}; // class CachingLocations
+
+/**
+ * Read-only location index on a memory-mapped cache file. Calling set()
+ * throws, so no nodes must be given to a location handler using it.
+ */
+class LocationCacheMap : public osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location> {
+
+    std::unique_ptr<osmium::util::MemoryMapping> m_mapping;
+
+    bool m_dense = false;
+    std::size_t m_size = 0;
+
+    // Views on the data in the mapping.
+    const std::int32_t* m_locations = nullptr; // dense
+    const char* m_entries = nullptr;           // sparse
+
+public:
+
+    explicit LocationCacheMap(const std::string& filename);
+
+    bool dense() const noexcept {
+        return m_dense;
+    }
+
+    void set(const osmium::unsigned_object_id_type id, const osmium::Location value) final;
+
+    osmium::Location get(const osmium::unsigned_object_id_type id) const final;
+
+    osmium::Location get_noexcept(const osmium::unsigned_object_id_type id) const noexcept final;
+
+    std::size_t size() const final {
+        return m_size;
+    }
+
+    /**
+     * The size of the mapping, which is shared with the page cache.
+     */
+    std::size_t used_memory() const final {
+        return m_mapping->size();
+    }
+
+    void clear() final {
+    }
+
+}; // class LocationCacheMap
+
+#endif // LOCATION_CACHE_HPP
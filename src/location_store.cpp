@@ -0,0 +1,102 @@
+/*
+
+  Automatic choice of the location store for the MapFactory.
+
+*/
+
+#include "location_store.hpp"
+#include "util.hpp"
+
+#include <osmium/io/file_compression.hpp>
+#include <osmium/io/file_format.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _MSC_VER
+# include <unistd.h>
+#endif
+
+namespace {
+
+    // Rough size of the input file per node, including the ways and
+    // relations. The planet PBF has about 8.5 bytes per node.
+    constexpr const std::size_t pbf_bytes_per_node        = 8;
+    constexpr const std::size_t compressed_bytes_per_node = 12;
+    constexpr const std::size_t text_bytes_per_node       = 80;
+
+    // With more nodes than this the ids are dense enough that flex_mem
+    // (and the file based index) use the dense layout with 8 bytes per
+    // id, node ids in the planet go up to about 1.3 times the number of
+    // nodes.
+    constexpr const std::size_t dense_threshold = 1000UL * 1000UL * 1000UL;
+
+    constexpr const std::size_t sparse_bytes_per_node = 16;
+    constexpr const std::size_t dense_bytes_per_node  = 11;
+
+    std::size_t estimated_nodes(const osmium::io::File& input_file, std::size_t size) {
+        if (input_file.format() == osmium::io::file_format::pbf) {
+            return size / pbf_bytes_per_node;
+        }
+        if (input_file.compression() != osmium::io::file_compression::none) {
+            return size / compressed_bytes_per_node;
+        }
+        return size / text_bytes_per_node;
+    }
+
+} // anonymous namespace
+
+std::size_t available_memory() {
+    std::ifstream meminfo{"/proc/meminfo"};
+    std::string key;
+    std::size_t value = 0;
+    std::string unit;
+    while (meminfo >> key >> value) {
+        std::getline(meminfo, unit);
+        if (key == "MemAvailable:") {
+            return value * 1024;
+        }
+    }
+
+#ifndef _MSC_VER
+    const long pages = ::sysconf(_SC_PHYS_PAGES);
+    const long page_size = ::sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && page_size > 0) {
+        return static_cast<std::size_t>(pages) * static_cast<std::size_t>(page_size);
+    }
+#endif
+
+    return 0;
+}
+
+std::string auto_location_store(const osmium::io::File& input_file, const std::string& index_filename) {
+    const std::size_t size = file_size_sum(std::vector<osmium::io::File>{input_file});
+    const std::size_t available = available_memory();
+
+    // Reading from stdin or unknown memory, nothing to go by.
+    if (size == 0 || available == 0) {
+        std::cerr << "Location store 'auto': using 'flex_mem'\n";
+        return "flex_mem";
+    }
+
+    const std::size_t nodes = estimated_nodes(input_file, size);
+    const bool dense = nodes > dense_threshold;
+    const std::size_t needed = nodes * (dense ? dense_bytes_per_node : sparse_bytes_per_node);
+
+    // Leave a quarter of the memory for everything else, like the
+    // multipolygon manager and the output.
+    std::string store;
+    if (needed <= available / 4 * 3) {
+        store = "flex_mem";
+    } else {
+        store = std::string{dense ? "dense_file_array," : "sparse_file_array,"} + index_filename;
+    }
+
+    std::cerr << "Location store 'auto': about " << (nodes / 1000000) << " million nodes need about "
+              << show_mbytes(needed) << " MBytes, " << show_mbytes(available)
+              << " MBytes available, using '" << store << "'\n";
+    return store;
+}
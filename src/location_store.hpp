@@ -0,0 +1,34 @@
+#ifndef LOCATION_STORE_HPP
+#define LOCATION_STORE_HPP
+
+/*
+
+  Automatic choice of the location store for the MapFactory.
+
+  The number of nodes is estimated from the size of the input file. If
+  the index fits comfortably into the available memory, the flex_mem
+  store is used, which switches between a sparse and a dense layout by
+  itself. Otherwise the index goes into a file and only the pages in use
+  are kept in memory by the operating system.
+
+*/
+
+#include <osmium/io/file.hpp>
+
+#include <cstddef>
+#include <string>
+
+/**
+ * The memory available for new processes in bytes: MemAvailable from
+ * /proc/meminfo, or the physical memory if that isn't available.
+ */
+std::size_t available_memory();
+
+/**
+ * Choose a location store for the given input file. If the index has to
+ * go to disk, it is written to index_filename. A short explanation is
+ * printed to stderr.
+ */
+std::string auto_location_store(const osmium::io::File& input_file, const std::string& index_filename);
+
+#endif // LOCATION_STORE_HPP
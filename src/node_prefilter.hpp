@@ -0,0 +1,106 @@
+#ifndef NODE_PREFILTER_HPP
+#define NODE_PREFILTER_HPP
+
+/*
+
+  Node prefilter for the location index.
+
+  A cheap first pass over the ways of the input file collects the ids of
+  all nodes needed by the ways the tool is interested in. The location
+  handler then only stores the locations of those nodes.
+
+*/
+
+#include <osmium/handler.hpp>
+#include <osmium/index/id_set.hpp>
+#include <osmium/io/any_input.hpp> // IWYU pragma: keep
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <stdexcept>
+
+using id_set_type = osmium::index::IdSetDense<osmium::unsigned_object_id_type>;
+
+inline void check_prefilter_input(const osmium::io::File& file) {
+    if (file.filename().empty() || file.filename() == "-") {
+        throw std::runtime_error{"The node prefilter needs an input file, it can't read from stdin."};
+    }
+}
+
+/**
+ * Read all ways from the file and add the node ids of those ways for
+ * which wanted(way) returns true to the node_ids set.
+ */
+template <typename TPredicate>
+void collect_way_nodes(const osmium::io::File& file, id_set_type& node_ids, TPredicate&& wanted) {
+    check_prefilter_input(file);
+
+    osmium::io::Reader reader{file, osmium::osm_entity_bits::way, osmium::io::read_meta::no};
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (auto it = buffer.begin<osmium::Way>(); it != buffer.end<osmium::Way>(); ++it) {
+            if (wanted(*it)) {
+                for (const auto& nr : it->nodes()) {
+                    node_ids.set(nr.positive_ref());
+                }
+            }
+        }
+    }
+    reader.close();
+}
+
+/**
+ * Read all relations from the file and add the ids of the member ways of
+ * those relations for which wanted(relation) returns true to the way_ids
+ * set.
+ */
+template <typename TPredicate>
+void collect_member_ways(const osmium::io::File& file, id_set_type& way_ids, TPredicate&& wanted) {
+    check_prefilter_input(file);
+    osmium::io::Reader reader{file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (auto it = buffer.begin<osmium::Relation>(); it != buffer.end<osmium::Relation>(); ++it) {
+            if (wanted(*it)) {
+                for (const auto& member : it->members()) {
+                    if (member.type() == osmium::item_type::way) {
+                        way_ids.set(member.positive_ref());
+                    }
+                }
+            }
+        }
+    }
+    reader.close();
+}
+
+/**
+ * Handler wrapping a location handler. Nodes are only passed on if they
+ * are in the node id set, ways are always passed on. If no id set is
+ * given, all nodes are passed on.
+ */
+template <typename TLocationHandler>
+class PrefilteredLocations : public osmium::handler::Handler {
+
+    TLocationHandler& m_location_handler;
+    const id_set_type* m_node_ids;
+
+public:
+
+    PrefilteredLocations(TLocationHandler& location_handler, const id_set_type* node_ids) :
+        m_location_handler(location_handler),
+        m_node_ids(node_ids) {
+    }
+
+    void node(const osmium::Node& node) {
+        if (!m_node_ids || m_node_ids->get(node.positive_id())) {
+            m_location_handler.node(node);
+        }
+    }
+
+    void way(osmium::Way& way) {
+        m_location_handler.way(way);
+    }
+
+}; // class PrefilteredLocations
+
+#endif // NODE_PREFILTER_HPP
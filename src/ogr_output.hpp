@@ -0,0 +1,157 @@
+#ifndef OGR_OUTPUT_HPP
+#define OGR_OUTPUT_HPP
+
+/*
+
+  Helper functions for the OGR output of the tools.
+
+*/
+
+#include <gdalcpp.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Group the writes to the dataset into transactions of batch_size
+ * features each. A batch_size of 0 disables explicit transactions.
+ * Returns false if the output driver doesn't support transactions.
+ */
+inline bool setup_transactions(gdalcpp::Dataset& dataset, std::uint64_t batch_size) {
+    if (batch_size == 0) {
+        return true;
+    }
+
+    if (!dataset.get().TestCapability(ODsCTransactions)) {
+        std::cerr << "Warning! Output format '" << dataset.driver_name()
+                  << "' doesn't support transactions, ignoring transaction batch size.\n";
+        return false;
+    }
+
+    dataset.enable_auto_transactions(batch_size);
+    return true;
+}
+
+/**
+ * Commit the last open transaction, if any.
+ */
+inline void finish_transactions(gdalcpp::Dataset& dataset) {
+    dataset.disable_auto_transactions();
+}
+
+/**
+ * Can the spatial index of layers in this dataset be created after all
+ * features have been written? This is only implemented for the SQLite
+ * (Spatialite) and GPKG drivers.
+ */
+inline bool supports_deferred_index(const std::string& driver_name) {
+    return driver_name == "SQLite" || driver_name == "GPKG";
+}
+
+/**
+ * Check whether the deferred spatial index creation can be used with the
+ * output driver. Warns and returns false if not.
+ */
+inline bool setup_deferred_index(const std::string& driver_name, bool deferred_index) {
+    if (!deferred_index) {
+        return false;
+    }
+
+    if (!supports_deferred_index(driver_name)) {
+        std::cerr << "Warning! Output format '" << driver_name
+                  << "' doesn't support deferred spatial index creation, ignoring it.\n";
+        return false;
+    }
+
+    return true;
+}
+
+inline bool setup_deferred_index(gdalcpp::Dataset& dataset, bool deferred_index) {
+    return setup_deferred_index(dataset.driver_name(), deferred_index);
+}
+
+/**
+ * Layer creation options. With deferred_index set, the layer is created
+ * without spatial index, so the R-tree isn't updated on every insert.
+ * Call create_spatial_index() on the layer once all features are written.
+ */
+inline std::vector<std::string> layer_options(bool deferred_index) {
+    if (deferred_index) {
+        return {"SPATIAL_INDEX=NO"};
+    }
+    return {};
+}
+
+inline std::string create_spatial_index_sql(const char* layer_name, const char* geometry_column) {
+    return std::string{"SELECT CreateSpatialIndex('"} + layer_name + "', '" + geometry_column + "')";
+}
+
+/**
+ * Build the spatial index of a layer created with deferred_index set in
+ * one bulk operation. Must be called after the last transaction has been
+ * committed.
+ */
+inline void create_spatial_index(gdalcpp::Dataset& dataset, gdalcpp::Layer& layer) {
+    dataset.exec(create_spatial_index_sql(layer.name(), layer.get().GetGeometryColumn()));
+}
+
+/**
+ * Build the spatial index of a layer in an existing dataset, for
+ * instance after the features have been written without OGR.
+ */
+inline void create_spatial_index(const std::string& filename, const std::string& layer_name) {
+    GDALDataset* dataset = static_cast<GDALDataset*>(GDALOpenEx(filename.c_str(), GDAL_OF_VECTOR | GDAL_OF_UPDATE, nullptr, nullptr, nullptr));
+    if (!dataset) {
+        throw std::runtime_error{"Can't open dataset " + filename};
+    }
+
+    OGRLayer* layer = dataset->GetLayerByName(layer_name.c_str());
+    if (!layer) {
+        GDALClose(dataset);
+        throw std::runtime_error{"No layer " + layer_name + " in dataset " + filename};
+    }
+
+    const std::string sql = create_spatial_index_sql(layer_name.c_str(), layer->GetGeometryColumn());
+    OGRLayer* result = dataset->ExecuteSQL(sql.c_str(), nullptr, nullptr);
+    if (result) {
+        dataset->ReleaseResultSet(result);
+    }
+    GDALClose(dataset);
+}
+
+/**
+ * Create an OGR geometry from WKB, for instance built by the WKBFactory
+ * on another thread.
+ */
+inline std::unique_ptr<OGRGeometry> geometry_from_wkb(const std::string& wkb) {
+    OGRGeometry* geometry = nullptr;
+    unsigned char* data = const_cast<unsigned char*>(reinterpret_cast<const unsigned char*>(wkb.data()));
+    if (OGRGeometryFactory::createFromWkb(data, nullptr, &geometry, static_cast<int>(wkb.size())) != OGRERR_NONE) {
+        throw std::runtime_error{"Can't create OGR geometry from WKB"};
+    }
+    return std::unique_ptr<OGRGeometry>{geometry};
+}
+
+/**
+ * Print number of features written and the rate.
+ */
+inline void print_feature_rate(std::uint64_t features, double seconds) {
+    std::cerr << "Wrote " << features << " features in " << seconds << " s";
+    if (seconds > 0) {
+        std::cerr << " (" << static_cast<std::uint64_t>(static_cast<double>(features) / seconds) << " features/s)";
+    }
+    std::cerr << "\n";
+}
+
+/**
+ * Print the wall clock time used by a phase of the export.
+ */
+inline void print_phase_time(const char* phase, double seconds) {
+    std::cerr << phase << ": " << seconds << " s\n";
+}
+
+#endif // OGR_OUTPUT_HPP
@@ -0,0 +1,541 @@
+/*
+
+  osmium_export_all
+
+  Creates the outputs of osmium_waterway_ids, osmium_toogr, osmium_toogr2
+  and osmium_rivermap while reading the input file only twice: once for
+  the multipolygon relations and once for everything. All handlers share
+  one location index and one multipolygon manager.
+
+  The waterway layer needs the river systems which are only known after
+  the full pass, so the waterways are kept with their node locations in
+  a temporary file and written to the layer at the end.
+
+*/
+
+#include <gdalcpp.hpp>
+
+#include <osmium/area/assembler.hpp>
+#include <osmium/area/multipolygon_manager.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/handler/node_locations_for_ways.hpp>
+#include <osmium/index/map/all.hpp> // IWYU pragma: keep
+#include <osmium/io/any_input.hpp> // IWYU pragma: keep
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/tags/tags_filter.hpp>
+#include <osmium/util/memory.hpp>
+#include <osmium/visitor.hpp>
+
+#include "base_layers_handler.hpp"
+#include "geometry_pipeline.hpp"
+#include "layer_config.hpp"
+#include "location_store.hpp"
+#include "read_profile.hpp"
+#include "ogr_output.hpp"
+#include "riversystem_map.hpp"
+#include "riversystems.hpp"
+#include "temp_file.hpp"
+#include "thread_count.hpp"
+#include "water_layer.hpp"
+#include "waterway_ids_handler.hpp"
+#include "waterway_layer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
+
+// Keeps the waterways with the locations of their nodes in a temporary
+// PBF file, so the waterway layer can be written once the river systems
+// are known.
+class WaterwaySpool : public osmium::handler::Handler {
+
+    osmium::io::Writer m_writer;
+
+    std::uint64_t m_ways = 0;
+
+public:
+
+    explicit WaterwaySpool(const std::string& filename) :
+        m_writer(osmium::io::File{filename, "pbf,locations_on_ways=true"}, osmium::io::overwrite::allow) {
+    }
+
+    void way(const osmium::Way& way) {
+        if (is_waterway(way)) {
+            m_writer(way);
+            ++m_ways;
+        }
+    }
+
+    std::uint64_t ways() const noexcept {
+        return m_ways;
+    }
+
+    void close() {
+        m_writer.close();
+    }
+
+}; // class WaterwaySpool
+
+// Hands the objects to those handlers whose output was requested.
+class ExportHandler : public osmium::handler::Handler {
+
+    WaterHandler* m_waterway_ids;
+    BaseLayersHandler<OGRBaseLayersOutput>* m_base_layers;
+    WaterwaySpool* m_waterways;
+
+public:
+
+    ExportHandler(WaterHandler* waterway_ids, BaseLayersHandler<OGRBaseLayersOutput>* base_layers, WaterwaySpool* waterways) :
+        m_waterway_ids(waterway_ids),
+        m_base_layers(base_layers),
+        m_waterways(waterways) {
+    }
+
+    void node(const osmium::Node& node) {
+        if (m_base_layers) {
+            m_base_layers->node(node);
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        if (m_waterway_ids) {
+            m_waterway_ids->way(way);
+        }
+        if (m_base_layers) {
+            m_base_layers->way(way);
+        }
+        if (m_waterways) {
+            m_waterways->way(way);
+        }
+    }
+
+    void area(const osmium::Area& area) {
+        if (m_waterway_ids) {
+            m_waterway_ids->area(area);
+        }
+    }
+
+}; // class ExportHandler
+
+// Create the spatial indexes of a dataset if they were deferred.
+template <typename TWriter>
+void finish_dataset(gdalcpp::Dataset& dataset, TWriter& writer, bool defer_index) {
+    finish_transactions(dataset);
+    if (defer_index) {
+        const auto start = std::chrono::steady_clock::now();
+        writer.create_spatial_indexes(dataset);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        print_phase_time("Creating spatial indexes", elapsed.count());
+    }
+}
+
+/* ================================================== */
+
+void print_help() {
+    std::cout << "osmium_export_all [OPTIONS] INFILE\n\n" \
+              << "Write the outputs of osmium_waterway_ids, osmium_toogr, osmium_toogr2\n" \
+              << "and osmium_rivermap reading INFILE only twice. Only the outputs given\n" \
+              << "are created.\n" \
+              << "\nOptions:\n" \
+              << "  -h, --help                 This help message\n" \
+              << "  -F, --tags-filter=FILE     Tags filter for the waterway ids\n" \
+              << "  -W, --wways=FILE           Write ids of waterways and their nodes\n" \
+              << "  -A, --wtr=FILE             Write ids of water areas and their nodes\n" \
+              << "  -b, --binary               Write waterway ids as binary files\n" \
+              << "  -R, --riversystems=FILE    Compute river systems and write them as\n" \
+              << "                             id,rsystem csv file (needs --wways)\n" \
+              << "  -B, --base-layers=FILE     Write places, peaks, roads, railways and\n" \
+              << "                             boundaries (as osmium_toogr)\n" \
+              << "  -c, --layers=FILE          Layer definitions for --base-layers (see\n" \
+              << "                             osmium_toogr --print-layers)\n" \
+              << "  -P, --water=FILE           Write water polygons (as osmium_toogr2)\n" \
+              << "  -M, --rivermap=FILE        Write waterways with their river systems\n" \
+              << "                             (as osmium_rivermap, needs --riversystems)\n" \
+              << "  -l, --location_store=TYPE  Set location store (Default: 'auto', chosen\n" \
+              << "                             from input size and available memory)\n" \
+              << "  -f, --format=FORMAT        Output OGR format (Default: 'SQLite')\n" \
+              << "  -t, --tx-batch=N           Write N features per transaction (Default: 0,\n" \
+              << "                             no explicit transactions, every feature is\n" \
+              << "                             committed on its own; use 1000 or more for\n" \
+              << "                             SQLite and GPKG)\n" \
+              << "  -I, --defer-index          Create spatial indexes after all features are\n" \
+              << "                             written (SQLite and GPKG only)\n" \
+              << "  -j, --threads=N            Number of threads building water geometries\n" \
+              << "                             and computing river systems (Default: 0,\n" \
+              << "                             number of cores)\n" \
+              << "  -e, --read=PROFILE         Object types to read in pass 2 and ',meta'\n" \
+              << "                             to decode metadata (Default: 'auto', nodes\n" \
+              << "                             and ways without metadata)\n" \
+              << "  -T, --time-read            Only read INFILE and report the decode time\n" \
+              << "  -L                         See available location stores\n";
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
+        static struct option long_options[] = {
+            {"help",                 no_argument,       nullptr, 'h'},
+            {"tags-filter",          required_argument, nullptr, 'F'},
+            {"wways",                required_argument, nullptr, 'W'},
+            {"wtr",                  required_argument, nullptr, 'A'},
+            {"binary",               no_argument,       nullptr, 'b'},
+            {"riversystems",         required_argument, nullptr, 'R'},
+            {"base-layers",          required_argument, nullptr, 'B'},
+            {"layers",               required_argument, nullptr, 'c'},
+            {"water",                required_argument, nullptr, 'P'},
+            {"rivermap",             required_argument, nullptr, 'M'},
+            {"location_store",       required_argument, nullptr, 'l'},
+            {"format",               required_argument, nullptr, 'f'},
+            {"tx-batch",             required_argument, nullptr, 't'},
+            {"defer-index",          no_argument,       nullptr, 'I'},
+            {"threads",              required_argument, nullptr, 'j'},
+            {"read",                 required_argument, nullptr, 'e'},
+            {"time-read",            no_argument,       nullptr, 'T'},
+            {"list_location_stores", no_argument,       nullptr, 'L'},
+            {nullptr, 0, nullptr, 0}
+        };
+
+        std::string tags_filter_file;
+        std::string wways_file;
+        std::string wtr_file;
+        bool binary = false;
+        std::string rsystems_file;
+        std::string base_layers_file;
+        std::string layers_file;
+        std::string water_file;
+        std::string rivermap_file;
+        std::string location_store{"auto"};
+        std::string output_format{"SQLite"};
+        std::uint64_t tx_batch = 0;
+        bool defer_index = false;
+        int num_threads = 0;
+        std::string read_profile{"auto"};
+        bool only_time_read = false;
+
+        while (true) {
+            const int c = getopt_long(argc, argv, "hF:W:A:bR:B:c:P:M:l:f:t:Ij:e:TL", long_options, nullptr);
+            if (c == -1) {
+                break;
+            }
+
+            switch (c) {
+                case 'h':
+                    print_help();
+                    return 0;
+                case 'F':
+                    tags_filter_file = optarg;
+                    break;
+                case 'W':
+                    wways_file = optarg;
+                    break;
+                case 'A':
+                    wtr_file = optarg;
+                    break;
+                case 'b':
+                    binary = true;
+                    break;
+                case 'R':
+                    rsystems_file = optarg;
+                    break;
+                case 'B':
+                    base_layers_file = optarg;
+                    break;
+                case 'c':
+                    layers_file = optarg;
+                    break;
+                case 'P':
+                    water_file = optarg;
+                    break;
+                case 'M':
+                    rivermap_file = optarg;
+                    break;
+                case 'l':
+                    location_store = optarg;
+                    break;
+                case 'f':
+                    output_format = optarg;
+                    break;
+                case 't':
+                    tx_batch = std::strtoull(optarg, nullptr, 10);
+                    break;
+                case 'I':
+                    defer_index = true;
+                    break;
+                case 'j':
+                    if (!parse_thread_count(optarg, "--threads", 0, num_threads)) {
+                        return 1;
+                    }
+                    break;
+                case 'e':
+                    read_profile = optarg;
+                    break;
+                case 'T':
+                    only_time_read = true;
+                    break;
+                case 'L':
+                    std::cout << "Available map types:\n";
+                    for (const auto& map_type : map_factory.map_types()) {
+                        std::cout << "  " << map_type << "\n";
+                    }
+                    return 0;
+                default:
+                    return 1;
+            }
+        }
+
+        if (argc - optind != 1) {
+            std::cerr << "Usage: " << argv[0] << " [OPTIONS] INFILE\n";
+            return 1;
+        }
+
+        const osmium::io::File input_file{argv[optind]};
+
+        // The relations are read in pass 1, the second pass only needs the
+        // nodes and ways.
+        const ReadProfile profile = parse_read_profile(read_profile, {
+            osmium::osm_entity_bits::node | osmium::osm_entity_bits::way,
+            osmium::io::read_meta::no
+        });
+        if (only_time_read) {
+            time_read(input_file, profile);
+            return 0;
+        }
+
+        const bool waterway_ids = !wways_file.empty() || !wtr_file.empty();
+        if (waterway_ids && (wways_file.empty() || wtr_file.empty() || tags_filter_file.empty())) {
+            std::cerr << "Options --wways and --wtr need each other and --tags-filter\n";
+            return 1;
+        }
+        if (!rsystems_file.empty() && !waterway_ids) {
+            std::cerr << "Option --riversystems needs --wways\n";
+            return 1;
+        }
+        if (!rivermap_file.empty() && rsystems_file.empty()) {
+            std::cerr << "Option --rivermap needs --riversystems\n";
+            return 1;
+        }
+        if (!waterway_ids && base_layers_file.empty() && water_file.empty()) {
+            std::cerr << "No output given\n";
+            return 1;
+        }
+
+        const unsigned int rsystems_threads = num_threads > 0 ? static_cast<unsigned int>(num_threads)
+                                                              : std::max(std::thread::hardware_concurrency(), 1U);
+
+        std::unique_ptr<WaterHandler> waterway_ids_handler;
+        RiversystemBuilder rsystems_builder{rsystems_threads};
+        if (waterway_ids) {
+            waterway_ids_handler.reset(new WaterHandler{wways_file, wtr_file, binary});
+            waterway_ids_handler->read_expressions_file(tags_filter_file);
+            if (!rsystems_file.empty()) {
+                waterway_ids_handler->set_riversystem_builder(&rsystems_builder);
+            }
+        }
+
+        // The multipolygon manager assembles the areas for the waterway
+        // ids and for the water layer. The waterway ids handler needs the
+        // areas to have at least one outer ring, so invalid multipolygons
+        // are ignored for the water layer, too.
+        osmium::TagsFilter mp_filter{false};
+        if (waterway_ids_handler) {
+            mp_filter = waterway_ids_handler->getTagsFilter();
+        }
+        if (!water_file.empty()) {
+            mp_filter.add_rule(true, osmium::TagMatcher{"natural", "water"});
+        }
+
+        osmium::area::Assembler::config_type assembler_config;
+        assembler_config.create_empty_areas = false;
+        osmium::area::MultipolygonManager<osmium::area::Assembler> mp_manager{assembler_config, mp_filter};
+
+        std::cerr << "Pass 1...\n";
+        const auto pass1_start = std::chrono::steady_clock::now();
+        {
+            // Only the relation members are needed, not their metadata.
+            osmium::io::Reader reader{input_file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
+            osmium::apply(reader, mp_manager);
+            reader.close();
+        }
+        mp_manager.prepare_for_lookup();
+        const std::chrono::duration<double> pass1_elapsed = std::chrono::steady_clock::now() - pass1_start;
+        std::cerr << "Pass 1 done\n";
+        print_phase_time("Reading relations", pass1_elapsed.count());
+
+        // If the index doesn't fit into memory, it goes into a temporary
+        // file in the current directory, named after the process, so
+        // concurrent runs don't share it.
+        const std::string location_file = temp_file_name("", "osmium_export_all", ".locations");
+        FileRemover location_remover;
+        if (location_store == "auto") {
+            location_store = auto_location_store(input_file, location_file);
+            if (location_store != "flex_mem") {
+                location_remover.set(location_file);
+            }
+        }
+        std::unique_ptr<index_type> index = map_factory.create_map(location_store);
+        location_handler_type location_handler{*index};
+        location_handler.ignore_errors();
+
+        CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
+
+        std::unique_ptr<LayerConfig> layer_config;
+        std::unique_ptr<gdalcpp::Dataset> base_layers_dataset;
+        std::unique_ptr<OGRBaseLayersOutput> base_layers_output;
+        std::unique_ptr<BaseLayersHandler<OGRBaseLayersOutput>> base_layers_handler;
+        bool base_layers_defer_index = false;
+        if (!base_layers_file.empty()) {
+            base_layers_dataset.reset(new gdalcpp::Dataset{output_format, base_layers_file, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }});
+            setup_transactions(*base_layers_dataset, tx_batch);
+            base_layers_defer_index = setup_deferred_index(*base_layers_dataset, defer_index);
+            layer_config.reset(new LayerConfig{layers_file.empty() ? LayerConfig::builtin() : LayerConfig::from_file(layers_file)});
+            base_layers_output.reset(new OGRBaseLayersOutput{*base_layers_dataset, *layer_config, base_layers_defer_index});
+            base_layers_handler.reset(new BaseLayersHandler<OGRBaseLayersOutput>{*layer_config, *base_layers_output});
+        }
+
+        std::unique_ptr<gdalcpp::Dataset> water_dataset;
+        std::unique_ptr<WaterLayerWriter> water_writer;
+        std::unique_ptr<GeometryPipeline<water_features>> water_pipeline;
+        bool water_defer_index = false;
+        if (!water_file.empty()) {
+            water_dataset.reset(new gdalcpp::Dataset{output_format, water_file, gdalcpp::SRS{factory_type{}.proj_string()}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }});
+            setup_transactions(*water_dataset, tx_batch);
+            water_defer_index = setup_deferred_index(*water_dataset, defer_index);
+            water_writer.reset(new WaterLayerWriter{*water_dataset, water_defer_index});
+            WaterLayerWriter* writer = water_writer.get();
+            water_pipeline.reset(new GeometryPipeline<water_features>{num_threads, [](const osmium::memory::Buffer& area_buffer) {
+                return build_water_features(area_buffer, nullptr, WaterLayerWriter::ogr_geometry);
+            }, [writer](water_features& result) {
+                writer->write(result);
+            }});
+            std::cerr << "Building water geometries with " << water_pipeline->num_threads() << " threads\n";
+        }
+
+        // The waterways are spooled to disk and not kept in a buffer: the
+        // river systems are only known after the whole file was read, and
+        // all waterways with their locations can be several GBytes. The
+        // remover is declared first, so the file is closed before it is
+        // removed, also if something throws.
+        const std::string spool_file = rivermap_file + ".tmp.pbf";
+        FileRemover spool_remover;
+        std::unique_ptr<WaterwaySpool> waterway_spool;
+        if (!rivermap_file.empty()) {
+            spool_remover.set(spool_file);
+            waterway_spool.reset(new WaterwaySpool{spool_file});
+        }
+
+        ExportHandler export_handler{waterway_ids_handler.get(), base_layers_handler.get(), waterway_spool.get()};
+
+        std::cerr << "Pass 2...\n";
+        const auto pass2_start = std::chrono::steady_clock::now();
+        osmium::io::Reader reader{input_file, profile.entities, profile.meta};
+
+        osmium::apply(reader, location_handler, export_handler, mp_manager.handler([&](osmium::memory::Buffer&& area_buffer) {
+            osmium::apply(area_buffer, export_handler);
+            if (water_pipeline) {
+                water_pipeline->submit(std::move(area_buffer));
+            }
+        }));
+
+        reader.close();
+        if (water_pipeline) {
+            water_pipeline->finish();
+        }
+        if (waterway_ids_handler) {
+            waterway_ids_handler->close();
+        }
+        if (waterway_spool) {
+            waterway_spool->close();
+        }
+        const std::chrono::duration<double> pass2_elapsed = std::chrono::steady_clock::now() - pass2_start;
+        std::cerr << "Pass 2 done\n";
+        print_phase_time("Reading all objects", pass2_elapsed.count());
+
+        index.reset();
+        location_remover.remove();
+
+        if (waterway_ids_handler) {
+            std::cerr << "Waterway ids: wrote " << waterway_ids_handler->bytes_written() << " bytes\n";
+        }
+        if (base_layers_handler) {
+            std::cerr << "Base layers: ";
+            print_feature_rate(base_layers_handler->features(), pass2_elapsed.count());
+            finish_dataset(*base_layers_dataset, *base_layers_output, base_layers_defer_index);
+        }
+        if (water_writer) {
+            std::cerr << "Water layer: ";
+            print_feature_rate(water_writer->features(), pass2_elapsed.count());
+            finish_dataset(*water_dataset, *water_writer, water_defer_index);
+        }
+
+        if (!rsystems_file.empty()) {
+            std::cerr << "Computing river systems of " << rsystems_builder.num_ways() << " waterways...\n";
+            const auto start = std::chrono::steady_clock::now();
+            rsystems_builder.write_csv(rsystems_file);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            print_phase_time("Computing river systems", elapsed.count());
+        }
+
+        if (waterway_spool) {
+            std::cerr << "Writing " << waterway_spool->ways() << " waterways...\n";
+            const auto start = std::chrono::steady_clock::now();
+
+            RiversystemMap rsystems;
+            rsystems.load(rsystems_file, rsystems_threads);
+
+            gdalcpp::Dataset dataset{output_format, rivermap_file, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
+            setup_transactions(dataset, tx_batch);
+            const bool rivermap_defer_index = setup_deferred_index(dataset, defer_index);
+
+            OGRWaterwayOutput output{dataset, rivermap_defer_index};
+            WaterwayLayerHandler<OGRWaterwayOutput> waterway_handler{output, rsystems};
+
+            // The ways come with their locations, no location index needed.
+            osmium::io::Reader spool_reader{osmium::io::File{spool_file, "pbf"}};
+            osmium::apply(spool_reader, waterway_handler);
+            spool_reader.close();
+            spool_remover.remove();
+
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr << "Waterway layer: ";
+            print_feature_rate(waterway_handler.features(), elapsed.count());
+            finish_dataset(dataset, output, rivermap_defer_index);
+        }
+
+        std::vector<osmium::object_id_type> incomplete_relations_ids;
+        mp_manager.for_each_incomplete_relation([&](const osmium::relations::RelationHandle& handle){
+            incomplete_relations_ids.push_back(handle->id());
+        });
+        if (!incomplete_relations_ids.empty()) {
+            std::cerr << "Warning! Some member ways missing for these multipolygon relations:";
+            for (const auto id : incomplete_relations_ids) {
+                std::cerr << " " << id;
+            }
+            std::cerr << "\n";
+        }
+
+        osmium::MemoryUsage memory;
+        if (memory.peak()) {
+            std::cerr << "Memory used: " << memory.peak() << " MBytes\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -7,140 +7,134 @@
 
 #include <gdalcpp.hpp>
 
-#include <osmium/geom/ogr.hpp>
-#include <osmium/handler.hpp>
 #include <osmium/handler/node_locations_for_ways.hpp>
 #include <osmium/index/map/all.hpp> // IWYU pragma: keep
 #include <osmium/io/any_input.hpp> // IWYU pragma: keep
 #include <osmium/visitor.hpp>
 
-#include <cerrno>
+#include "location_cache.hpp"
+#include "location_store.hpp"
+#include "node_prefilter.hpp"
+#include "ogr_output.hpp"
+#include "progress.hpp"
+#include "read_profile.hpp"
+#include "region.hpp"
+#include "riversystem_bench.hpp"
+#include "riversystem_map.hpp"
+#include "run_stats.hpp"
+#include "temp_file.hpp"
+#include "util.hpp"
+#include "waterway_layer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
-#include <fcntl.h>
 #include <getopt.h>
 #include <iostream>
-#include <fstream>
+#include <memory>
 #include <string>
-#include <map>
-#include <set>
-#include <system_error>
-
-#ifndef _MSC_VER
-# include <unistd.h>
-#endif
+#include <thread>
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
-std::istream& comma(std::istream& is)
-{
-    char c;
-    if (is >> c && c != ',')
-        is.clear(std::ios::badbit);
-    return is;
-}
-
-class RiversystemMap {
-
-private:
-    std::set<std::string> m_names;
-    std::map<long, const char *> m_id2Name;
-    std::string m_empty;
-
-    void insert(long id, std::string name) {
-        auto it = m_names.insert(name).first;
-        const char * nameptr = it->c_str();
-        m_id2Name.insert(std::pair<long, const char*>(id, nameptr));
+// Synthetic riversystems file written by --bench-load.
+const char* const bench_csv_file = "osmium_rivermap_bench.csv";
+
+// Run the second pass writing to the given output and print the feature
+// rate. Returns the time used in seconds.
+template <typename TOutput, typename TLocationHandler>
+double write_waterways(const osmium::io::File& input_file, const ReadProfile& profile, TLocationHandler& location_handler, const Region* region, TOutput& output, RiversystemMap& rsystems,
+                       ProgressReporter* progress, RunStats* stats) {
+    WaterwayLayerHandler<TOutput> ogr_handler{output, rsystems};
+    RegionFilter<WaterwayLayerHandler<TOutput>> region_filter{region, ogr_handler};
+    if (progress) {
+        ogr_handler.set_progress_counter(&progress->add_layer("waterway"));
+        progress->start("Writing features", file_size(input_file));
     }
-
-public:
-    void load(const std::string& filename) {
-        std::ifstream ifs;
-        std::string header;
-        ifs.open(filename);
-        if (! ifs.eof()) {
-            std::getline(ifs, header);
-        }
-        if (header.empty()) {
-            throw std::runtime_error(std::string("Can't read from file ") + filename);
-        }
-        if (header != "id,rsystem") {
-            throw std::runtime_error(std::string("Wrong csv header: ") + header);
-        }
-
-        long id;
-        std::string name;
-        while (! ifs.eof()) {
-            ifs >> id >> comma >> name;
-            //std::cout << id << ": " << name << std::endl;
-            insert(id, name);
-        }
-        ifs.close();
+    StageTime write_time;
+    if (stats) {
+        ogr_handler.set_write_time(&write_time);
     }
 
-    const char * getName(long id) const {
-        auto it = m_id2Name.find(id);
-        if (it == m_id2Name.end()) {
-            return m_empty.c_str();
-        }
-        return it->second;
+    const auto start = std::chrono::steady_clock::now();
+    osmium::io::Reader reader{input_file, profile.entities, profile.meta};
+    StatsHandler stats_handler{stats};
+    {
+        ProgressHandler progress_handler{progress, &reader};
+        osmium::apply(reader, progress_handler, stats_handler, location_handler, region_filter);
     }
-
-};
-
-class MyOGRHandler : public osmium::handler::Handler {
-
-    gdalcpp::Layer m_layer_linestring;
-    RiversystemMap& m_rsystems;
-
-    osmium::geom::OGRFactory<> m_factory;
-
-public:
-    explicit MyOGRHandler(gdalcpp::Dataset& dataset, RiversystemMap& rsystems) :
-        m_layer_linestring(dataset, "waterway", wkbLineString),
-        m_rsystems(rsystems) {
-
-        m_layer_linestring.add_field("id", OFTReal, 10);
-        m_layer_linestring.add_field("name", OFTString, 30);
-        m_layer_linestring.add_field("type", OFTString, 30);
-        m_layer_linestring.add_field("rsystem", OFTString, 30);
+    reader.close();
+    if (progress) {
+        progress->stop();
     }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
-    void way(const osmium::Way& way) {
-        const char* waterway = way.tags().get_value_by_key("waterway");
-        if (waterway) {
-            try {
-                const char* name = way.tags().get_value_by_key("name");
-                gdalcpp::Feature feature{m_layer_linestring, m_factory.create_linestring(way)};
-                feature.set_field("id", static_cast<double>(way.id()));
-                if (name) {
-                    feature.set_field("name", name);
-                }
-                feature.set_field("type", waterway);
-                const char* riversystem = m_rsystems.getName(way.id());
-                feature.set_field("rsystem", riversystem);
-                feature.add_to_layer();
-            } catch (const osmium::geometry_error&) {
-                std::cerr << "Ignoring illegal geometry for way " << way.id() << ".\n";
-            }
-        }
+    stats_handler.finish();
+    if (stats) {
+        stats->add_stage("ogr_writes", write_time);
+        stats->add_features("waterway", ogr_handler.features());
+        stats->add_errors("geometry", ogr_handler.geometry_errors());
     }
 
-};
+    region_filter.print_stats();
+    print_feature_rate(ogr_handler.features(), elapsed.count());
+    return elapsed.count();
+}
 
 /* ================================================== */
 
 void print_help() {
-    std::cout << "osmium_rivermap [OPTIONS] [INFILE [OUTFILE]]\n\n" \
+    std::cout << "osmium_rivermap [OPTIONS] [INFILE [OUTFILE]]\n" \
+              << "osmium_rivermap -r CSVFILE --build-index=INDEXFILE\n\n" \
               << "If INFILE is not given stdin is assumed.\n" \
               << "If OUTFILE is not given 'ogr_out' is used.\n" \
               << "\nOptions:\n" \
               << "  -h, --help                 This help message\n" \
-              << "  -l, --location_store=TYPE  Set location store\n" \
+              << "  -l, --location_store=TYPE  Set location store ('auto' chooses from input\n" \
+              << "                             size and available memory)\n" \
               << "  -f, --format=FORMAT        Output OGR format (Default: 'SQLite')\n" \
-              << "  -r, --riversystems=FILE    Merge in riversystems csv file\n" \
+              << "  -t, --tx-batch=N           Write N features per transaction (Default: 0,\n" \
+              << "                             no explicit transactions, every feature is\n" \
+              << "                             committed on its own; use 1000 or more for\n" \
+              << "                             SQLite and GPKG)\n" \
+              << "  -I, --defer-index          Create spatial index after all features are\n" \
+              << "                             written (SQLite and GPKG only)\n" \
+              << "  -w, --writer=WRITER        Write features with 'ogr' (default), 'native'\n" \
+              << "                             (Spatialite only, uses sqlite3 directly) or\n" \
+              << "                             'fgb' (FlatGeobuf file, ignores --format)\n" \
+              << "  -r, --riversystems=FILE    Merge in riversystems csv or index file\n" \
+              << "  -B, --build-index=FILE     Convert riversystems csv file to index file\n" \
+              << "  -b, --bench-lookup         Only load the riversystems file and print the\n" \
+              << "                             time needed per id lookup\n" \
+              << "  -N, --bench-load=N         Only write N synthetic riversystems csv rows\n" \
+              << "                             to " << bench_csv_file << " and print the load\n" \
+              << "                             time with 1 to all hardware threads\n" \
+              << "  -p, --prefilter            Only store locations of waterway nodes\n" \
+              << "                             (reads the ways of INFILE twice)\n" \
+              << "  -S, --save-locations=FILE  Save the locations of all nodes into a\n" \
+              << "                             location cache (INFILE must be sorted)\n" \
+              << "  -D, --dense-locations      Save a dense location cache (for planet\n" \
+              << "                             files, Default: sparse)\n" \
+              << "  -C, --load-locations=FILE  Use location cache saved before instead of\n" \
+              << "                             reading the nodes of INFILE\n" \
+              << "  -x, --bbox=BOX             Only export waterways in BOX (LON1,LAT1,LON2,\n" \
+              << "                             LAT2), clipped at its boundary\n" \
+              << "  -g, --polygon=FILE         Only export waterways in the polygon in FILE\n" \
+              << "                             (Osmosis .poly format), clipped at its boundary\n" \
+              << "  -e, --read=PROFILE         Object types to read and ',meta' to decode\n" \
+              << "                             metadata (Default: 'auto', nodes and ways\n" \
+              << "                             without metadata, only ways with a\n" \
+              << "                             location cache)\n" \
+              << "  -T, --time-read            Only read INFILE and report the decode time\n" \
+              << "  -v, --progress             Report bytes read, objects per second,\n" \
+              << "                             features written and ETA every 10 seconds\n" \
+              << "  -J, --stats=FILE           Write times per stage, memory use, object and\n" \
+              << "                             feature counts and errors to JSON FILE\n" \
               << "  -L                         See available location stores\n";
 }
 
@@ -151,8 +145,24 @@ int main(int argc, char* argv[]) {
         static struct option long_options[] = {
             {"help",                 no_argument,       nullptr, 'h'},
             {"format",               required_argument, nullptr, 'f'},
+            {"tx-batch",             required_argument, nullptr, 't'},
+            {"defer-index",          no_argument,       nullptr, 'I'},
+            {"writer",               required_argument, nullptr, 'w'},
             {"location_store",       required_argument, nullptr, 'l'},
             {"riversystems",         required_argument, nullptr, 'r'},
+            {"build-index",          required_argument, nullptr, 'B'},
+            {"bench-lookup",         no_argument,       nullptr, 'b'},
+            {"bench-load",           required_argument, nullptr, 'N'},
+            {"prefilter",            no_argument,       nullptr, 'p'},
+            {"save-locations",       required_argument, nullptr, 'S'},
+            {"dense-locations",      no_argument,       nullptr, 'D'},
+            {"load-locations",       required_argument, nullptr, 'C'},
+            {"bbox",                 required_argument, nullptr, 'x'},
+            {"polygon",              required_argument, nullptr, 'g'},
+            {"read",                 required_argument, nullptr, 'e'},
+            {"time-read",            no_argument,       nullptr, 'T'},
+            {"progress",             no_argument,       nullptr, 'v'},
+            {"stats",                required_argument, nullptr, 'J'},
             {"list_location_stores", no_argument,       nullptr, 'L'},
             {nullptr, 0, nullptr, 0}
         };
@@ -160,9 +170,25 @@ int main(int argc, char* argv[]) {
         std::string output_format{"SQLite"};
         std::string location_store{"flex_mem"};
         std::string rsystems_file;
+        std::string index_file;
+        bool bench = false;
+        std::size_t bench_rows = 0;
+        bool prefilter = false;
+        std::string save_locations;
+        bool dense_locations = false;
+        std::string load_locations;
+        std::uint64_t tx_batch = 0;
+        bool defer_index = false;
+        std::string writer{"ogr"};
+        std::string bbox;
+        std::string polygon_file;
+        std::string read_profile{"auto"};
+        bool only_time_read = false;
+        bool show_progress = false;
+        std::string stats_file;
 
         while (true) {
-            const int c = getopt_long(argc, argv, "hf:l:r:L", long_options, nullptr);
+            const int c = getopt_long(argc, argv, "hf:t:Iw:l:r:B:bN:pS:DC:x:g:e:TvJ:L", long_options, nullptr);
             if (c == -1) {
                 break;
             }
@@ -174,12 +200,68 @@ int main(int argc, char* argv[]) {
                 case 'f':
                     output_format = optarg;
                     break;
+                case 't':
+                    tx_batch = std::strtoull(optarg, nullptr, 10);
+                    break;
+                case 'I':
+                    defer_index = true;
+                    break;
+                case 'w':
+                    writer = optarg;
+                    if (writer != "ogr" && writer != "native" && writer != "fgb") {
+                        std::cerr << "Unknown writer '" << writer << "'. Use 'ogr', 'native' or 'fgb'.\n";
+                        return 1;
+                    }
+                    break;
                 case 'l':
                     location_store = optarg;
                     break;
                 case 'r':
                     rsystems_file = optarg;
                     break;
+                case 'B':
+                    index_file = optarg;
+                    break;
+                case 'b':
+                    bench = true;
+                    break;
+                case 'N':
+                    bench_rows = std::strtoull(optarg, nullptr, 10);
+                    if (bench_rows == 0) {
+                        std::cerr << "Option --bench-load needs a number of rows\n";
+                        return 1;
+                    }
+                    break;
+                case 'p':
+                    prefilter = true;
+                    break;
+                case 'S':
+                    save_locations = optarg;
+                    break;
+                case 'D':
+                    dense_locations = true;
+                    break;
+                case 'C':
+                    load_locations = optarg;
+                    break;
+                case 'x':
+                    bbox = optarg;
+                    break;
+                case 'g':
+                    polygon_file = optarg;
+                    break;
+                case 'e':
+                    read_profile = optarg;
+                    break;
+                case 'T':
+                    only_time_read = true;
+                    break;
+                case 'v':
+                    show_progress = true;
+                    break;
+                case 'J':
+                    stats_file = optarg;
+                    break;
                 case 'L':
                     std::cout << "Available map types:\n";
                     for (const auto& map_type : map_factory.map_types()) {
@@ -191,6 +273,34 @@ int main(int argc, char* argv[]) {
             }
         }
 
+        if (!index_file.empty()) {
+            if (rsystems_file.empty()) {
+                std::cerr << "Option --build-index needs --riversystems\n";
+                return 1;
+            }
+            RiversystemMap rsystems;
+            rsystems.load(rsystems_file, std::max(std::thread::hardware_concurrency(), 1U));
+            rsystems.write_index(index_file);
+            std::cerr << "Wrote index with " << rsystems.size() << " river system ids to " << index_file << "\n";
+            return 0;
+        }
+
+        if (bench_rows > 0) {
+            bench_load(bench_rows, bench_csv_file);
+            return 0;
+        }
+
+        if (bench) {
+            if (rsystems_file.empty()) {
+                std::cerr << "Option --bench-lookup needs --riversystems\n";
+                return 1;
+            }
+            RiversystemMap rsystems;
+            rsystems.load(rsystems_file, std::max(std::thread::hardware_concurrency(), 1U));
+            bench_lookup(rsystems);
+            return 0;
+        }
+
         std::string input_filename;
         std::string output_filename{"ogr_out"};
         const int remaining_args = argc - optind;
@@ -208,32 +318,185 @@ int main(int argc, char* argv[]) {
             input_filename = "-";
         }
 
-        osmium::io::Reader reader{input_filename};
+        if (!load_locations.empty() && (prefilter || !save_locations.empty())) {
+            std::cerr << "Option --load-locations can't be used with --prefilter or --save-locations\n";
+            return 1;
+        }
+
+        if (writer == "native" && output_format != "SQLite") {
+            std::cerr << "The native writer only supports the 'SQLite' format\n";
+            return 1;
+        }
+
+        const osmium::io::File input_file{input_filename};
+
+        // With a location cache the nodes don't have to be read at all.
+        const ReadProfile profile = parse_read_profile(read_profile, {
+            load_locations.empty() ? osmium::osm_entity_bits::node | osmium::osm_entity_bits::way : osmium::osm_entity_bits::way,
+            osmium::io::read_meta::no
+        });
+        if (only_time_read) {
+            time_read(input_file, profile);
+            return 0;
+        }
+
+        const std::unique_ptr<Region> region = Region::from_options(bbox, polygon_file);
+
+        std::unique_ptr<ProgressReporter> progress;
+        if (show_progress) {
+            progress.reset(new ProgressReporter{});
+        }
+
+        std::unique_ptr<RunStats> stats;
+        if (!stats_file.empty()) {
+            stats.reset(new RunStats{"osmium_rivermap"});
+            stats->set_input(input_file);
+        }
+
+        // Only the locations of nodes used by waterways are needed.
+        id_set_type node_ids;
+        if (prefilter) {
+            std::cerr << "Prefilter...\n";
+            if (stats) {
+                stats->begin_stage("prefilter");
+            }
+            collect_way_nodes(input_file, node_ids, [](const osmium::Way& way) {
+                return is_waterway(way);
+            });
+            std::cerr << "Prefilter done: " << node_ids.size() << " nodes needed\n";
+            if (stats) {
+                stats->end_stage();
+            }
+        }
 
-        std::unique_ptr<index_type> index = map_factory.create_map(location_store);
+        // Declared before the index, so the index is closed before its
+        // file is removed, also if something throws.
+        const std::string location_file = output_filename + ".locations";
+        FileRemover location_remover;
+        std::unique_ptr<index_type> index;
+        if (!load_locations.empty()) {
+            if (stats) {
+                stats->begin_stage("index_load");
+            }
+            LocationCacheMap* cache = new LocationCacheMap{load_locations};
+            index.reset(cache);
+            std::cerr << "Mapped " << (cache->dense() ? "dense" : "sparse") << " location cache with "
+                      << cache->size() << " entries\n";
+        } else {
+            if (location_store == "auto") {
+                location_store = auto_location_store(input_file, location_file);
+                if (location_store != "flex_mem") {
+                    location_remover.set(location_file);
+                }
+            }
+            index = map_factory.create_map(location_store);
+        }
         location_handler_type location_handler{*index};
         location_handler.ignore_errors();
+        PrefilteredLocations<location_handler_type> filtered_location_handler{location_handler, prefilter ? &node_ids : nullptr};
 
-        CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
-        gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
+        std::unique_ptr<LocationCacheWriter> cache_writer;
+        if (!save_locations.empty()) {
+            cache_writer.reset(new LocationCacheWriter{save_locations, dense_locations});
+        }
+        CachingLocations<PrefilteredLocations<location_handler_type>> caching_location_handler{filtered_location_handler, cache_writer.get()};
 
         RiversystemMap rsystems;
         if (! rsystems_file.empty()) {
-            rsystems.load(rsystems_file);
+            if (stats) {
+                stats->begin_stage("index_load");
+            }
+            const auto start = std::chrono::steady_clock::now();
+            rsystems.load(rsystems_file, std::max(std::thread::hardware_concurrency(), 1U));
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr << (rsystems.is_mapped() ? "Mapped " : "Loaded ") << rsystems.size() << " river system ids with "
+                      << rsystems.num_names() << " names in " << elapsed.count() << " s ("
+                      << (rsystems.size() ? rsystems.used_memory() / rsystems.size() : 0)
+                      << " bytes per id)\n";
+        }
+        if (stats) {
+            stats->end_stage();
+        }
+
+        CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
+
+        if (writer == "fgb") {
+            FlatGeobufWaterwayOutput output{output_filename};
+            const double elapsed = write_waterways(input_file, profile, caching_location_handler, region.get(), output, rsystems, progress.get(), stats.get());
+            print_phase_time("Writing features", elapsed);
+
+            if (stats) {
+                stats->begin_stage("spatial_index");
+            }
+            const auto index_start = std::chrono::steady_clock::now();
+            output.close();
+            const std::chrono::duration<double> index_elapsed = std::chrono::steady_clock::now() - index_start;
+            print_phase_time("Creating spatial index and final file", index_elapsed.count());
+        } else if (writer == "native") {
+            // Let OGR create the database with the same schema as above,
+            // but without spatial index, then write the rows directly.
+            {
+                gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
+                gdalcpp::Layer layer{dataset, "waterway", wkbLineString, layer_options(true)};
+                add_waterway_fields(layer);
+            }
+
+            NativeWaterwayOutput output{output_filename, tx_batch};
+            const double elapsed = write_waterways(input_file, profile, caching_location_handler, region.get(), output, rsystems, progress.get(), stats.get());
+            if (stats) {
+                stats->begin_stage("ogr_commit");
+            }
+            output.close();
+            print_phase_time("Writing features", elapsed);
+
+            if (stats) {
+                stats->begin_stage("spatial_index");
+            }
+            const auto index_start = std::chrono::steady_clock::now();
+            create_spatial_index(output_filename, "waterway");
+            const std::chrono::duration<double> index_elapsed = std::chrono::steady_clock::now() - index_start;
+            print_phase_time("Creating spatial indexes", index_elapsed.count());
+        } else {
+            gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
+            setup_transactions(dataset, tx_batch);
+            defer_index = setup_deferred_index(dataset, defer_index);
+
+            OGRWaterwayOutput output{dataset, defer_index};
+            const double elapsed = write_waterways(input_file, profile, caching_location_handler, region.get(), output, rsystems, progress.get(), stats.get());
+            if (stats) {
+                stats->begin_stage("ogr_commit");
+            }
+            finish_transactions(dataset);
+            print_phase_time("Writing features", elapsed);
+
+            if (defer_index) {
+                if (stats) {
+                    stats->begin_stage("spatial_index");
+                }
+                const auto index_start = std::chrono::steady_clock::now();
+                output.create_spatial_indexes(dataset);
+                const std::chrono::duration<double> index_elapsed = std::chrono::steady_clock::now() - index_start;
+                print_phase_time("Creating spatial indexes", index_elapsed.count());
+            }
+        }
+
+        if (stats) {
+            stats->end_stage();
+            stats->set_location_index(load_locations.empty() ? location_store : "location_cache", index->size(), index->used_memory());
+        }
+
+        if (cache_writer) {
+            cache_writer->close();
+            std::cerr << "Saved " << cache_writer->nodes() << " node locations ("
+                      << (cache_writer->bytes_written() / (1024 * 1024)) << " MBytes) to " << save_locations << "\n";
         }
-        MyOGRHandler ogr_handler{dataset, rsystems};
 
-        osmium::apply(reader, location_handler, ogr_handler);
-        reader.close();
+        index.reset();
+        location_remover.remove();
 
-        /*
-        const int locations_fd = ::open("locations.dump", O_WRONLY | O_CREAT, 0644);
-        if (locations_fd < 0) {
-            throw std::system_error{errno, std::system_category(), "Open failed"};
+        if (stats) {
+            stats->write(stats_file);
         }
-        index->dump_as_list(locations_fd);
-        ::close(locations_fd);
-        */
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << '\n';
         return 1;
@@ -7,137 +7,91 @@
 
 #include <gdalcpp.hpp>
 
-#include <osmium/geom/ogr.hpp>
-#include <osmium/handler.hpp>
 #include <osmium/handler/node_locations_for_ways.hpp>
 #include <osmium/index/map/all.hpp> // IWYU pragma: keep
 #include <osmium/io/any_input.hpp> // IWYU pragma: keep
 #include <osmium/visitor.hpp>
 
-#include <cerrno>
+#include "base_layers_handler.hpp"
+#include "location_cache.hpp"
+#include "layer_config.hpp"
+#include "location_store.hpp"
+#include "read_profile.hpp"
+#include "region.hpp"
+#include "run_stats.hpp"
+#include "node_prefilter.hpp"
+#include "ogr_output.hpp"
+#include "progress.hpp"
+#include "split_layers.hpp"
+#include "tag_dispatch.hpp"
+#include "temp_file.hpp"
+#include "util.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
-#include <fcntl.h>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <string>
-#include <system_error>
-
-#ifndef _MSC_VER
-# include <unistd.h>
-#endif
+#include <vector>
 
 using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
-class MyOGRHandler : public osmium::handler::Handler {
-
-    gdalcpp::Layer* m_layer_places;
-    gdalcpp::Layer* m_layer_peaks;
-    gdalcpp::Layer* m_layer_roads;
-    gdalcpp::Layer* m_layer_railways;
-    gdalcpp::Layer* m_layer_boundaries;
-
-    osmium::geom::OGRFactory<> m_factory;
-
-public:
-
-    explicit MyOGRHandler(gdalcpp::Dataset& dataset) {
-        m_layer_places = new gdalcpp::Layer(dataset, "places", wkbPoint);
-        m_layer_places->add_field("id", OFTReal, 10);
-        m_layer_places->add_field("type", OFTString, 32);
-        m_layer_places->add_field("name", OFTString, 32);
-
-        m_layer_peaks = new gdalcpp::Layer(dataset, "peaks", wkbPoint);
-        m_layer_peaks->add_field("id", OFTReal, 10);
-        m_layer_peaks->add_field("type", OFTString, 32);
-        m_layer_peaks->add_field("name", OFTString, 32);
-        m_layer_peaks->add_field("importance", OFTString, 32);
-        m_layer_peaks->add_field("ele", OFTString, 12);
-
-        m_layer_roads = new gdalcpp::Layer(dataset, "roads", wkbLineString);
-        m_layer_roads->add_field("id", OFTReal, 10);
-        m_layer_roads->add_field("type", OFTString, 32);
-        m_layer_roads->add_field("name", OFTString, 32);
-        m_layer_roads->add_field("ref", OFTString, 16);
-
-        m_layer_railways = new gdalcpp::Layer(dataset, "railways", wkbLineString);
-        m_layer_railways->add_field("id", OFTReal, 10);
-
-        m_layer_boundaries = new gdalcpp::Layer(dataset, "boundaries", wkbLineString);
-        m_layer_boundaries->add_field("id", OFTReal, 10);
-        m_layer_boundaries->add_field("level", OFTInteger, 4);
-    }
-
-    ~MyOGRHandler() {
-        delete m_layer_places;
-        delete m_layer_peaks;
-        delete m_layer_roads;
-        delete m_layer_railways;
-        delete m_layer_boundaries;
+// Add the features written per layer, the geometry errors and the time
+// the handler spent handing features to the output as stage write_stage
+// to the stats.
+template <typename THandler>
+void add_layer_stats(RunStats& stats, const LayerConfig& config, const THandler& handler, const char* write_stage, const StageTime& write_time) {
+    stats.add_stage(write_stage, write_time);
+    for (std::size_t i = 0; i < config.layers().size(); ++i) {
+        stats.add_features(config.layers()[i].name, handler.layer_features(i));
     }
+    stats.add_errors("geometry", handler.geometry_errors());
+}
 
-    void node(const osmium::Node& node) {
-        const char* place = node.tags().get_value_by_key("place");
-        const char* natural = node.tags().get_value_by_key("natural");
-        if (place && (0 == std::strcmp(place, "town") || 0 == std::strcmp(place, "city"))) {
-            gdalcpp::Feature feature{*m_layer_places, m_factory.create_point(node)};
-            feature.set_field("id", static_cast<double>(node.id()));
-            feature.set_field("type", place);
-            feature.set_field("name", node.tags().get_value_by_key("name"));
-            feature.add_to_layer();
-        }
-        else if (natural && 0 == std::strcmp(natural, "peak")) {
-            gdalcpp::Feature feature{*m_layer_peaks, m_factory.create_point(node)};
-            feature.set_field("id", static_cast<double>(node.id()));
-            feature.set_field("type", natural);
-            feature.set_field("name", node.tags().get_value_by_key("name"));
-            feature.set_field("ele", node.tags().get_value_by_key("ele"));
-            feature.set_field("importance", node.tags().get_value_by_key("importance"));
-            feature.add_to_layer();
-        }
-    }
+/* ================================================== */
 
-    void way(const osmium::Way& way) {
-        const char* highway = way.tags().get_value_by_key("highway");
-        const char* railway = way.tags().get_value_by_key("railway");
-        const char* boundary = way.tags().get_value_by_key("boundary");
-        if (highway && (0 == std::strcmp(highway, "motorway") || 0 == std::strcmp(highway, "motorway_link"))) {
-            try {
-                gdalcpp::Feature feature{*m_layer_roads, m_factory.create_linestring(way)};
-                feature.set_field("id", static_cast<double>(way.id()));
-                feature.set_field("type", highway);
-                feature.set_field("name", way.tags().get_value_by_key("name"));
-                feature.set_field("ref", way.tags().get_value_by_key("ref"));
-                feature.add_to_layer();
-            } catch (const osmium::geometry_error&) {
-                std::cerr << "Ignoring illegal geometry for way " << way.id() << ".\n";
-            }
-        } else if (railway && 0 == std::strcmp(railway, "rail")) {
-            try {
-                gdalcpp::Feature feature{*m_layer_railways, m_factory.create_linestring(way)};
-                feature.set_field("id", static_cast<double>(way.id()));
-                feature.add_to_layer();
-            } catch (const osmium::geometry_error&) {
-                std::cerr << "Ignoring illegal geometry for way " << way.id() << ".\n";
-            }
-        } else if (boundary && 0 == std::strcmp(boundary, "administrative")) {
-            try {
-                gdalcpp::Feature feature{*m_layer_boundaries, m_factory.create_linestring(way)};
-                feature.set_field("id", static_cast<double>(way.id()));
-                const char* admin_level = way.tags().get_value_by_key("admin_level");
-                feature.set_field("level", admin_level!=nullptr? atoi(admin_level) : 99);
-                feature.add_to_layer();
-            } catch (const osmium::geometry_error&) {
-                std::cerr << "Ignoring illegal geometry for way " << way.id() << ".\n";
+// Read nodes and ways and only classify them, to measure the cost of the
+// tag dispatch per object.
+void bench_classify(const osmium::io::File& input_file, const LayerConfig& config) {
+    osmium::io::Reader reader{input_file, osmium::osm_entity_bits::node | osmium::osm_entity_bits::way, osmium::io::read_meta::no};
+
+    std::vector<const char*> values(config.max_attributes());
+    std::uint64_t objects = 0;
+    std::uint64_t matched = 0;
+    std::chrono::duration<double> elapsed{0};
+
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            int layer = TagDispatcher::no_target;
+            if (object.type() == osmium::item_type::node) {
+                layer = config.node_dispatcher().classify(object.tags(), values.data());
+            } else if (object.type() == osmium::item_type::way) {
+                layer = config.way_dispatcher().classify(object.tags(), values.data());
+            }
+            ++objects;
+            if (layer != TagDispatcher::no_target) {
+                ++matched;
             }
         }
+        elapsed += std::chrono::steady_clock::now() - start;
     }
+    reader.close();
 
-};
-
-/* ================================================== */
+    std::cerr << "Classified " << objects << " objects (" << matched << " matched) in "
+              << elapsed.count() << "s";
+    if (objects > 0) {
+        std::cerr << ", " << (elapsed.count() * 1e9 / static_cast<double>(objects)) << " ns/object";
+    }
+    std::cerr << "\n";
+}
 
 void print_help() {
     std::cout << "osmium_toogr [OPTIONS] [INFILE [OUTFILE]]\n\n" \
@@ -145,8 +99,44 @@ void print_help() {
               << "If OUTFILE is not given 'ogr_out' is used.\n" \
               << "\nOptions:\n" \
               << "  -h, --help                 This help message\n" \
-              << "  -l, --location_store=TYPE  Set location store\n" \
+              << "  -l, --location_store=TYPE  Set location store ('auto' chooses from input\n" \
+              << "                             size and available memory)\n" \
               << "  -f, --format=FORMAT        Output OGR format (Default: 'SQLite')\n" \
+              << "  -t, --tx-batch=N           Write N features per transaction (Default: 0,\n" \
+              << "                             no explicit transactions, every feature is\n" \
+              << "                             committed on its own; use 1000 or more for\n" \
+              << "                             SQLite and GPKG)\n" \
+              << "  -I, --defer-index          Create spatial index after all features are\n" \
+              << "                             written (SQLite and GPKG only)\n" \
+              << "  -p, --prefilter            Only store locations of nodes needed by\n" \
+              << "                             exported ways (reads the ways of INFILE twice)\n" \
+              << "  -S, --save-locations=FILE  Save the locations of all nodes into a\n" \
+              << "                             location cache (INFILE must be sorted)\n" \
+              << "  -D, --dense-locations      Save a dense location cache (for planet\n" \
+              << "                             files, Default: sparse)\n" \
+              << "  -C, --load-locations=FILE  Use location cache saved before instead of\n" \
+              << "                             storing the node locations of INFILE\n" \
+              << "  -c, --layers=FILE          Read the layer definitions from FILE (Default:\n" \
+              << "                             places, peaks, roads, railways, boundaries)\n" \
+              << "  -P, --print-layers         Print the default layer definitions\n" \
+              << "  -s, --split-layers         Write every layer into its own dataset (named\n" \
+              << "                             OUTFILE with _LAYER before the suffix), each\n" \
+              << "                             on its own thread\n" \
+              << "  -m, --merge                Merge the split layers into OUTFILE at the end\n" \
+              << "  -b, --bench-classify       Only classify the nodes and ways of INFILE and\n" \
+              << "                             print the time needed per object\n" \
+              << "  -x, --bbox=BOX             Only export objects in BOX (LON1,LAT1,LON2,\n" \
+              << "                             LAT2), ways are clipped at its boundary\n" \
+              << "  -g, --polygon=FILE         Only export objects in the polygon in FILE\n" \
+              << "                             (Osmosis .poly format), ways are clipped\n" \
+              << "  -e, --read=PROFILE         Object types to read and ',meta' to decode\n" \
+              << "                             metadata (Default: 'auto', nodes and ways\n" \
+              << "                             without metadata)\n" \
+              << "  -T, --time-read            Only read INFILE and report the decode time\n" \
+              << "  -v, --progress             Report bytes read, objects per second,\n" \
+              << "                             features written and ETA every 10 seconds\n" \
+              << "  -J, --stats=FILE           Write times per stage, memory use, object and\n" \
+              << "                             feature counts and errors to JSON FILE\n" \
               << "  -L                         See available location stores\n";
 }
 
@@ -157,16 +147,49 @@ int main(int argc, char* argv[]) {
         static struct option long_options[] = {
             {"help",                 no_argument,       nullptr, 'h'},
             {"format",               required_argument, nullptr, 'f'},
+            {"tx-batch",             required_argument, nullptr, 't'},
+            {"defer-index",          no_argument,       nullptr, 'I'},
             {"location_store",       required_argument, nullptr, 'l'},
+            {"prefilter",            no_argument,       nullptr, 'p'},
+            {"save-locations",       required_argument, nullptr, 'S'},
+            {"dense-locations",      no_argument,       nullptr, 'D'},
+            {"load-locations",       required_argument, nullptr, 'C'},
+            {"layers",               required_argument, nullptr, 'c'},
+            {"print-layers",         no_argument,       nullptr, 'P'},
+            {"split-layers",         no_argument,       nullptr, 's'},
+            {"merge",                no_argument,       nullptr, 'm'},
+            {"bench-classify",       no_argument,       nullptr, 'b'},
+            {"bbox",                 required_argument, nullptr, 'x'},
+            {"polygon",              required_argument, nullptr, 'g'},
+            {"read",                 required_argument, nullptr, 'e'},
+            {"time-read",            no_argument,       nullptr, 'T'},
+            {"progress",             no_argument,       nullptr, 'v'},
+            {"stats",                required_argument, nullptr, 'J'},
             {"list_location_stores", no_argument,       nullptr, 'L'},
             {nullptr, 0, nullptr, 0}
         };
 
         std::string output_format{"SQLite"};
         std::string location_store{"flex_mem"};
+        bool prefilter = false;
+        std::string save_locations;
+        bool dense_locations = false;
+        std::string load_locations;
+        std::uint64_t tx_batch = 0;
+        bool defer_index = false;
+        std::string layers_file;
+        bool split_layers = false;
+        bool merge_layers = false;
+        bool bench = false;
+        std::string bbox;
+        std::string polygon_file;
+        std::string read_profile{"auto"};
+        bool only_time_read = false;
+        bool show_progress = false;
+        std::string stats_file;
 
         while (true) {
-            const int c = getopt_long(argc, argv, "hf:l:L", long_options, nullptr);
+            const int c = getopt_long(argc, argv, "hf:t:Il:pS:DC:c:Psmbx:g:e:TvJ:L", long_options, nullptr);
             if (c == -1) {
                 break;
             }
@@ -178,9 +201,60 @@ int main(int argc, char* argv[]) {
                 case 'f':
                     output_format = optarg;
                     break;
+                case 't':
+                    tx_batch = std::strtoull(optarg, nullptr, 10);
+                    break;
+                case 'I':
+                    defer_index = true;
+                    break;
                 case 'l':
                     location_store = optarg;
                     break;
+                case 'p':
+                    prefilter = true;
+                    break;
+                case 'S':
+                    save_locations = optarg;
+                    break;
+                case 'D':
+                    dense_locations = true;
+                    break;
+                case 'C':
+                    load_locations = optarg;
+                    break;
+                case 'c':
+                    layers_file = optarg;
+                    break;
+                case 'P':
+                    std::cout << LayerConfig::builtin_text();
+                    return 0;
+                case 's':
+                    split_layers = true;
+                    break;
+                case 'm':
+                    merge_layers = true;
+                    break;
+                case 'b':
+                    bench = true;
+                    break;
+                case 'x':
+                    bbox = optarg;
+                    break;
+                case 'g':
+                    polygon_file = optarg;
+                    break;
+                case 'e':
+                    read_profile = optarg;
+                    break;
+                case 'T':
+                    only_time_read = true;
+                    break;
+                case 'v':
+                    show_progress = true;
+                    break;
+                case 'J':
+                    stats_file = optarg;
+                    break;
                 case 'L':
                     std::cout << "Available map types:\n";
                     for (const auto& map_type : map_factory.map_types()) {
@@ -209,27 +283,213 @@ int main(int argc, char* argv[]) {
             input_filename = "-";
         }
 
-        osmium::io::Reader reader{input_filename};
+        if (!load_locations.empty() && (prefilter || !save_locations.empty())) {
+            std::cerr << "Option --load-locations can't be used with --prefilter or --save-locations\n";
+            return 1;
+        }
+
+        if (merge_layers && !split_layers) {
+            std::cerr << "Option --merge needs --split-layers\n";
+            return 1;
+        }
+
+        const LayerConfig layer_config = layers_file.empty() ? LayerConfig::builtin() : LayerConfig::from_file(layers_file);
+
+        const osmium::io::File input_file{input_filename};
 
-        std::unique_ptr<index_type> index = map_factory.create_map(location_store);
+        const ReadProfile profile = parse_read_profile(read_profile, {
+            osmium::osm_entity_bits::node | osmium::osm_entity_bits::way,
+            osmium::io::read_meta::no
+        });
+        if (only_time_read) {
+            time_read(input_file, profile);
+            return 0;
+        }
+
+        if (bench) {
+            bench_classify(input_file, layer_config);
+            return 0;
+        }
+
+        const std::unique_ptr<Region> region = Region::from_options(bbox, polygon_file);
+
+        std::unique_ptr<RunStats> stats;
+        if (!stats_file.empty()) {
+            stats.reset(new RunStats{"osmium_toogr"});
+            stats->set_input(input_file);
+        }
+        StatsHandler stats_handler{stats.get()};
+        StageTime write_time;
+
+        // Only the locations of nodes used by exported ways are needed.
+        id_set_type node_ids;
+        if (prefilter) {
+            std::cerr << "Prefilter...\n";
+            if (stats) {
+                stats->begin_stage("prefilter");
+            }
+            collect_way_nodes(input_file, node_ids, [&layer_config](const osmium::Way& way) {
+                return layer_config.wanted(way);
+            });
+            std::cerr << "Prefilter done: " << node_ids.size() << " nodes needed\n";
+            if (stats) {
+                stats->end_stage();
+            }
+        }
+
+        std::unique_ptr<ProgressReporter> progress;
+        if (show_progress) {
+            progress.reset(new ProgressReporter{});
+        }
+
+        osmium::io::Reader reader{input_file, profile.entities, profile.meta};
+        ProgressHandler progress_handler{progress.get(), &reader};
+
+        // The nodes are still needed for the places and peaks, but with a
+        // location cache none of them go into the index: the empty node id
+        // set filters them all out.
+        // Declared before the index, so the index is closed before its
+        // file is removed, also if something throws.
+        const std::string location_file = output_filename + ".locations";
+        FileRemover location_remover;
+        std::unique_ptr<index_type> index;
+        if (!load_locations.empty()) {
+            if (stats) {
+                stats->begin_stage("index_load");
+            }
+            LocationCacheMap* cache = new LocationCacheMap{load_locations};
+            index.reset(cache);
+            std::cerr << "Mapped " << (cache->dense() ? "dense" : "sparse") << " location cache with "
+                      << cache->size() << " entries\n";
+            if (stats) {
+                stats->end_stage();
+            }
+        } else {
+            if (location_store == "auto") {
+                location_store = auto_location_store(input_file, location_file);
+                if (location_store != "flex_mem") {
+                    location_remover.set(location_file);
+                }
+            }
+            index = map_factory.create_map(location_store);
+        }
         location_handler_type location_handler{*index};
         location_handler.ignore_errors();
+        PrefilteredLocations<location_handler_type> filtered_location_handler{location_handler, (prefilter || !load_locations.empty()) ? &node_ids : nullptr};
+
+        std::unique_ptr<LocationCacheWriter> cache_writer;
+        if (!save_locations.empty()) {
+            cache_writer.reset(new LocationCacheWriter{save_locations, dense_locations});
+        }
+        CachingLocations<PrefilteredLocations<location_handler_type>> caching_location_handler{filtered_location_handler, cache_writer.get()};
 
         CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
-        gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
-        MyOGRHandler ogr_handler{dataset};
+        if (split_layers) {
+            SplitLayersOutput output{output_format, output_filename, layer_config, tx_batch, defer_index, merge_layers};
+            BaseLayersHandler<SplitLayersOutput> ogr_handler{layer_config, output};
+            RegionFilter<BaseLayersHandler<SplitLayersOutput>> region_filter{region.get(), ogr_handler};
+            if (progress) {
+                ogr_handler.add_progress_counters(*progress);
+                progress->start("Writing features", file_size(input_file));
+            }
+            if (stats) {
+                ogr_handler.set_write_time(&write_time);
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            osmium::apply(reader, progress_handler, stats_handler, caching_location_handler, region_filter);
+            progress_handler.publish();
+            reader.close();
+            if (progress) {
+                progress->stop();
+            }
+            stats_handler.finish();
+            if (stats) {
+                // The handler only builds the geometries and queues the
+                // features, the writes happen on the layer threads.
+                add_layer_stats(*stats, layer_config, ogr_handler, "ogr_enqueue", write_time);
+                stats->begin_stage("ogr_commit");
+            }
+            output.finish();
+            if (stats) {
+                stats->add_stage("ogr_writes", output.write_time());
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            region_filter.print_stats();
+            print_feature_rate(ogr_handler.features(), elapsed.count());
+            print_phase_time("Writing features", elapsed.count());
+
+            if (merge_layers) {
+                if (stats) {
+                    stats->begin_stage("merge_layers");
+                }
+                const auto merge_start = std::chrono::steady_clock::now();
+                gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
+                output.merge(dataset, setup_deferred_index(dataset, defer_index));
+                const std::chrono::duration<double> merge_elapsed = std::chrono::steady_clock::now() - merge_start;
+                print_phase_time("Merging layers", merge_elapsed.count());
+            }
+        } else {
+            gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
+            setup_transactions(dataset, tx_batch);
+            defer_index = setup_deferred_index(dataset, defer_index);
+            OGRBaseLayersOutput output{dataset, layer_config, defer_index};
+            BaseLayersHandler<OGRBaseLayersOutput> ogr_handler{layer_config, output};
+            RegionFilter<BaseLayersHandler<OGRBaseLayersOutput>> region_filter{region.get(), ogr_handler};
+            if (progress) {
+                ogr_handler.add_progress_counters(*progress);
+                progress->start("Writing features", file_size(input_file));
+            }
+            if (stats) {
+                ogr_handler.set_write_time(&write_time);
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            osmium::apply(reader, progress_handler, stats_handler, caching_location_handler, region_filter);
+            progress_handler.publish();
+            reader.close();
+            if (progress) {
+                progress->stop();
+            }
+            stats_handler.finish();
+            if (stats) {
+                add_layer_stats(*stats, layer_config, ogr_handler, "ogr_writes", write_time);
+                stats->begin_stage("ogr_commit");
+            }
+            finish_transactions(dataset);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            region_filter.print_stats();
+            print_feature_rate(ogr_handler.features(), elapsed.count());
+            print_phase_time("Writing features", elapsed.count());
+
+            if (defer_index) {
+                if (stats) {
+                    stats->begin_stage("spatial_index");
+                }
+                const auto index_start = std::chrono::steady_clock::now();
+                output.create_spatial_indexes(dataset);
+                const std::chrono::duration<double> index_elapsed = std::chrono::steady_clock::now() - index_start;
+                print_phase_time("Creating spatial indexes", index_elapsed.count());
+            }
+        }
+
+        if (stats) {
+            stats->end_stage();
+            stats->set_location_index(load_locations.empty() ? location_store : "location_cache", index->size(), index->used_memory());
+        }
+
+        if (cache_writer) {
+            cache_writer->close();
+            std::cerr << "Saved " << cache_writer->nodes() << " node locations ("
+                      << (cache_writer->bytes_written() / (1024 * 1024)) << " MBytes) to " << save_locations << "\n";
+        }
 
-        osmium::apply(reader, location_handler, ogr_handler);
-        reader.close();
+        index.reset();
+        location_remover.remove();
 
-        /*
-        const int locations_fd = ::open("locations.dump", O_WRONLY | O_CREAT, 0644);
-        if (locations_fd < 0) {
-            throw std::system_error{errno, std::system_category(), "Open failed"};
+        if (stats) {
+            stats->write(stats_file);
         }
-        index->dump_as_list(locations_fd);
-        ::close(locations_fd);
-        */
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << '\n';
         return 1;
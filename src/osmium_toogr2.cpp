@@ -12,64 +12,124 @@
 
 #include <osmium/area/assembler.hpp>
 #include <osmium/area/multipolygon_manager.hpp>
-#include <osmium/geom/mercator_projection.hpp>
-#include <osmium/geom/ogr.hpp>
-#include <osmium/handler.hpp>
 #include <osmium/handler/node_locations_for_ways.hpp>
-#include <osmium/index/map/flex_mem.hpp> // IWYU pragma: keep
+#include <osmium/index/map/all.hpp> // IWYU pragma: keep
 #include <osmium/io/any_input.hpp> // IWYU pragma: keep
 #include <osmium/util/memory.hpp>
 #include <osmium/visitor.hpp>
 
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
-using index_type = osmium::index::map::FlexMem<osmium::unsigned_object_id_type, osmium::Location>;
+#include "geometry_pipeline.hpp"
+#include "location_store.hpp"
+#include "node_prefilter.hpp"
+#include "ogr_output.hpp"
+#include "parallel_areas.hpp"
+#include "progress.hpp"
+#include "read_profile.hpp"
+#include "region.hpp"
+#include "run_stats.hpp"
+#include "spilled_multipolygons.hpp"
+#include "temp_file.hpp"
+#include "thread_count.hpp"
+#include "util.hpp"
+#include "water_layer.hpp"
+
+using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
-template <class TProjection>
-class MyOGRHandler : public osmium::handler::Handler {
-
-    gdalcpp::Layer m_layer_polygon;
-
-    osmium::geom::OGRFactory<TProjection>& m_factory;
+// Run the second pass, the areas are assembled on this thread or the
+// area threads, their geometries are built on the worker threads and
+// written on the writer thread. The relations come from the manager or,
+// if set, from the spill file. Returns the time used in seconds.
+template <typename TWriter, typename TLocationHandler, typename TManager, typename TSpilled, typename TAssembly>
+double write_water(const osmium::io::File& input_file, const ReadProfile& profile, TLocationHandler& location_handler, TManager* mp_manager, TSpilled* spilled,
+                   TAssembly& area_assembly, const Region* region, TWriter& writer, int num_threads, ProgressReporter* progress, RunStats* stats) {
+    std::cerr << "Pass 2...\n";
+    ProgressCounter* water_counter = nullptr;
+    if (progress) {
+        water_counter = &progress->add_layer("water");
+        progress->start("Pass 2", file_size(input_file));
+    }
 
-public:
+    const auto start = std::chrono::steady_clock::now();
+    osmium::io::Reader reader{input_file, profile.entities, profile.meta};
+    ProgressHandler progress_handler{progress, &reader};
+    // The relations were counted in pass 1.
+    StatsHandler stats_handler{stats};
+    stats_handler.ignore_relations();
+
+    // The areas are counted on the writer thread, so the area threads
+    // and workers don't share a counter.
+    StageTime write_time;
+    std::uint64_t areas = 0;
+    std::uint64_t geometry_errors = 0;
+    const bool ogr_geometry = TWriter::ogr_geometry;
+    GeometryPipeline<water_features> pipeline{num_threads, [region, ogr_geometry](const osmium::memory::Buffer& area_buffer) {
+        return build_water_features(area_buffer, region, ogr_geometry);
+    }, [&writer, progress, water_counter, stats, &write_time, &areas, &geometry_errors](water_features& result) {
+        {
+            StageTime::scope timer{stats ? &write_time : nullptr};
+            writer.write(result);
+        }
+        areas += result.areas;
+        geometry_errors += result.geometry_errors;
+        if (progress) {
+            progress->add_objects(ProgressReporter::area, result.areas);
+            water_counter->add(result.features.size());
+        }
+    }};
+    std::cerr << "Building geometries with " << pipeline.num_threads() << " threads\n";
+    if (area_assembly.num_threads() > 0) {
+        std::cerr << "Assembling areas with " << area_assembly.num_threads() << " threads\n";
+    }
 
-    MyOGRHandler(gdalcpp::Dataset& dataset, osmium::geom::OGRFactory<TProjection>& factory) :
-        m_layer_polygon(dataset, "water", wkbMultiPolygon),
-        m_factory(factory) {
-        m_layer_polygon.add_field("id", OFTReal, 10);
-        m_layer_polygon.add_field("type", OFTString, 32);
-        m_layer_polygon.add_field("name", OFTString, 32);
+    area_assembly.set_callback([&pipeline](osmium::memory::Buffer&& area_buffer) {
+        pipeline.submit(std::move(area_buffer));
+    });
+    if (spilled) {
+        osmium::apply(reader, progress_handler, stats_handler, location_handler, *spilled);
+        spilled->finish();
+    } else {
+        osmium::apply(reader, progress_handler, stats_handler, location_handler, mp_manager->handler());
     }
+    progress_handler.publish();
+    area_assembly.finish();
 
-    void area(const osmium::Area& area) {
-        const char* natural = area.tags()["natural"];
-        if (natural && 0 == std::strcmp(natural, "water")) {
-            try {
-                gdalcpp::Feature feature{m_layer_polygon, m_factory.create_multipolygon(area)};
-                feature.set_field("id", static_cast<double>(area.id()));
-                feature.set_field("type", natural);
-                feature.set_field("name", area.tags().get_value_by_key("name"));
-                feature.add_to_layer();
-            } catch (const osmium::geometry_error&) {
-                std::cerr << "Ignoring illegal geometry for area "
-                          << area.id()
-                          << " created from "
-                          << (area.from_way() ? "way" : "relation")
-                          << " with id="
-                          << area.orig_id() << ".\n";
-            }
-        }
+    reader.close();
+    pipeline.finish();
+    if (progress) {
+        progress->stop();
+    }
+    std::cerr << "Pass 2 done\n";
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // The stage of the last ways also covers the areas and features
+    // still in the queues after reading.
+    stats_handler.finish();
+    if (stats) {
+        stats->add_stage("area_assembly", area_assembly.time());
+        stats->add_stage("ogr_writes", write_time);
+        stats->add_objects("areas", areas);
+        stats->add_features("water", writer.features());
+        stats->add_errors("geometry", geometry_errors);
+        add_area_errors(*stats, area_assembly.stats());
     }
 
-};
+    print_feature_rate(writer.features(), elapsed.count());
+    return elapsed.count();
+}
 
 /* ================================================== */
 
@@ -80,23 +140,88 @@ void print_help() {
               << "\nOptions:\n" \
               << "  -h, --help           This help message\n" \
               << "  -d, --debug          Enable debug output\n" \
-              << "  -f, --format=FORMAT  Output OGR format (Default: 'SQLite')\n";
+              << "  -f, --format=FORMAT  Output OGR format (Default: 'SQLite')\n" \
+              << "  -t, --tx-batch=N     Write N features per transaction (Default: 0,\n" \
+              << "                       no explicit transactions, every feature is\n" \
+              << "                       committed on its own; use 1000 or more for\n" \
+              << "                       SQLite and GPKG)\n" \
+              << "  -I, --defer-index    Create spatial index after all features are\n" \
+              << "                       written (SQLite and GPKG only)\n" \
+              << "  -w, --writer=WRITER  Write features with 'ogr' (default) or 'fgb'\n" \
+              << "                       (FlatGeobuf file, ignores --format)\n" \
+              << "  -j, --threads=N      Number of threads building geometries (Default: 0,\n" \
+              << "                       number of cores)\n" \
+              << "  -a, --area-threads=N Assemble multipolygons on N threads (0 for\n" \
+              << "                       number of cores, Default: on the main thread)\n" \
+              << "  -s, --spill-relations\n" \
+              << "                       Keep multipolygon relations in a temporary\n" \
+              << "                       file next to OUTFILE instead of in memory\n" \
+              << "                       (INFILE must be sorted)\n" \
+              << "  -p, --prefilter      Only store locations of nodes needed by water\n" \
+              << "                       areas (reads relations and ways of INFILE again)\n" \
+              << "  -l, --location_store=TYPE\n" \
+              << "                       Set location store (Default: 'auto', chosen\n" \
+              << "                       from input size and available memory)\n" \
+              << "  -x, --bbox=BOX       Only export areas overlapping BOX (LON1,LAT1,\n" \
+              << "                       LON2,LAT2)\n" \
+              << "  -g, --polygon=FILE   Only export areas overlapping the polygon in\n" \
+              << "                       FILE (Osmosis .poly format)\n" \
+              << "  -e, --read=PROFILE   Object types to read in pass 2 and ',meta' to\n" \
+              << "                       decode metadata (Default: 'auto', nodes and\n" \
+              << "                       ways without metadata)\n" \
+              << "  -T, --time-read      Only read INFILE and report the decode time\n" \
+              << "  -v, --progress       Report bytes read, objects per second, features\n" \
+              << "                       written and ETA every 10 seconds\n" \
+              << "  -J, --stats=FILE     Write times per stage, memory use, object and\n" \
+              << "                       feature counts and errors to JSON FILE\n" \
+              << "  -L                   See available location stores\n";
 }
 
 int main(int argc, char* argv[]) {
     try {
+        const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
         static struct option long_options[] = {
             {"help",   no_argument, nullptr, 'h'},
             {"debug",  no_argument, nullptr, 'd'},
             {"format", required_argument, nullptr, 'f'},
+            {"tx-batch", required_argument, nullptr, 't'},
+            {"defer-index", no_argument, nullptr, 'I'},
+            {"writer", required_argument, nullptr, 'w'},
+            {"threads", required_argument, nullptr, 'j'},
+            {"area-threads", required_argument, nullptr, 'a'},
+            {"spill-relations", no_argument, nullptr, 's'},
+            {"prefilter", no_argument, nullptr, 'p'},
+            {"location_store", required_argument, nullptr, 'l'},
+            {"bbox", required_argument, nullptr, 'x'},
+            {"polygon", required_argument, nullptr, 'g'},
+            {"read", required_argument, nullptr, 'e'},
+            {"time-read", no_argument, nullptr, 'T'},
+            {"progress", no_argument, nullptr, 'v'},
+            {"stats", required_argument, nullptr, 'J'},
+            {"list_location_stores", no_argument, nullptr, 'L'},
             {nullptr, 0, nullptr, 0}
         };
 
         std::string output_format{"SQLite"};
         bool debug = false;
+        bool prefilter = false;
+        bool spill_relations = false;
+        std::string location_store{"auto"};
+        std::uint64_t tx_batch = 0;
+        bool defer_index = false;
+        int num_threads = 0;
+        int area_threads = -1;
+        std::string writer{"ogr"};
+        std::string bbox;
+        std::string polygon_file;
+        std::string read_profile{"auto"};
+        bool only_time_read = false;
+        bool show_progress = false;
+        std::string stats_file;
 
         while (true) {
-            const int c = getopt_long(argc, argv, "hdf:", long_options, nullptr);
+            const int c = getopt_long(argc, argv, "hdf:t:Iw:j:a:spl:x:g:e:TvJ:L", long_options, nullptr);
             if (c == -1) {
                 break;
             }
@@ -111,6 +236,62 @@ int main(int argc, char* argv[]) {
                 case 'f':
                     output_format = optarg;
                     break;
+                case 't':
+                    tx_batch = std::strtoull(optarg, nullptr, 10);
+                    break;
+                case 'I':
+                    defer_index = true;
+                    break;
+                case 'w':
+                    writer = optarg;
+                    if (writer != "ogr" && writer != "fgb") {
+                        std::cerr << "Unknown writer '" << writer << "'. Use 'ogr' or 'fgb'.\n";
+                        return 1;
+                    }
+                    break;
+                case 'j':
+                    if (!parse_thread_count(optarg, "--threads", 0, num_threads)) {
+                        return 1;
+                    }
+                    break;
+                case 'a':
+                    if (!parse_thread_count(optarg, "--area-threads", 0, area_threads)) {
+                        return 1;
+                    }
+                    break;
+                case 's':
+                    spill_relations = true;
+                    break;
+                case 'p':
+                    prefilter = true;
+                    break;
+                case 'l':
+                    location_store = optarg;
+                    break;
+                case 'x':
+                    bbox = optarg;
+                    break;
+                case 'g':
+                    polygon_file = optarg;
+                    break;
+                case 'e':
+                    read_profile = optarg;
+                    break;
+                case 'T':
+                    only_time_read = true;
+                    break;
+                case 'v':
+                    show_progress = true;
+                    break;
+                case 'J':
+                    stats_file = optarg;
+                    break;
+                case 'L':
+                    std::cout << "Available map types:\n";
+                    for (const auto& map_type : map_factory.map_types()) {
+                        std::cout << "  " << map_type << "\n";
+                    }
+                    return 0;
                 default:
                     return 1;
             }
@@ -135,52 +316,148 @@ int main(int argc, char* argv[]) {
 
         osmium::io::File input_file{input_filename};
 
-        osmium::area::Assembler::config_type assembler_config;
-        if (debug) {
-            assembler_config.debug_level = 1;
+        // The relations are read in pass 1, the second pass only needs the
+        // nodes and ways.
+        const ReadProfile profile = parse_read_profile(read_profile, {
+            osmium::osm_entity_bits::node | osmium::osm_entity_bits::way,
+            osmium::io::read_meta::no
+        });
+        if (only_time_read) {
+            time_read(input_file, profile);
+            return 0;
         }
-        osmium::area::MultipolygonManager<osmium::area::Assembler> mp_manager{assembler_config};
 
-        std::cerr << "Pass 1...\n";
-        osmium::relations::read_relations(input_file, mp_manager);
-        std::cerr << "Pass 1 done\n";
+        const std::unique_ptr<Region> region = Region::from_options(bbox, polygon_file);
 
-        index_type index;
-        location_handler_type location_handler{index};
-        location_handler.ignore_errors();
+        std::unique_ptr<ProgressReporter> progress;
+        if (show_progress) {
+            progress.reset(new ProgressReporter{});
+        }
 
-        // Choose one of the following:
+        std::unique_ptr<RunStats> stats;
+        if (!stats_file.empty()) {
+            stats.reset(new RunStats{"osmium_toogr2"});
+            stats->set_input(input_file);
+        }
+        StatsHandler relation_stats_handler{stats.get()};
 
-        // 1. Use WGS84, do not project coordinates.
-        osmium::geom::OGRFactory<> factory {};
+        using assembler_type = ParallelAssembler<osmium::area::Assembler>;
+        assembler_type::config_type assembler_config;
+        if (debug) {
+            assembler_config.debug_level = 1;
+        }
+        ParallelAreaAssembly<osmium::area::Assembler> area_assembly{area_threads, assembler_config};
+        assembler_config.assembly = &area_assembly;
 
-        // 2. Project coordinates into "Web Mercator".
-        //osmium::geom::OGRFactory<osmium::geom::MercatorProjection> factory;
+        // With --spill-relations the relations only live in memory while
+        // their member ways are read.
+        std::unique_ptr<osmium::area::MultipolygonManager<assembler_type>> mp_manager;
+        std::unique_ptr<SpilledMultipolygons<osmium::area::Assembler>> spilled;
 
-        // 3. Use any projection that the proj library can handle.
-        //    (Initialize projection with EPSG code or proj string).
-        //    In addition you need to link with "-lproj" and add
-        //    #include <osmium/geom/projection.hpp>.
-        //osmium::geom::OGRFactory<osmium::geom::Projection> factory {osmium::geom::Projection(3857)};
+        std::cerr << "Pass 1...\n";
+        if (spill_relations) {
+            spilled.reset(new SpilledMultipolygons<osmium::area::Assembler>{output_filename + ".relations", assembler_config});
+            spilled->read_relations(input_file, progress.get(), relation_stats_handler);
+            std::cerr << "Spilled " << spilled->num_relations() << " relations ("
+                      << (spilled->spill_bytes() / (1024 * 1024)) << " MBytes)\n";
+        } else {
+            mp_manager.reset(new osmium::area::MultipolygonManager<assembler_type>{assembler_config});
+            read_relations_with_progress(input_file, *mp_manager, progress.get(), relation_stats_handler);
+        }
+        relation_stats_handler.finish();
+        std::cerr << "Pass 1 done\n";
 
-        CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
-        gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{factory.proj_string()}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
-        MyOGRHandler<decltype(factory)::projection_type> ogr_handler{dataset, factory};
+        // Only the locations of nodes used by water areas are needed. These
+        // are the nodes of closed water ways and of all member ways of
+        // water multipolygon relations.
+        id_set_type node_ids;
+        if (prefilter) {
+            std::cerr << "Prefilter...\n";
+            if (stats) {
+                stats->begin_stage("prefilter");
+            }
+            id_set_type member_way_ids;
+            collect_member_ways(input_file, member_way_ids, [](const osmium::Relation& relation) {
+                const char* type = relation.tags()["type"];
+                return type && (0 == std::strcmp(type, "multipolygon") || 0 == std::strcmp(type, "boundary")) &&
+                       is_water(relation.tags());
+            });
+            collect_way_nodes(input_file, node_ids, [&member_way_ids](const osmium::Way& way) {
+                return member_way_ids.get(way.positive_id()) ||
+                       (way.ends_have_same_id() && is_water(way.tags()));
+            });
+            std::cerr << "Prefilter done: " << node_ids.size() << " nodes needed\n";
+            if (stats) {
+                stats->end_stage();
+            }
+        }
+
+        // If the index doesn't fit into memory, it goes into a file next
+        // to the output which is removed at the end.
+        const std::string location_file = output_filename + ".locations";
+        FileRemover location_remover;
+        if (location_store == "auto") {
+            location_store = auto_location_store(input_file, location_file);
+            if (location_store != "flex_mem") {
+                location_remover.set(location_file);
+            }
+        }
 
-        std::cerr << "Pass 2...\n";
-        osmium::io::Reader reader{input_file};
+        std::unique_ptr<index_type> index = map_factory.create_map(location_store);
+        location_handler_type location_handler{*index};
+        location_handler.ignore_errors();
+        PrefilteredLocations<location_handler_type> filtered_location_handler{location_handler, prefilter ? &node_ids : nullptr};
 
-        osmium::apply(reader, location_handler, ogr_handler, mp_manager.handler([&ogr_handler](const osmium::memory::Buffer& area_buffer) {
-            osmium::apply(area_buffer, ogr_handler);
-        }));
+        if (writer == "fgb") {
+            FlatGeobufWaterWriter fgb_writer{output_filename, factory_type{}.epsg()};
+            const double elapsed = write_water(input_file, profile, filtered_location_handler, mp_manager.get(), spilled.get(), area_assembly, region.get(), fgb_writer, num_threads, progress.get(), stats.get());
+            print_phase_time("Writing features", elapsed);
 
-        reader.close();
-        std::cerr << "Pass 2 done\n";
+            if (stats) {
+                stats->begin_stage("spatial_index");
+            }
+            const auto index_start = std::chrono::steady_clock::now();
+            fgb_writer.close();
+            const std::chrono::duration<double> index_elapsed = std::chrono::steady_clock::now() - index_start;
+            print_phase_time("Creating spatial index and final file", index_elapsed.count());
+        } else {
+            CPLSetConfigOption("OGR_SQLITE_SYNCHRONOUS", "OFF");
+            gdalcpp::Dataset dataset{output_format, output_filename, gdalcpp::SRS{factory_type{}.proj_string()}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }};
+            setup_transactions(dataset, tx_batch);
+            defer_index = setup_deferred_index(dataset, defer_index);
+            WaterLayerWriter ogr_writer{dataset, defer_index};
+
+            const double elapsed = write_water(input_file, profile, filtered_location_handler, mp_manager.get(), spilled.get(), area_assembly, region.get(), ogr_writer, num_threads, progress.get(), stats.get());
+            if (stats) {
+                stats->begin_stage("ogr_commit");
+            }
+            finish_transactions(dataset);
+            print_phase_time("Writing features", elapsed);
+
+            if (defer_index) {
+                if (stats) {
+                    stats->begin_stage("spatial_index");
+                }
+                const auto index_start = std::chrono::steady_clock::now();
+                ogr_writer.create_spatial_indexes(dataset);
+                const std::chrono::duration<double> index_elapsed = std::chrono::steady_clock::now() - index_start;
+                print_phase_time("Creating spatial indexes", index_elapsed.count());
+            }
+        }
+        if (stats) {
+            stats->end_stage();
+            stats->set_location_index(location_store, index->size(), index->used_memory());
+        }
 
         std::vector<osmium::object_id_type> incomplete_relations_ids;
-        mp_manager.for_each_incomplete_relation([&](const osmium::relations::RelationHandle& handle){
-            incomplete_relations_ids.push_back(handle->id());
-        });
+        if (spilled) {
+            incomplete_relations_ids = spilled->incomplete_relations();
+            std::cerr << "At most " << spilled->peak_relations_in_memory() << " relations in memory\n";
+        } else {
+            mp_manager->for_each_incomplete_relation([&](const osmium::relations::RelationHandle& handle){
+                incomplete_relations_ids.push_back(handle->id());
+            });
+        }
         if (!incomplete_relations_ids.empty()) {
             std::cerr << "Warning! Some member ways missing for these multipolygon relations:";
             for (const auto id : incomplete_relations_ids) {
@@ -188,11 +465,21 @@ int main(int argc, char* argv[]) {
             }
             std::cerr << "\n";
         }
+        if (stats) {
+            stats->add_errors("incomplete_relations", incomplete_relations_ids.size());
+        }
 
         osmium::MemoryUsage memory;
         if (memory.peak()) {
             std::cerr << "Memory used: " << memory.peak() << " MBytes\n";
         }
+
+        index.reset();
+        location_remover.remove();
+
+        if (stats) {
+            stats->write(stats_file);
+        }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << '\n';
         return 1;
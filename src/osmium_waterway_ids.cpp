@@ -6,20 +6,28 @@
 
 */
 
+#include <cstdint>
+#include <cstdio>   // for std::remove
 #include <cstdlib>  // for std::exit
 #include <cstring>  // for std::strncmp
+#include <chrono>
+#include <getopt.h>
 #include <iostream> // for std::cout, std::cerr
 #include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-// For the location index. There are different types of indexes available.
-// This will work for all input files keeping the index in memory.
-#include <osmium/index/map/flex_mem.hpp>
+// For the location index. There are different types of indexes available,
+// they are chosen at run time with the MapFactory.
+#include <osmium/index/map/all.hpp>
 
 // For the NodeLocationForWays handler
 #include <osmium/handler/node_locations_for_ways.hpp>
 
-// The type of index used. This must match the include file above
-using index_type = osmium::index::map::FlexMem<osmium::unsigned_object_id_type, osmium::Location>;
+// The base class of all indexes
+using index_type = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
 
 // The location handler always depends on the index type
 using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
@@ -36,164 +44,288 @@ using location_handler_type = osmium::handler::NodeLocationsForWays<index_type>;
 
 // For reading and parsing of tags filter
 #include <osmium/index/nwr_array.hpp>
+#include "location_store.hpp"
+#include "parallel_areas.hpp"
+#include "progress.hpp"
+#include "read_profile.hpp"
+#include "region.hpp"
+#include "riversystems.hpp"
+#include "run_stats.hpp"
+#include "spilled_multipolygons.hpp"
+#include "temp_file.hpp"
+#include "thread_count.hpp"
 #include "util.hpp"
+#include "waterway_format.hpp"
+#include "waterway_ids_handler.hpp"
 
-class WaterHandler : public osmium::handler::Handler {
+// Convert a binary waterway file back to CSV on stdout.
+void dump_binary(const std::string& filename) {
+    waterway_format::Reader reader{filename};
 
-    static void output_waterway(const osmium::Way& way, const char* tag_key, std::ofstream & out) {
-        const osmium::TagList& tags = way.tags();
-        const char* tag_value = tags.get_value_by_key(tag_key);
-        if (nullptr != tag_value) {
-            // Print id of the waterway and the tagname of the pub if it is set.
-            out << way.id() << "," << tag_value;
+    WaterwayWriter writer;
+    writer.open("-", false);
 
-            // Print ids of nodes of the ways
-            for (const osmium::NodeRef& nr : way.nodes()) {
-              out << "," << nr.ref();
-            }
-
-            out << std::endl;
-        }
-    }
-
-    static void output_area(const osmium::Area& area, const char* tag_key, std::ofstream & out) {
-        const osmium::TagList& tags = area.tags();
-        const char* tag_value = tags.get_value_by_key(tag_key);
-        if (nullptr != tag_value) {
-            // Print id of the waterway and the tagname of the pub if it is set.
-            out << area.orig_id() << "," << tag_value;
-
-            // Because we set
-            // create_empty_areas = false in the assembler config, we can
-            // be sure there will always be at least one outer ring.
-
-            // Print ids of nodes of the outer rings
-            for (auto& ring : area.outer_rings()) {
-                for (const osmium::NodeRef& nr : ring) {
-                  out << "," << nr.ref();
-                }
-            }
-
-            out << std::endl;
+    waterway_format::Record record;
+    while (reader.next(record)) {
+        writer.begin_record(record.id, reader.value(record).c_str());
+        for (const auto ref : record.nodes) {
+            writer.add_node(ref);
         }
+        writer.end_record();
     }
 
-public:
-
-    WaterHandler(const char* wayfile, const char* areafile)
-        : m_filter(false)
-    {
-      waystream.open(wayfile);
-      areastream.open(areafile);
-    }
-
-    ~WaterHandler() {
-      waystream.close();
-      areastream.close();
-    }
-
-    void way(const osmium::Way& way) {
-        const osmium::TagList& tags = way.tags();
-        if (osmium::tags::match_any_of(tags, m_filter)) {
-            if (tags.has_key("waterway")) {
-              output_waterway(way, "waterway", waystream);
-            } else if (tags.has_key("natural")) {
-              output_waterway(way, "natural", areastream);
-            } else if (tags.has_key("landuse")) {
-              output_waterway(way, "landuse", areastream);
-            }
-        }
-    }
-
-    void area(const osmium::Area& area) {
-        const osmium::TagList& tags = area.tags();
-        if (osmium::tags::match_any_of(tags, m_filter)) {
-            if (tags.has_key("natural")) {
-              output_area(area, "natural", areastream);
-            } else if (tags.has_key("landuse")) {
-              output_area(area, "landuse", areastream);
-            }
-        }
-    }
-
-    void parse_and_add_expression(const std::string& expression) {
-        const auto p = get_filter_expression(expression);
-        std::cout << "adding filter rule " << p.second << std::endl;
-        m_filter.add_rule(true, get_tag_matcher(p.second));
-    }
+    writer.close();
+}
 
-    void read_expressions_file(const std::string& file_name) {
-        // Reading filter expressions file
+void print_help() {
+    std::cout << "osmium_waterway_ids [OPTIONS] osmfile.pbf tags-filter.txt wways.csv wtr.csv\n" \
+              << "osmium_waterway_ids --dump=FILE\n\n" \
+              << "Write ids of waterways and their nodes into wways.csv and ids of\n" \
+              << "water areas and their nodes into wtr.csv.\n" \
+              << "\nOptions:\n" \
+              << "  -h, --help               This help message\n" \
+              << "  -b, --binary             Write compact binary files instead of CSV\n" \
+              << "  -D, --dump=FILE          Convert binary FILE to CSV on stdout\n" \
+              << "  -r, --riversystems=FILE  Compute river systems and write them\n" \
+              << "                           as id,rsystem csv file\n" \
+              << "  -j, --threads=N          Number of threads for the river system\n" \
+              << "                           computation (Default: 1)\n" \
+              << "  -a, --area-threads=N     Assemble multipolygons on N threads (0 for\n" \
+              << "                           number of cores, Default: on the main thread)\n" \
+              << "  -s, --spill-relations    Keep multipolygon relations in a temporary\n" \
+              << "                           file next to wways.csv instead of in\n" \
+              << "                           memory (osmfile.pbf must be sorted)\n" \
+              << "  -x, --bbox=BOX           Only write waterways and water areas in or\n" \
+              << "                           crossing BOX (LON1,LAT1,LON2,LAT2)\n" \
+              << "  -g, --polygon=FILE       Only write waterways and water areas in or\n" \
+              << "                           crossing the polygon in FILE (Osmosis .poly\n" \
+              << "                           format)\n" \
+              << "  -e, --read=PROFILE       Object types to read in pass 2 and ',meta'\n" \
+              << "                           to decode metadata (Default: 'auto', nodes\n" \
+              << "                           and ways without metadata)\n" \
+              << "  -T, --time-read          Only read osmfile.pbf and report the decode\n" \
+              << "                           time\n" \
+              << "  -v, --progress           Report bytes read, objects per second,\n" \
+              << "                           records written and ETA every 10 seconds\n" \
+              << "  -J, --stats=FILE         Write times per stage, memory use, object\n" \
+              << "                           and record counts and errors to JSON FILE\n" \
+              << "  -l, --location_store=TYPE\n" \
+              << "                           Set location store (Default: 'auto', chosen\n" \
+              << "                           from input size and available memory)\n" \
+              << "  -L                       See available location stores\n";
+}
 
-        std::ifstream file{file_name};
-        if (!file.is_open()) {
-            throw std::runtime_error{"Could not open file '" + file_name + "'"};
+int main(int argc, char* argv[]) {
+    const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+
+    static struct option long_options[] = {
+        {"help",   no_argument,       nullptr, 'h'},
+        {"binary", no_argument,       nullptr, 'b'},
+        {"dump",   required_argument, nullptr, 'D'},
+        {"riversystems", required_argument, nullptr, 'r'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"area-threads", required_argument, nullptr, 'a'},
+        {"spill-relations", no_argument, nullptr, 's'},
+        {"bbox", required_argument, nullptr, 'x'},
+        {"polygon", required_argument, nullptr, 'g'},
+        {"read", required_argument, nullptr, 'e'},
+        {"time-read", no_argument, nullptr, 'T'},
+        {"progress", no_argument, nullptr, 'v'},
+        {"stats", required_argument, nullptr, 'J'},
+        {"location_store", required_argument, nullptr, 'l'},
+        {"list_location_stores", no_argument, nullptr, 'L'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    bool binary = false;
+    std::string dump_file;
+    std::string rsystems_file;
+    int num_threads = 1;
+    int area_threads = -1;
+    bool spill_relations = false;
+    std::string bbox;
+    std::string polygon_file;
+    std::string read_profile{"auto"};
+    bool only_time_read = false;
+    bool show_progress = false;
+    std::string stats_file;
+    std::string location_store{"auto"};
+
+    while (true) {
+        const int c = getopt_long(argc, argv, "hbD:r:j:a:sx:g:e:TvJ:l:L", long_options, nullptr);
+        if (c == -1) {
+            break;
         }
 
-        for (std::string line; std::getline(file, line);) {
-            const auto pos = line.find_first_of('#');
-            if (pos != std::string::npos) {
-                line.erase(pos);
-            }
-            if (!line.empty()) {
-                if (line.back() == '\r') {
-                    line.resize(line.size() - 1);
+        switch (c) {
+            case 'h':
+                print_help();
+                return 0;
+            case 'b':
+                binary = true;
+                break;
+            case 'D':
+                dump_file = optarg;
+                break;
+            case 'r':
+                rsystems_file = optarg;
+                break;
+            case 'j':
+                if (!parse_thread_count(optarg, "--threads", 1, num_threads)) {
+                    return 1;
                 }
-                parse_and_add_expression(line);
-            }
+                break;
+            case 'a':
+                if (!parse_thread_count(optarg, "--area-threads", 0, area_threads)) {
+                    return 1;
+                }
+                break;
+            case 's':
+                spill_relations = true;
+                break;
+            case 'x':
+                bbox = optarg;
+                break;
+            case 'g':
+                polygon_file = optarg;
+                break;
+            case 'e':
+                read_profile = optarg;
+                break;
+            case 'T':
+                only_time_read = true;
+                break;
+            case 'v':
+                show_progress = true;
+                break;
+            case 'J':
+                stats_file = optarg;
+                break;
+            case 'l':
+                location_store = optarg;
+                break;
+            case 'L':
+                std::cout << "Available map types:\n";
+                for (const auto& map_type : map_factory.map_types()) {
+                    std::cout << "  " << map_type << "\n";
+                }
+                return 0;
+            default:
+                return 1;
         }
     }
 
-    const osmium::TagsFilter & getTagsFilter() {
-        return m_filter;
+    if (!dump_file.empty()) {
+        try {
+            dump_binary(dump_file);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            std::exit(1);
+        }
+        return 0;
     }
 
-private:
-    std::ofstream waystream;
-    std::ofstream areastream;
-    osmium::TagsFilter m_filter;
-
-}; // class WaterHandler
-
-int main(int argc, char* argv[]) {
-    if (argc != 5) {
-        std::cerr << "Usage: " << argv[0] << " osmfile.pbf tags-filter.txt wways.csv wtr.csv\n";
+    if (argc - optind != 4) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] osmfile.pbf tags-filter.txt wways.csv wtr.csv\n";
         std::exit(1);
     }
 
     try {
         // The input file
-        const osmium::io::File input_file{argv[1]};
+        const osmium::io::File input_file{argv[optind]};
+
+        // The relations are read in pass 1, the second pass only needs the
+        // nodes and ways.
+        const ReadProfile profile = parse_read_profile(read_profile, {
+            osmium::osm_entity_bits::node | osmium::osm_entity_bits::way,
+            osmium::io::read_meta::no
+        });
+        if (only_time_read) {
+            time_read(input_file, profile);
+            return 0;
+        }
+
+        const std::unique_ptr<Region> region = Region::from_options(bbox, polygon_file);
+
+        // Reports the progress of both passes every few seconds.
+        std::unique_ptr<ProgressReporter> progress;
+        if (show_progress) {
+            progress.reset(new ProgressReporter{});
+        }
+
+        // Counts the objects and times the stages for --stats.
+        std::unique_ptr<RunStats> stats;
+        if (!stats_file.empty()) {
+            stats.reset(new RunStats{"osmium_waterway_ids"});
+            stats->set_input(input_file);
+        }
+        StatsHandler stats_handler{stats.get()};
 
         // Create our waterway handler.
-        WaterHandler data_handler(argv[3]/*wayfile*/, argv[4]/*areafile*/);
-        data_handler.read_expressions_file(argv[2]/*tags-filter-file*/);
+        WaterHandler data_handler(argv[optind+2]/*wayfile*/, argv[optind+3]/*areafile*/, binary);
+        data_handler.read_expressions_file(argv[optind+1]/*tags-filter-file*/);
+
+        RiversystemBuilder rsystems{static_cast<unsigned int>(num_threads)};
+        if (!rsystems_file.empty()) {
+            data_handler.set_riversystem_builder(&rsystems);
+        }
 
         // Configuration for the multipolygon assembler. We disable the option to
         // create empty areas when invalid multipolygons are encountered. This
         // means areas created have a valid geometry and invalid multipolygons
         // are simply ignored.
-        osmium::area::Assembler::config_type assembler_config;
+        using assembler_type = ParallelAssembler<osmium::area::Assembler>;
+        assembler_type::config_type assembler_config;
         assembler_config.create_empty_areas = false;
 
+        // The areas are assembled in batches, on a thread pool if
+        // --area-threads is given.
+        ParallelAreaAssembly<osmium::area::Assembler> area_assembly{area_threads, assembler_config};
+        assembler_config.assembly = &area_assembly;
+
         // Initialize the MultipolygonManager. Its job is to collect all
-        // relations and member ways needed for each area. It then calls an
-        // instance of the osmium::area::Assembler class (with the given config)
-        // to actually assemble one area.
-        osmium::area::MultipolygonManager<osmium::area::Assembler> mp_manager{assembler_config, data_handler.getTagsFilter()};
+        // relations and member ways needed for each area. It then hands
+        // them over to the area assembly (through the assembler type given)
+        // to actually assemble the areas. With --spill-relations the
+        // relations go into a temporary file instead and are only kept in
+        // memory while their member ways are read.
+        std::unique_ptr<osmium::area::MultipolygonManager<assembler_type>> mp_manager;
+        std::unique_ptr<SpilledMultipolygons<osmium::area::Assembler>> spilled;
 
         // We read the input file twice. In the first pass, only relations are
         // read and fed into the multipolygon manager.
         std::cerr << "Pass 1...\n";
-        osmium::relations::read_relations(input_file, mp_manager);
+        if (spill_relations) {
+            spilled.reset(new SpilledMultipolygons<osmium::area::Assembler>{temp_file_name(argv[optind+2], "osmium_waterway_ids", ".relations"),
+                                                                           assembler_config, data_handler.getTagsFilter()});
+            spilled->read_relations(input_file, progress.get(), stats_handler);
+            std::cerr << "Spilled " << spilled->num_relations() << " relations ("
+                      << (spilled->spill_bytes() / (1024 * 1024)) << " MBytes)\n";
+        } else {
+            mp_manager.reset(new osmium::area::MultipolygonManager<assembler_type>{assembler_config, data_handler.getTagsFilter()});
+            read_relations_with_progress(input_file, *mp_manager, progress.get(), stats_handler);
+        }
+        stats_handler.finish();
+        stats_handler.ignore_relations();
         std::cerr << "Pass 1 done\n";
 
-        // The index storing all node locations.
-        index_type index;
+        // The index storing all node locations. If it doesn't fit into
+        // memory, it goes into a file next to the waterway file which is
+        // removed at the end. If the waterways go to stdout, the file is
+        // named after the process in the current directory.
+        const std::string location_file = temp_file_name(argv[optind+2], "osmium_waterway_ids", ".locations");
+        FileRemover location_remover;
+        if (location_store == "auto") {
+            location_store = auto_location_store(input_file, location_file);
+            if (location_store != "flex_mem") {
+                location_remover.set(location_file);
+            }
+        }
+        std::unique_ptr<index_type> index = map_factory.create_map(location_store);
 
         // The handler that stores all node locations in the index and adds them
         // to the ways.
-        location_handler_type location_handler{index};
+        location_handler_type location_handler{*index};
 
         // If a location is not available in the index, we ignore it. It might
         // not be needed (if it is not part of a multipolygon relation), so why
@@ -201,22 +333,99 @@ int main(int argc, char* argv[]) {
         location_handler.ignore_errors();
 
         // On the second pass we read all objects and run them first through the
-        // node location handler and then the multipolygon manager. The manager
-        // will put the areas it has created into the "buffer" which are then
-        // fed through our handler.
+        // node location handler and then the multipolygon manager. The areas
+        // assembled are fed through our handler in the order the manager
+        // completed them.
         //
-        // The read_meta::no option disables reading of meta data (such as version
-        // numbers, timestamps, etc.) which are not needed in this case. Disabling
-        // this can speed up your program.
+        // The read profile disables reading of meta data (such as version
+        // numbers, timestamps, etc.) and of relations, which are not needed
+        // in this case. Disabling this can speed up your program.
         std::cerr << "Pass 2...\n";
-        osmium::io::Reader reader{input_file, osmium::io::read_meta::no};
+        if (progress) {
+            data_handler.add_progress_counters(*progress);
+            progress->start("Pass 2", file_size(input_file));
+        }
+        const auto start = std::chrono::steady_clock::now();
+        osmium::io::Reader reader{input_file, profile.entities, profile.meta};
+        ProgressHandler progress_handler{progress.get(), &reader};
 
-        osmium::apply(reader, location_handler, data_handler, mp_manager.handler([&data_handler](const osmium::memory::Buffer& area_buffer) {
-            osmium::apply(area_buffer, data_handler);
-        }));
+        if (area_assembly.num_threads() > 0) {
+            std::cerr << "Assembling areas with " << area_assembly.num_threads() << " threads\n";
+        }
+
+        // The output has node ids, not geometries, so ways crossing the
+        // boundary of the region are written whole.
+        RegionFilter<WaterHandler> region_filter{region.get(), data_handler, false};
+        area_assembly.set_callback([&region_filter, &progress_handler, &stats_handler](osmium::memory::Buffer&& area_buffer) {
+            osmium::apply(area_buffer, progress_handler, stats_handler, region_filter);
+        });
+
+        if (spilled) {
+            osmium::apply(reader, progress_handler, stats_handler, location_handler, region_filter, *spilled);
+            spilled->finish();
+        } else {
+            osmium::apply(reader, progress_handler, stats_handler, location_handler, region_filter, mp_manager->handler());
+        }
+        area_assembly.finish();
+        progress_handler.publish();
+        region_filter.print_stats();
 
         reader.close();
+        data_handler.close();
+        if (progress) {
+            progress->stop();
+        }
         std::cerr << "Pass 2 done\n";
+        if (spilled) {
+            std::cerr << "At most " << spilled->peak_relations_in_memory() << " relations in memory, "
+                      << spilled->incomplete_relations().size() << " relations incomplete\n";
+        }
+
+        stats_handler.finish();
+        if (stats) {
+            stats->add_stage("area_assembly", area_assembly.time());
+            stats->set_location_index(location_store, index->size(), index->used_memory());
+            stats->add_features("waterways", data_handler.way_records());
+            stats->add_features("water", data_handler.area_records());
+            add_area_errors(*stats, area_assembly.stats());
+            std::size_t incomplete_relations = 0;
+            if (spilled) {
+                incomplete_relations = spilled->incomplete_relations().size();
+            } else {
+                mp_manager->for_each_incomplete_relation([&incomplete_relations](const osmium::relations::RelationHandle& /*handle*/) {
+                    ++incomplete_relations;
+                });
+            }
+            stats->add_errors("incomplete_relations", incomplete_relations);
+        }
+
+        index.reset();
+        location_remover.remove();
+
+        // Report how fast the output was produced. Only the time spent in
+        // the writers counts, reading and assembling areas is not included.
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double write_seconds = data_handler.write_seconds();
+        const double mbytes = static_cast<double>(data_handler.bytes_written()) / (1024.0 * 1024.0);
+        std::cerr << "Wrote " << mbytes << " MBytes of " << (binary ? "binary output" : "CSV")
+                  << " in " << write_seconds << " s of writer time";
+        if (write_seconds > 0) {
+            std::cerr << " (" << (mbytes / write_seconds) << " MBytes/s)";
+        }
+        std::cerr << ", pass 2 took " << elapsed.count() << " s\n";
+
+        if (!rsystems_file.empty()) {
+            std::cerr << "Computing river systems of " << rsystems.num_ways() << " waterways...\n";
+            if (stats) {
+                stats->begin_stage("riversystems");
+            }
+            rsystems.write_csv(rsystems_file);
+            std::cerr << "Computing river systems done\n";
+        }
+
+        if (stats) {
+            stats->write(stats_file);
+        }
     } catch (const std::exception& e) {
         // All exceptions used by the Osmium library derive from std::exception.
         std::cerr << e.what() << '\n';
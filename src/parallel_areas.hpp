@@ -0,0 +1,310 @@
+#ifndef PARALLEL_AREAS_HPP
+#define PARALLEL_AREAS_HPP
+
+/*
+
+  Multipolygon assembly on several threads.
+
+  The MultipolygonManager collects the member ways of the relations and
+  calls the assembler on the thread running osmium::apply(), which makes
+  that thread the bottleneck for files with huge water relations. Used
+  with a ParallelAssembler, the manager only hands over the complete
+  relations with their member ways and the closed ways. They are copied
+  into work buffers, assembled by the real assembler on the threads of a
+  thread pool, and the area buffers are given to the callback in the
+  order the work came in, on the thread calling the manager. So the
+  areas are the same and in the same order as with the assembler run by
+  the manager, but they arrive later.
+
+  Usage:
+
+    using assembler_type = ParallelAssembler<osmium::area::Assembler>;
+    assembler_type::config_type config;
+    // ... set assembler options in config
+    ParallelAreaAssembly<osmium::area::Assembler> assembly{num_threads, config};
+    config.assembly = &assembly;
+    osmium::area::MultipolygonManager<assembler_type> mp_manager{config};
+    ...
+    assembly.set_callback([](osmium::memory::Buffer&& buffer) { ... });
+    osmium::apply(reader, location_handler, mp_manager.handler());
+    assembly.finish();
+
+*/
+
+#include <osmium/area/stats.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/pool.hpp>
+
+#include "stage_time.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template <typename TAssembler>
+class ParallelAreaAssembly {
+
+public:
+
+    using callback_type = std::function<void(osmium::memory::Buffer&&)>;
+    using assembler_config_type = typename TAssembler::config_type;
+
+private:
+
+    // Closed ways and relations followed by their member ways.
+    struct work_batch {
+        osmium::memory::Buffer buffer{initial_buffer_size, osmium::memory::Buffer::auto_grow::yes};
+
+        // The number of member ways of each relation in the buffer.
+        std::vector<std::size_t> member_counts;
+    };
+
+    struct result_type {
+        osmium::memory::Buffer buffer;
+        osmium::area::area_stats stats;
+        StageTime time;
+    };
+
+    // Work buffers are handed over when they reach this size.
+    static constexpr const std::size_t initial_buffer_size = 1024UL * 1024UL;
+
+    class assemble_task {
+
+        std::unique_ptr<work_batch> m_batch;
+        const assembler_config_type* m_config;
+
+    public:
+
+        assemble_task(std::unique_ptr<work_batch>&& batch, const assembler_config_type& config) :
+            m_batch(std::move(batch)),
+            m_config(&config) {
+        }
+
+        result_type operator()() {
+            return assemble(*m_batch, *m_config);
+        }
+
+    }; // class assemble_task
+
+    assembler_config_type m_config;
+
+    // Without pool the work is done by the thread adding it.
+    std::unique_ptr<osmium::thread::Pool> m_pool;
+
+    std::unique_ptr<work_batch> m_batch;
+    std::deque<std::future<result_type>> m_results;
+    std::size_t m_max_results;
+
+    callback_type m_callback;
+    osmium::area::area_stats m_stats;
+    StageTime m_time;
+
+    static result_type assemble(const work_batch& batch, const assembler_config_type& config) {
+        result_type result{osmium::memory::Buffer{initial_buffer_size, osmium::memory::Buffer::auto_grow::yes}, {}, {}};
+        // Timed on the thread doing the work.
+        {
+            StageTime::scope timer{&result.time};
+
+            auto it = batch.buffer.template begin<osmium::OSMObject>();
+            const auto end = batch.buffer.template end<osmium::OSMObject>();
+            auto member_count = batch.member_counts.begin();
+            std::vector<const osmium::Way*> ways;
+
+            while (it != end) {
+                TAssembler assembler{config};
+                try {
+                    if (it->type() == osmium::item_type::way) {
+                        const auto& way = static_cast<const osmium::Way&>(*it);
+                        ++it;
+                        assembler(way, result.buffer);
+                    } else {
+                        const auto& relation = static_cast<const osmium::Relation&>(*it);
+                        ++it;
+                        ways.clear();
+                        for (std::size_t i = 0; i < *member_count; ++i, ++it) {
+                            ways.push_back(&static_cast<const osmium::Way&>(*it));
+                        }
+                        ++member_count;
+                        assembler(relation, ways, result.buffer);
+                    }
+                } catch (const osmium::invalid_location&) {
+                    // ignore, as the MultipolygonManager does
+                }
+                result.stats += assembler.stats();
+            }
+        }
+
+        return result;
+    }
+
+    void deliver(result_type&& result) {
+        m_stats += result.stats;
+        m_time += result.time;
+        if (m_callback && result.buffer.committed() > 0) {
+            m_callback(std::move(result.buffer));
+        }
+    }
+
+    // Give the results at the front of the queue which are ready to the
+    // callback. Waits for results while more than max_waiting are queued.
+    void deliver_ready(std::size_t max_waiting) {
+        while (!m_results.empty()) {
+            auto& future = m_results.front();
+            if (m_results.size() <= max_waiting &&
+                future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return;
+            }
+            result_type result = future.get();
+            m_results.pop_front();
+            deliver(std::move(result));
+        }
+    }
+
+    void submit_batch() {
+        if (m_batch->buffer.committed() == 0) {
+            return;
+        }
+
+        std::unique_ptr<work_batch> batch{new work_batch{}};
+        std::swap(batch, m_batch);
+
+        if (!m_pool) {
+            deliver(assemble(*batch, m_config));
+            return;
+        }
+
+        m_results.push_back(m_pool->submit(assemble_task{std::move(batch), m_config}));
+        deliver_ready(m_max_results);
+    }
+
+    void possibly_submit_batch() {
+        if (m_batch->buffer.committed() >= initial_buffer_size) {
+            submit_batch();
+        }
+    }
+
+public:
+
+    /**
+     * Assemble areas on num_threads threads (0 for the osmium default).
+     * With num_threads < 0, the areas are assembled on the calling
+     * thread, in batches like on the pool.
+     */
+    explicit ParallelAreaAssembly(int num_threads, const assembler_config_type& config = assembler_config_type{}) :
+        m_config(config),
+        m_pool(num_threads < 0 ? nullptr : new osmium::thread::Pool{num_threads}),
+        m_batch(new work_batch{}),
+        m_max_results(m_pool ? static_cast<std::size_t>(std::max(m_pool->num_threads() * 2, 8)) : 0) {
+    }
+
+    ParallelAreaAssembly(const ParallelAreaAssembly&) = delete;
+    ParallelAreaAssembly& operator=(const ParallelAreaAssembly&) = delete;
+
+    int num_threads() const noexcept {
+        return m_pool ? m_pool->num_threads() : 0;
+    }
+
+    void set_callback(const callback_type& callback) {
+        m_callback = callback;
+    }
+
+    const osmium::area::area_stats& stats() const noexcept {
+        return m_stats;
+    }
+
+    // Time spent in the assembler, summed over all threads.
+    const StageTime& time() const noexcept {
+        return m_time;
+    }
+
+    void add_way(const osmium::Way& way) {
+        m_batch->buffer.add_item(way);
+        m_batch->buffer.commit();
+        possibly_submit_batch();
+    }
+
+    void add_relation(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members) {
+        m_batch->buffer.add_item(relation);
+        for (const osmium::Way* way : members) {
+            m_batch->buffer.add_item(*way);
+        }
+        m_batch->buffer.commit();
+        m_batch->member_counts.push_back(members.size());
+        possibly_submit_batch();
+    }
+
+    /**
+     * Assemble the rest of the work and give all areas to the callback.
+     * Rethrows exceptions from the assembler threads.
+     */
+    void finish() {
+        submit_batch();
+        deliver_ready(0);
+    }
+
+}; // class ParallelAreaAssembly
+
+/**
+ * Stand-in for the assembler used as template parameter of the
+ * MultipolygonManager. Instead of assembling the areas, it hands the
+ * objects over to the ParallelAreaAssembly in its config.
+ */
+template <typename TAssembler>
+class ParallelAssembler {
+
+    ParallelAreaAssembly<TAssembler>* m_assembly;
+    bool m_way_areas;
+
+    // The stats are collected by the ParallelAreaAssembly.
+    osmium::area::area_stats m_stats;
+
+public:
+
+    struct config_type : public TAssembler::config_type {
+
+        ParallelAreaAssembly<TAssembler>* assembly;
+
+        // Set to false to ignore closed ways, so only relations become
+        // areas.
+        bool way_areas = true;
+
+        explicit config_type(ParallelAreaAssembly<TAssembler>* parallel_assembly = nullptr) :
+            assembly(parallel_assembly) {
+        }
+
+    }; // struct config_type
+
+    explicit ParallelAssembler(const config_type& config) :
+        m_assembly(config.assembly),
+        m_way_areas(config.way_areas) {
+    }
+
+    bool operator()(const osmium::Way& way, osmium::memory::Buffer& /*out_buffer*/) {
+        if (!m_way_areas) {
+            return false;
+        }
+        m_assembly->add_way(way);
+        return true;
+    }
+
+    bool operator()(const osmium::Relation& relation, const std::vector<const osmium::Way*>& members, osmium::memory::Buffer& /*out_buffer*/) {
+        m_assembly->add_relation(relation, members);
+        return true;
+    }
+
+    const osmium::area::area_stats& stats() const noexcept {
+        return m_stats;
+    }
+
+}; // class ParallelAssembler
+
+#endif // PARALLEL_AREAS_HPP
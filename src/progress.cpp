@@ -0,0 +1,132 @@
+/*
+
+  Progress reporting for long runs.
+
+*/
+
+#include "progress.hpp"
+
+#include "util.hpp"
+
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+    // Format seconds as "1h 02m", or "2m 03s" if less than an hour.
+    std::string format_duration(double seconds) {
+        const auto total = static_cast<std::uint64_t>(seconds);
+        const auto hours = total / 3600;
+        const auto minutes = (total / 60) % 60;
+        char buffer[32];
+        if (hours > 0) {
+            std::snprintf(buffer, sizeof(buffer), "%lluh %02llum", static_cast<unsigned long long>(hours), static_cast<unsigned long long>(minutes));
+        } else {
+            std::snprintf(buffer, sizeof(buffer), "%llum %02llus", static_cast<unsigned long long>(minutes), static_cast<unsigned long long>(total % 60));
+        }
+        return buffer;
+    }
+
+    const char* const object_type_names[] = {"nodes", "ways", "relations", "areas"};
+
+} // anonymous namespace
+
+ProgressReporter::ProgressReporter(std::chrono::seconds interval) :
+    m_interval(interval) {
+}
+
+ProgressReporter::~ProgressReporter() noexcept {
+    try {
+        stop();
+    } catch (...) {
+        // ignore exceptions in destructor
+    }
+}
+
+ProgressCounter& ProgressReporter::add_layer(const std::string& name) {
+    m_layers.emplace_back(name);
+    return m_layers.back().features;
+}
+
+void ProgressReporter::start(const std::string& phase, std::size_t total_bytes) {
+    stop();
+
+    m_phase = phase;
+    m_total_bytes = total_bytes;
+    m_bytes.set(0);
+    for (std::size_t i = 0; i < num_object_types; ++i) {
+        m_objects[i].set(0);
+        m_last_objects[i] = 0;
+    }
+    m_start = std::chrono::steady_clock::now();
+    m_last_report = m_start;
+
+    m_stop = false;
+    m_thread = std::thread{&ProgressReporter::run, this};
+}
+
+void ProgressReporter::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_stop = true;
+    }
+    m_stop_condition.notify_all();
+    m_thread.join();
+    report(true);
+}
+
+void ProgressReporter::run() {
+    std::unique_lock<std::mutex> lock{m_mutex};
+    while (!m_stop_condition.wait_for(lock, m_interval, [this]() { return m_stop; })) {
+        report(false);
+    }
+}
+
+void ProgressReporter::report(bool final) {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - m_start).count();
+    const double since_last = std::chrono::duration<double>(now - m_last_report).count();
+    m_last_report = now;
+
+    std::ostringstream out;
+    out << "[" << m_phase << " " << format_duration(elapsed) << "]";
+
+    // The reader reads ahead, so the bytes read are a bit ahead of the
+    // objects handled.
+    const std::size_t bytes = final ? m_total_bytes : m_bytes.get();
+    if (m_total_bytes > 0) {
+        out << " " << std::fixed << std::setprecision(2) << show_gbytes(bytes) << "/" << show_gbytes(m_total_bytes) << " GBytes ("
+            << (100 * bytes / m_total_bytes) << "%)";
+    }
+
+    // Per type the objects per second since the last report, and the
+    // average over the phase in the last line.
+    for (std::size_t i = 0; i < num_object_types; ++i) {
+        const std::uint64_t count = m_objects[i].get();
+        if (count == 0) {
+            continue;
+        }
+        const double rate = final ? static_cast<double>(count) / elapsed
+                                  : static_cast<double>(count - m_last_objects[i]) / since_last;
+        m_last_objects[i] = count;
+        out << " " << object_type_names[i] << " " << count << " (" << static_cast<std::uint64_t>(rate) << "/s)";
+    }
+
+    for (const auto& layer : m_layers) {
+        out << " " << layer.name << " " << layer.features.get();
+    }
+
+    if (!final && m_total_bytes > 0 && bytes > 0 && bytes < m_total_bytes) {
+        const double remaining = elapsed * static_cast<double>(m_total_bytes - bytes) / static_cast<double>(bytes);
+        out << " ETA " << format_duration(remaining);
+    }
+
+    out << "\n";
+    std::cerr << out.str();
+}
@@ -0,0 +1,239 @@
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+/*
+
+  Progress reporting for long runs.
+
+  The handlers and writers only add to atomic counters: ProgressHandler
+  counts the objects per type and hands the counts over in batches,
+  together with the number of bytes the reader has read so far. A
+  reporter thread wakes up every few seconds and prints one line to
+  stderr with the bytes read of the input size, the objects per second
+  since the last line, the features written per layer and the estimated
+  time left for the phase.
+
+*/
+
+#include <osmium/handler.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/visitor.hpp>
+
+#include "util.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class ProgressCounter {
+
+    std::atomic<std::uint64_t> m_value{0};
+
+public:
+
+    void add(std::uint64_t n = 1) noexcept {
+        m_value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void set(std::uint64_t value) noexcept {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    std::uint64_t get() const noexcept {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+}; // class ProgressCounter
+
+class ProgressReporter {
+
+public:
+
+    enum object_type : std::size_t {
+        node = 0,
+        way = 1,
+        relation = 2,
+        area = 3,
+        num_object_types = 4
+    };
+
+private:
+
+    struct layer_counter {
+        std::string name;
+        ProgressCounter features;
+
+        explicit layer_counter(const std::string& layer_name) :
+            name(layer_name) {
+        }
+    };
+
+    std::chrono::seconds m_interval;
+
+    std::string m_phase;
+    std::size_t m_total_bytes = 0;
+    std::chrono::steady_clock::time_point m_start;
+
+    ProgressCounter m_bytes;
+    ProgressCounter m_objects[num_object_types];
+
+    // A deque, so the counters stay where they are.
+    std::deque<layer_counter> m_layers;
+
+    // The counts at the last report, only used by the reporter thread.
+    std::uint64_t m_last_objects[num_object_types] = {0, 0, 0, 0};
+    std::chrono::steady_clock::time_point m_last_report;
+
+    std::mutex m_mutex;
+    std::condition_variable m_stop_condition;
+    bool m_stop = false;
+    std::thread m_thread;
+
+    void run();
+    void report(bool final);
+
+public:
+
+    explicit ProgressReporter(std::chrono::seconds interval = std::chrono::seconds{10});
+
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+    ~ProgressReporter() noexcept;
+
+    /**
+     * Counter for the features written to a layer. All layers have to be
+     * added before the first phase starts.
+     */
+    ProgressCounter& add_layer(const std::string& name);
+
+    /**
+     * Start reporting a phase reading total_bytes of input. The object
+     * counts start from zero.
+     */
+    void start(const std::string& phase, std::size_t total_bytes);
+
+    /**
+     * Stop the reporter thread and print the last line of the phase.
+     */
+    void stop();
+
+    void set_bytes(std::size_t bytes) noexcept {
+        m_bytes.set(bytes);
+    }
+
+    void add_objects(object_type type, std::uint64_t n) noexcept {
+        m_objects[type].add(n);
+    }
+
+}; // class ProgressReporter
+
+/**
+ * Handler counting the objects for the progress reporter. Without
+ * reporter it does nothing. The counts are handed over every few thousand
+ * objects and when the handler is destroyed.
+ */
+class ProgressHandler : public osmium::handler::Handler {
+
+    static constexpr const std::uint64_t batch_size = 4096;
+
+    ProgressReporter* m_reporter;
+    const osmium::io::Reader* m_reader;
+
+    std::uint64_t m_counts[ProgressReporter::num_object_types] = {0, 0, 0, 0};
+    std::uint64_t m_pending = 0;
+
+    void count(ProgressReporter::object_type type) {
+        if (!m_reporter) {
+            return;
+        }
+        ++m_counts[type];
+        if (++m_pending >= batch_size) {
+            publish();
+        }
+    }
+
+public:
+
+    /**
+     * If a reader is given, the bytes it has read are handed over, too.
+     */
+    explicit ProgressHandler(ProgressReporter* reporter, const osmium::io::Reader* reader = nullptr) :
+        m_reporter(reporter),
+        m_reader(reader) {
+    }
+
+    ProgressHandler(const ProgressHandler&) = delete;
+    ProgressHandler& operator=(const ProgressHandler&) = delete;
+
+    ~ProgressHandler() noexcept {
+        publish();
+    }
+
+    void publish() noexcept {
+        if (!m_reporter) {
+            return;
+        }
+        for (std::size_t i = 0; i < ProgressReporter::num_object_types; ++i) {
+            m_reporter->add_objects(static_cast<ProgressReporter::object_type>(i), m_counts[i]);
+            m_counts[i] = 0;
+        }
+        m_pending = 0;
+        if (m_reader) {
+            m_reporter->set_bytes(m_reader->offset());
+        }
+    }
+
+    void node(const osmium::Node& /*node*/) {
+        count(ProgressReporter::node);
+    }
+
+    void way(const osmium::Way& /*way*/) {
+        count(ProgressReporter::way);
+    }
+
+    void relation(const osmium::Relation& /*relation*/) {
+        count(ProgressReporter::relation);
+    }
+
+    void area(const osmium::Area& /*area*/) {
+        count(ProgressReporter::area);
+    }
+
+}; // class ProgressHandler
+
+/**
+ * Same as osmium::relations::read_relations() with one manager, reported
+ * as phase "Pass 1" if there is a progress reporter. The relations are
+ * also given to the handlers, before the manager. Metadata is not
+ * decoded, the managers only need the members.
+ */
+template <typename TManager, typename... THandlers>
+void read_relations_with_progress(const osmium::io::File& file, TManager& manager, ProgressReporter* progress, THandlers&... handlers) {
+    if (progress) {
+        progress->start("Pass 1", file_size(file));
+    }
+    osmium::io::Reader reader{file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
+    {
+        ProgressHandler progress_handler{progress, &reader};
+        osmium::apply(reader, progress_handler, handlers..., manager);
+    }
+    reader.close();
+    if (progress) {
+        progress->stop();
+    }
+    manager.prepare_for_lookup();
+}
+
+#endif // PROGRESS_HPP
@@ -0,0 +1,85 @@
+/*
+
+  Read profiles: the object types a tool reads from its input file and
+  whether the metadata is decoded.
+
+*/
+
+#include "read_profile.hpp"
+
+#include "util.hpp"
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/object.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+ReadProfile parse_read_profile(const std::string& str, const ReadProfile& tool_default) {
+    ReadProfile profile{tool_default.entities, osmium::io::read_meta::no};
+
+    std::string types = str;
+    const auto comma = str.find(',');
+    if (comma != std::string::npos) {
+        types = str.substr(0, comma);
+        if (str.substr(comma + 1) != "meta") {
+            throw std::runtime_error{"Unknown read option '" + str.substr(comma + 1) + "' (allowed is 'meta')."};
+        }
+        profile.meta = osmium::io::read_meta::yes;
+    }
+
+    if (types != "auto") {
+        profile.entities = get_types(types);
+        if (profile.entities == osmium::osm_entity_bits::nothing) {
+            throw std::runtime_error{"Read profile needs at least one object type."};
+        }
+    }
+
+    return profile;
+}
+
+std::string read_profile_description(const ReadProfile& profile) {
+    std::string description;
+    if (profile.entities & osmium::osm_entity_bits::node) {
+        description += 'n';
+    }
+    if (profile.entities & osmium::osm_entity_bits::way) {
+        description += 'w';
+    }
+    if (profile.entities & osmium::osm_entity_bits::relation) {
+        description += 'r';
+    }
+    if (profile.entities & osmium::osm_entity_bits::area) {
+        description += 'a';
+    }
+    description += profile.meta == osmium::io::read_meta::yes ? " with metadata" : " without metadata";
+    return description;
+}
+
+double time_read(const osmium::io::File& input_file, const ReadProfile& profile) {
+    const auto start = std::chrono::steady_clock::now();
+    osmium::io::Reader reader{input_file, profile.entities, profile.meta};
+
+    std::uint64_t objects = 0;
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        for (const auto& object : buffer.select<osmium::OSMObject>()) {
+            (void)object;
+            ++objects;
+        }
+    }
+    reader.close();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const double mbytes = static_cast<double>(file_size(input_file)) / (1024.0 * 1024.0);
+    std::cerr << "Read " << objects << " objects (" << read_profile_description(profile) << ") in "
+              << elapsed.count() << " s";
+    if (elapsed.count() > 0 && mbytes > 0) {
+        std::cerr << " (" << (mbytes / elapsed.count()) << " MBytes/s)";
+    }
+    std::cerr << "\n";
+
+    return elapsed.count();
+}
@@ -0,0 +1,44 @@
+#ifndef READ_PROFILE_HPP
+#define READ_PROFILE_HPP
+
+/*
+
+  Read profiles: the object types a tool reads from its input file and
+  whether the metadata (version, timestamp, user, changeset) is decoded.
+
+  Each tool has a default profile with only what it needs. It can be
+  changed with the --read option, mostly to measure what the decoding of
+  the other types and the metadata costs.
+
+*/
+
+#include <osmium/io/file.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/osm/entity_bits.hpp>
+
+#include <string>
+
+struct ReadProfile {
+    osmium::osm_entity_bits::type entities;
+    osmium::io::read_meta meta;
+};
+
+/**
+ * Parse the argument of the --read option: 'auto' for the default of
+ * the tool or object types like for get_types(), followed by ',meta' to
+ * decode the metadata.
+ */
+ReadProfile parse_read_profile(const std::string& str, const ReadProfile& tool_default);
+
+/**
+ * Description of the profile like "nw without metadata".
+ */
+std::string read_profile_description(const ReadProfile& profile);
+
+/**
+ * Only read the file with the given profile, without handlers, and print
+ * the decode time to stderr. Returns the time used in seconds.
+ */
+double time_read(const osmium::io::File& input_file, const ReadProfile& profile);
+
+#endif // READ_PROFILE_HPP
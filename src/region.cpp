@@ -0,0 +1,437 @@
+/*
+
+  Region to clip the exports to, given as bounding box or polygon.
+
+*/
+
+#include "region.hpp"
+
+#include "util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    // Grid rows and columns at least and at most.
+    constexpr const std::int64_t min_grid_size = 64;
+    constexpr const std::int64_t max_grid_size = 1024;
+
+    // Segments covering more cells than this are always split exactly.
+    constexpr const std::int64_t max_segment_cells = 64;
+
+    void trim(std::string& line) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) {
+            line.pop_back();
+        }
+        const auto pos = line.find_first_not_of(" \t");
+        line.erase(0, pos == std::string::npos ? line.size() : pos);
+    }
+
+} // anonymous namespace
+
+Region::Region(const osmium::Box& box) {
+    add_ring({
+        box.bottom_left(),
+        osmium::Location{box.top_right().x(), box.bottom_left().y()},
+        box.top_right(),
+        osmium::Location{box.bottom_left().x(), box.top_right().y()},
+        box.bottom_left()
+    });
+    build_grid();
+}
+
+std::unique_ptr<Region> Region::from_poly_file(const std::string& filename) {
+    std::ifstream file{filename};
+    if (!file.is_open()) {
+        throw std::runtime_error{"Could not open file '" + filename + "'"};
+    }
+
+    std::unique_ptr<Region> region{new Region{}};
+
+    std::string line;
+    std::getline(file, line); // name of the polygon
+
+    std::vector<osmium::Location> ring;
+    bool in_ring = false;
+    std::size_t line_number = 1;
+    while (std::getline(file, line)) {
+        ++line_number;
+        trim(line);
+        if (line.empty()) {
+            continue;
+        }
+        if (line == "END") {
+            if (!in_ring) {
+                break; // end of file
+            }
+            region->add_ring(ring);
+            ring.clear();
+            in_ring = false;
+        } else if (!in_ring) {
+            in_ring = true; // section name, '!' for holes doesn't matter
+        } else {
+            // Exactly two numbers, only whitespace around them.
+            const char* const begin = line.c_str();
+            char* lon_end = nullptr;
+            const double lon = std::strtod(begin, &lon_end);
+            char* lat_end = nullptr;
+            const double lat = std::strtod(lon_end, &lat_end);
+            const char* end = lat_end;
+            while (*end == ' ' || *end == '\t') {
+                ++end;
+            }
+            const osmium::Location location{lon, lat};
+            if (lon_end == begin || lat_end == lon_end || *end != '\0' || !location.valid()) {
+                throw std::runtime_error{"Invalid coordinates in line " + std::to_string(line_number) + " of '" + filename + "'"};
+            }
+            ring.push_back(location);
+        }
+    }
+
+    if (in_ring) {
+        throw std::runtime_error{"Missing END in '" + filename + "'"};
+    }
+    if (region->m_edges.empty()) {
+        throw std::runtime_error{"No polygon in '" + filename + "'"};
+    }
+
+    region->build_grid();
+    return region;
+}
+
+std::unique_ptr<Region> Region::from_options(const std::string& bbox, const std::string& polygon_file) {
+    if (!bbox.empty() && !polygon_file.empty()) {
+        throw std::runtime_error{"Options --bbox and --polygon can't be used together."};
+    }
+
+    std::unique_ptr<Region> region;
+    if (!bbox.empty()) {
+        region.reset(new Region{parse_bbox(bbox, "--bbox")});
+    } else if (!polygon_file.empty()) {
+        region = from_poly_file(polygon_file);
+    } else {
+        return region;
+    }
+
+    std::cerr << "Clipping to region " << region->box() << " with " << region->num_edges() << " edges ("
+              << region->grid_size() << "x" << region->grid_size() << " grid)\n";
+    return region;
+}
+
+void Region::add_ring(const std::vector<osmium::Location>& ring) {
+    if (ring.size() < 3) {
+        throw std::runtime_error{"Polygon ring with less than three points."};
+    }
+
+    for (std::size_t i = 0; i < ring.size(); ++i) {
+        const auto& a = ring[i];
+        const auto& b = ring[(i + 1) % ring.size()];
+        if (a != b) {
+            m_edges.push_back(edge{a.x(), a.y(), b.x(), b.y()});
+        }
+        m_box.extend(a);
+    }
+}
+
+std::int64_t Region::column(std::int64_t x) const noexcept {
+    const std::int64_t c = (x - m_box.bottom_left().x()) / m_cell_width;
+    return std::max(std::int64_t{0}, std::min(m_size - 1, c));
+}
+
+std::int64_t Region::row(std::int64_t y) const noexcept {
+    const std::int64_t r = (y - m_box.bottom_left().y()) / m_cell_height;
+    return std::max(std::int64_t{0}, std::min(m_size - 1, r));
+}
+
+void Region::build_grid() {
+    m_size = static_cast<std::int64_t>(2.0 * std::sqrt(static_cast<double>(m_edges.size())));
+    m_size = std::max(min_grid_size, std::min(max_grid_size, m_size));
+
+    const std::int64_t min_x = m_box.bottom_left().x();
+    const std::int64_t min_y = m_box.bottom_left().y();
+    m_cell_width = std::max(std::int64_t{1}, (m_box.top_right().x() - min_x + m_size) / m_size);
+    m_cell_height = std::max(std::int64_t{1}, (m_box.top_right().y() - min_y + m_size) / m_size);
+
+    m_cells.assign(static_cast<std::size_t>(m_size * m_size), cell_state::outside);
+    m_rows.assign(static_cast<std::size_t>(m_size), {});
+
+    // Add every edge to the rows it reaches into and mark the cells it
+    // passes through in each row. The x range is widened by one unit, so
+    // rounding can't leave a cell out.
+    for (std::uint32_t i = 0; i < m_edges.size(); ++i) {
+        const edge& e = m_edges[i];
+        const std::int64_t y_min = std::min(e.y1, e.y2);
+        const std::int64_t y_max = std::max(e.y1, e.y2);
+        for (std::int64_t r = row(y_min); r <= row(y_max); ++r) {
+            m_rows[static_cast<std::size_t>(r)].push_back(i);
+
+            double x_from = std::min(e.x1, e.x2);
+            double x_to = std::max(e.x1, e.x2);
+            if (e.y1 != e.y2) {
+                const double band_min = static_cast<double>(std::max(y_min, min_y + r * m_cell_height));
+                const double band_max = static_cast<double>(std::min(y_max, min_y + (r + 1) * m_cell_height));
+                const double slope = static_cast<double>(e.x2 - e.x1) / static_cast<double>(e.y2 - e.y1);
+                const double xa = e.x1 + (band_min - e.y1) * slope;
+                const double xb = e.x1 + (band_max - e.y1) * slope;
+                x_from = std::min(xa, xb);
+                x_to = std::max(xa, xb);
+            }
+            const std::int64_t c_from = column(static_cast<std::int64_t>(std::floor(x_from)) - 1);
+            const std::int64_t c_to = column(static_cast<std::int64_t>(std::ceil(x_to)) + 1);
+            for (std::int64_t c = c_from; c <= c_to; ++c) {
+                m_cells[static_cast<std::size_t>(r * m_size + c)] = cell_state::boundary;
+            }
+        }
+    }
+
+    // The other cells are inside if their center is.
+    for (std::int64_t r = 0; r < m_size; ++r) {
+        const double y = static_cast<double>(min_y + r * m_cell_height + m_cell_height / 2);
+        for (std::int64_t c = 0; c < m_size; ++c) {
+            auto& cell = m_cells[static_cast<std::size_t>(r * m_size + c)];
+            if (cell != cell_state::boundary) {
+                const double x = static_cast<double>(min_x + c * m_cell_width + m_cell_width / 2);
+                cell = crossing_test(r, x, y) ? cell_state::inside : cell_state::outside;
+            }
+        }
+    }
+}
+
+bool Region::crossing_test(std::int64_t row, double x, double y) const noexcept {
+    bool inside = false;
+    for (const auto i : m_rows[static_cast<std::size_t>(row)]) {
+        const edge& e = m_edges[i];
+        if ((e.y1 > y) != (e.y2 > y)) {
+            const double xi = e.x1 + (y - e.y1) * static_cast<double>(e.x2 - e.x1) / static_cast<double>(e.y2 - e.y1);
+            if (x < xi) {
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
+
+bool Region::contains(const osmium::Location& location) const noexcept {
+    if (!location.valid() || !m_box.contains(location)) {
+        return false;
+    }
+
+    const std::int64_t r = row(location.y());
+    const auto state = m_cells[static_cast<std::size_t>(r * m_size + column(location.x()))];
+    if (state != cell_state::boundary) {
+        return state == cell_state::inside;
+    }
+    return crossing_test(r, location.x(), location.y());
+}
+
+Region::cell_state Region::segment_cells(const osmium::Location& a, const osmium::Location& b) const noexcept {
+    const std::int64_t c_from = column(std::min(a.x(), b.x()));
+    const std::int64_t c_to = column(std::max(a.x(), b.x()));
+    const std::int64_t r_from = row(std::min(a.y(), b.y()));
+    const std::int64_t r_to = row(std::max(a.y(), b.y()));
+    if ((c_to - c_from + 1) * (r_to - r_from + 1) > max_segment_cells) {
+        return cell_state::boundary;
+    }
+
+    const auto first = m_cells[static_cast<std::size_t>(r_from * m_size + c_from)];
+    for (std::int64_t r = r_from; r <= r_to; ++r) {
+        for (std::int64_t c = c_from; c <= c_to; ++c) {
+            if (m_cells[static_cast<std::size_t>(r * m_size + c)] != first) {
+                return cell_state::boundary;
+            }
+        }
+    }
+    return first;
+}
+
+osmium::Location Region::interpolate(const osmium::Location& a, const osmium::Location& b, double t) noexcept {
+    return osmium::Location{static_cast<std::int32_t>(std::lround(a.x() + t * (static_cast<double>(b.x()) - a.x()))),
+                            static_cast<std::int32_t>(std::lround(a.y() + t * (static_cast<double>(b.y()) - a.y())))};
+}
+
+void Region::split_segment(const osmium::Location& a, const osmium::Location& b, std::vector<double>& splits) const {
+    splits.clear();
+    splits.push_back(0.0);
+
+    const double ax = a.x();
+    const double ay = a.y();
+    const double dx = static_cast<double>(b.x()) - ax;
+    const double dy = static_cast<double>(b.y()) - ay;
+
+    const std::int64_t r_from = row(std::min(a.y(), b.y()));
+    const std::int64_t r_to = row(std::max(a.y(), b.y()));
+    for (std::int64_t r = r_from; r <= r_to; ++r) {
+        for (const auto i : m_rows[static_cast<std::size_t>(r)]) {
+            const edge& e = m_edges[i];
+            const double ex = static_cast<double>(e.x2) - e.x1;
+            const double ey = static_cast<double>(e.y2) - e.y1;
+            const double d = dx * ey - dy * ex;
+            if (d == 0.0) {
+                continue; // parallel
+            }
+            const double t = ((e.x1 - ax) * ey - (e.y1 - ay) * ex) / d;
+            const double u = ((e.x1 - ax) * dy - (e.y1 - ay) * dx) / d;
+            if (t > 0.0 && t < 1.0 && u >= 0.0 && u <= 1.0) {
+                splits.push_back(t);
+            }
+        }
+    }
+
+    splits.push_back(1.0);
+    std::sort(splits.begin(), splits.end());
+    splits.erase(std::unique(splits.begin(), splits.end()), splits.end());
+}
+
+Region::overlap Region::classify_segment(const osmium::Location& a, const osmium::Location& b, std::vector<double>& splits) const {
+    const osmium::Box& box = m_box;
+    if (std::max(a.x(), b.x()) < box.bottom_left().x() || std::min(a.x(), b.x()) > box.top_right().x() ||
+        std::max(a.y(), b.y()) < box.bottom_left().y() || std::min(a.y(), b.y()) > box.top_right().y()) {
+        return overlap::outside;
+    }
+
+    if (box.contains(a) && box.contains(b)) {
+        const auto state = segment_cells(a, b);
+        if (state != cell_state::boundary) {
+            return state == cell_state::inside ? overlap::inside : overlap::outside;
+        }
+    }
+
+    split_segment(a, b, splits);
+    bool any_inside = false;
+    bool any_outside = false;
+    for (std::size_t i = 1; i < splits.size(); ++i) {
+        if (contains(interpolate(a, b, (splits[i - 1] + splits[i]) / 2))) {
+            any_inside = true;
+        } else {
+            any_outside = true;
+        }
+    }
+    if (any_inside && any_outside) {
+        return overlap::partial;
+    }
+    return any_inside ? overlap::inside : overlap::outside;
+}
+
+Region::overlap Region::classify(const osmium::NodeRefList& nodes) const {
+    if (nodes.size() == 1) {
+        return contains(nodes.front().location()) ? overlap::inside : overlap::outside;
+    }
+
+    std::vector<double> splits;
+    bool any_inside = false;
+    bool any_outside = false;
+    for (std::size_t i = 1; i < nodes.size(); ++i) {
+        const auto& a = nodes[i - 1].location();
+        const auto& b = nodes[i].location();
+        if (!a.valid() || !b.valid()) {
+            continue;
+        }
+        switch (classify_segment(a, b, splits)) {
+            case overlap::partial:
+                return overlap::partial;
+            case overlap::inside:
+                any_inside = true;
+                break;
+            case overlap::outside:
+                any_outside = true;
+                break;
+        }
+    }
+
+    if (any_inside && any_outside) {
+        return overlap::partial;
+    }
+    return any_inside ? overlap::inside : overlap::outside;
+}
+
+void Region::clip(const osmium::NodeRefList& nodes, std::vector<std::vector<osmium::NodeRef>>& pieces) const {
+    pieces.clear();
+    std::vector<osmium::NodeRef> piece;
+    std::vector<double> splits;
+
+    const auto end_piece = [&]() {
+        if (piece.size() >= 2) {
+            pieces.push_back(std::move(piece));
+        }
+        piece.clear();
+    };
+
+    for (std::size_t i = 1; i < nodes.size(); ++i) {
+        const osmium::NodeRef& a = nodes[i - 1];
+        const osmium::NodeRef& b = nodes[i];
+        if (!a.location().valid() || !b.location().valid()) {
+            end_piece();
+            continue;
+        }
+
+        const auto state = classify_segment(a.location(), b.location(), splits);
+        if (state == overlap::outside) {
+            end_piece();
+            continue;
+        }
+        if (state == overlap::inside) {
+            if (piece.empty()) {
+                piece.push_back(a);
+            }
+            piece.push_back(b);
+            continue;
+        }
+
+        for (std::size_t j = 1; j < splits.size(); ++j) {
+            const double from = splits[j - 1];
+            const double to = splits[j];
+            if (!contains(interpolate(a.location(), b.location(), (from + to) / 2))) {
+                end_piece();
+                continue;
+            }
+            if (piece.empty()) {
+                piece.push_back(from == 0.0 ? a : osmium::NodeRef{0, interpolate(a.location(), b.location(), from)});
+            }
+            if (to == 1.0) {
+                piece.push_back(b);
+            } else {
+                piece.push_back(osmium::NodeRef{0, interpolate(a.location(), b.location(), to)});
+                end_piece();
+            }
+        }
+    }
+    end_piece();
+}
+
+bool Region::intersects(const osmium::Area& area) const {
+    // If no outer ring touches the region, one of them could still
+    // contain all of it.
+    const osmium::Location probe{m_edges.front().x1, m_edges.front().y1};
+
+    for (const auto& ring : area.outer_rings()) {
+        if (classify(ring) != overlap::outside) {
+            return true;
+        }
+        if (!ring.envelope().contains(probe)) {
+            continue;
+        }
+        bool inside = false;
+        for (std::size_t i = 1; i < ring.size(); ++i) {
+            const auto& a = ring[i - 1].location();
+            const auto& b = ring[i].location();
+            if ((a.y() > probe.y()) != (b.y() > probe.y())) {
+                const double xi = a.x() + static_cast<double>(probe.y() - a.y()) * (static_cast<double>(b.x()) - a.x()) / (static_cast<double>(b.y()) - a.y());
+                if (probe.x() < xi) {
+                    inside = !inside;
+                }
+            }
+        }
+        if (inside) {
+            return true;
+        }
+    }
+    return false;
+}
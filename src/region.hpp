@@ -0,0 +1,271 @@
+#ifndef REGION_HPP
+#define REGION_HPP
+
+/*
+
+  Region to clip the exports to, given as bounding box or polygon.
+
+  The polygon (a bounding box is a polygon with four edges) is stored as
+  a list of edges, holes and several outer rings are handled with the
+  even-odd rule. Over the bounding box of the polygon lies a grid. Each
+  grid row has the list of edges reaching into it, so a point-in-polygon
+  test only has to look at the edges of one row. Cells not touched by any
+  edge are completely inside or outside, that is precomputed, so for
+  most points no edge has to be looked at at all.
+
+  RegionFilter is a handler passing on only the objects in the region to
+  another handler, with the ways crossing the boundary clipped.
+
+*/
+
+#include <osmium/handler.hpp>
+#include <osmium/builder/osm_object_builder.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/node_ref.hpp>
+#include <osmium/osm/node_ref_list.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Region {
+
+public:
+
+    enum class overlap {
+        outside,
+        inside,
+        partial
+    };
+
+private:
+
+    enum class cell_state : unsigned char {
+        outside,
+        inside,
+        boundary
+    };
+
+    struct edge {
+        std::int32_t x1;
+        std::int32_t y1;
+        std::int32_t x2;
+        std::int32_t y2;
+    };
+
+    std::vector<edge> m_edges;
+    osmium::Box m_box;
+
+    // The grid has m_size x m_size cells of m_cell_width x m_cell_height.
+    std::int64_t m_size = 0;
+    std::int64_t m_cell_width = 1;
+    std::int64_t m_cell_height = 1;
+    std::vector<cell_state> m_cells;
+
+    // For each grid row, the edges reaching into it.
+    std::vector<std::vector<std::uint32_t>> m_rows;
+
+    Region() = default;
+
+    void add_ring(const std::vector<osmium::Location>& ring);
+    void build_grid();
+
+    std::int64_t column(std::int64_t x) const noexcept;
+    std::int64_t row(std::int64_t y) const noexcept;
+
+    // Point-in-polygon test with the edges of the given row.
+    bool crossing_test(std::int64_t row, double x, double y) const noexcept;
+
+    // The state of the grid cells covered by the segment's bounding box.
+    cell_state segment_cells(const osmium::Location& a, const osmium::Location& b) const noexcept;
+
+    // Split the segment at its intersections with the edges. Fills
+    // splits with the parameters of the sub-segments, from 0 to 1.
+    void split_segment(const osmium::Location& a, const osmium::Location& b, std::vector<double>& splits) const;
+
+    // If the segment is partially inside, splits is filled as by
+    // split_segment().
+    overlap classify_segment(const osmium::Location& a, const osmium::Location& b, std::vector<double>& splits) const;
+
+    static osmium::Location interpolate(const osmium::Location& a, const osmium::Location& b, double t) noexcept;
+
+public:
+
+    /**
+     * The region inside the bounding box.
+     */
+    explicit Region(const osmium::Box& box);
+
+    /**
+     * Read the region from a polygon file in the Osmosis .poly format.
+     * Sections with names starting with '!' are holes.
+     */
+    static std::unique_ptr<Region> from_poly_file(const std::string& filename);
+
+    /**
+     * The region from the --bbox or --polygon option, nullptr if none is
+     * given. Throws if both are given.
+     */
+    static std::unique_ptr<Region> from_options(const std::string& bbox, const std::string& polygon_file);
+
+    const osmium::Box& box() const noexcept {
+        return m_box;
+    }
+
+    std::size_t num_edges() const noexcept {
+        return m_edges.size();
+    }
+
+    std::size_t grid_size() const noexcept {
+        return static_cast<std::size_t>(m_size);
+    }
+
+    // All methods are const and can be used from several threads.
+
+    /**
+     * Is the location in the region? Invalid locations are not.
+     */
+    bool contains(const osmium::Location& location) const noexcept;
+
+    /**
+     * Is the line through the nodes inside, outside or partially inside
+     * the region? Segments with invalid locations are ignored.
+     */
+    overlap classify(const osmium::NodeRefList& nodes) const;
+
+    /**
+     * Clip the line through the nodes to the region. The pieces inside
+     * have the original node refs, and node refs with id 0 where they
+     * cross the boundary.
+     */
+    void clip(const osmium::NodeRefList& nodes, std::vector<std::vector<osmium::NodeRef>>& pieces) const;
+
+    /**
+     * Does the area overlap the region? Only the outer rings are
+     * looked at.
+     */
+    bool intersects(const osmium::Area& area) const;
+
+}; // class Region
+
+/**
+ * Handler passing on the objects in the region to another handler. Nodes
+ * and areas outside the region are dropped. Ways outside the region are
+ * dropped and ways crossing the boundary are clipped into pieces (with
+ * the id and tags of the way), unless clip is false, then they are
+ * passed on whole. Without region everything is passed on.
+ */
+template <typename THandler>
+class RegionFilter : public osmium::handler::Handler {
+
+    const Region* m_region;
+    THandler& m_handler;
+    bool m_clip;
+
+    osmium::memory::Buffer m_buffer{1024, osmium::memory::Buffer::auto_grow::yes};
+    std::vector<std::vector<osmium::NodeRef>> m_pieces;
+
+    std::uint64_t m_dropped = 0;
+    std::uint64_t m_clipped = 0;
+
+    void add_piece(const osmium::Way& way, const std::vector<osmium::NodeRef>& nodes) {
+        {
+            osmium::builder::WayBuilder builder{m_buffer};
+            builder.set_id(way.id());
+            builder.set_version(way.version());
+            builder.add_item(way.tags());
+            osmium::builder::WayNodeListBuilder node_builder{builder};
+            for (const auto& node_ref : nodes) {
+                node_builder.add_node_ref(node_ref);
+            }
+        }
+        m_buffer.commit();
+    }
+
+public:
+
+    RegionFilter(const Region* region, THandler& handler, bool clip = true) :
+        m_region(region),
+        m_handler(handler),
+        m_clip(clip) {
+    }
+
+    // Objects dropped because they are outside the region.
+    std::uint64_t dropped() const noexcept {
+        return m_dropped;
+    }
+
+    // Ways clipped because they cross the boundary.
+    std::uint64_t clipped() const noexcept {
+        return m_clipped;
+    }
+
+    void print_stats() const {
+        if (m_region) {
+            std::cerr << "Outside of region: " << m_dropped << " objects dropped, " << m_clipped << " ways clipped\n";
+        }
+    }
+
+    void node(const osmium::Node& node) {
+        if (!m_region || m_region->contains(node.location())) {
+            m_handler.node(node);
+        } else {
+            ++m_dropped;
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        if (!m_region) {
+            m_handler.way(way);
+            return;
+        }
+
+        const auto state = m_region->classify(way.nodes());
+        if (state == Region::overlap::outside) {
+            ++m_dropped;
+            return;
+        }
+        if (state == Region::overlap::inside || !m_clip) {
+            m_handler.way(way);
+            return;
+        }
+
+        ++m_clipped;
+        m_region->clip(way.nodes(), m_pieces);
+        m_buffer.clear();
+        for (const auto& piece : m_pieces) {
+            add_piece(way, piece);
+        }
+        for (const auto& piece : m_buffer.select<osmium::Way>()) {
+            m_handler.way(piece);
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        m_handler.relation(relation);
+    }
+
+    void area(const osmium::Area& area) {
+        if (!m_region || m_region->intersects(area)) {
+            m_handler.area(area);
+        } else {
+            ++m_dropped;
+        }
+    }
+
+    void flush() {
+        m_handler.flush();
+    }
+
+}; // class RegionFilter
+
+#endif // REGION_HPP
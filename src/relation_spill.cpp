@@ -0,0 +1,111 @@
+/*
+
+  Temporary file with multipolygon relations, sorted by the smallest id
+  of their member ways.
+
+*/
+
+#include "relation_spill.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+RelationSpill::RelationSpill(const std::string& filename) :
+    m_filename(filename) {
+    m_out.open(m_filename + ".unsorted");
+}
+
+RelationSpill::~RelationSpill() noexcept {
+    try {
+        if (m_out.is_open()) {
+            m_out.close();
+        }
+    } catch (...) {
+        // ignore exceptions in destructor
+    }
+    m_in.close();
+    std::remove((m_filename + ".unsorted").c_str());
+    std::remove(m_filename.c_str());
+}
+
+void RelationSpill::add(const osmium::Relation& relation) {
+    entry e{std::numeric_limits<osmium::object_id_type>::max(), std::numeric_limits<osmium::object_id_type>::min(),
+            m_out.bytes_written(), relation.padded_size()};
+    for (const auto& member : relation.members()) {
+        if (member.type() == osmium::item_type::way) {
+            e.min_way = std::min(e.min_way, member.ref());
+            e.max_way = std::max(e.max_way, member.ref());
+        }
+    }
+    if (e.min_way > e.max_way) {
+        throw std::runtime_error{"Relation " + std::to_string(relation.id()) + " without way members can't be spilled"};
+    }
+
+    m_out.write(reinterpret_cast<const char*>(&relation), e.size);
+    m_index.push_back(e);
+}
+
+void RelationSpill::finish() {
+    m_out.close();
+
+    std::stable_sort(m_index.begin(), m_index.end(), [](const entry& a, const entry& b) {
+        return a.min_way < b.min_way;
+    });
+
+    // Rewrite the relations in index order. The reads jump around in the
+    // unsorted file, but that is usually small enough to be in the page
+    // cache.
+    const std::string unsorted_filename = m_filename + ".unsorted";
+    std::ifstream unsorted{unsorted_filename, std::ios::binary};
+    if (!unsorted.is_open()) {
+        throw std::runtime_error{"Could not open file '" + unsorted_filename + "'"};
+    }
+
+    BufferedWriter sorted;
+    sorted.open(m_filename);
+    std::vector<char> data;
+    for (auto& e : m_index) {
+        data.resize(e.size);
+        unsorted.seekg(static_cast<std::streamoff>(e.offset));
+        if (!unsorted.read(data.data(), static_cast<std::streamsize>(e.size))) {
+            throw std::runtime_error{"Can't read relation from '" + unsorted_filename + "'"};
+        }
+        e.offset = sorted.bytes_written();
+        sorted.write(data.data(), data.size());
+    }
+    sorted.close();
+    unsorted.close();
+    std::remove(unsorted_filename.c_str());
+
+    m_in.open(m_filename, std::ios::binary);
+    if (!m_in.is_open()) {
+        throw std::runtime_error{"Could not open file '" + m_filename + "'"};
+    }
+}
+
+osmium::object_id_type RelationSpill::next_min_way() const noexcept {
+    if (m_next == m_index.size()) {
+        return std::numeric_limits<osmium::object_id_type>::max();
+    }
+    return m_index[m_next].min_way;
+}
+
+osmium::object_id_type RelationSpill::read(osmium::object_id_type way_id, std::size_t min_count, osmium::memory::Buffer& buffer) {
+    osmium::object_id_type max_way = std::numeric_limits<osmium::object_id_type>::min();
+
+    for (std::size_t count = 0; m_next < m_index.size() && (count < min_count || m_index[m_next].min_way <= way_id); ++count, ++m_next) {
+        const entry& e = m_index[m_next];
+        unsigned char* data = buffer.reserve_space(e.size);
+        if (!m_in.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(e.size))) {
+            throw std::runtime_error{"Can't read relation from '" + m_filename + "'"};
+        }
+        buffer.commit();
+        max_way = std::max(max_way, e.max_way);
+    }
+
+    return max_way;
+}
@@ -0,0 +1,93 @@
+#ifndef RELATION_SPILL_HPP
+#define RELATION_SPILL_HPP
+
+/*
+
+  Temporary file with multipolygon relations, sorted by the smallest id
+  of their member ways.
+
+  In the first pass the relations are appended to the file as they come,
+  in the native osmium buffer format, and only a small index entry per
+  relation stays in memory. finish() rewrites the file in the order of
+  the smallest member way id, so in the second pass, with the ways coming
+  sorted by id, the relations can be read back sequentially just before
+  their first member way arrives.
+
+*/
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+
+#include "buffered_writer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class RelationSpill {
+
+    struct entry {
+        osmium::object_id_type min_way;
+        osmium::object_id_type max_way;
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    std::string m_filename;
+    BufferedWriter m_out;
+    std::ifstream m_in;
+
+    // Sorted by min_way after finish().
+    std::vector<entry> m_index;
+    std::size_t m_next = 0;
+
+public:
+
+    /**
+     * Create the spill file. It is removed when this object is destroyed.
+     */
+    explicit RelationSpill(const std::string& filename);
+
+    RelationSpill(const RelationSpill&) = delete;
+    RelationSpill& operator=(const RelationSpill&) = delete;
+
+    ~RelationSpill() noexcept;
+
+    /**
+     * Append a relation. It must have at least one way member.
+     */
+    void add(const osmium::Relation& relation);
+
+    /**
+     * Sort the relations and prepare for reading them back.
+     */
+    void finish();
+
+    std::size_t size() const noexcept {
+        return m_index.size();
+    }
+
+    std::size_t bytes_written() const noexcept {
+        return m_out.bytes_written();
+    }
+
+    /**
+     * The smallest member way id of the relations not read back yet. If
+     * all are read, the largest possible id.
+     */
+    osmium::object_id_type next_min_way() const noexcept;
+
+    /**
+     * Read the relations whose smallest member way id is at most way_id
+     * into the buffer, but at least min_count relations if there are
+     * that many left. Returns the largest member way id of the relations
+     * read.
+     */
+    osmium::object_id_type read(osmium::object_id_type way_id, std::size_t min_count, osmium::memory::Buffer& buffer);
+
+}; // class RelationSpill
+
+#endif // RELATION_SPILL_HPP
@@ -0,0 +1,149 @@
+/*
+
+  Micro-benchmarks for the river system map used by osmium_rivermap.
+
+*/
+
+#include "riversystem_bench.hpp"
+#include "buffered_writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // Do at least this many lookups, so small maps get several rounds.
+    constexpr const std::size_t min_lookups = 10 * 1000 * 1000;
+
+    // Number of different river system names in the synthetic CSV file.
+    constexpr const std::size_t bench_names = 10000;
+
+    // Time the lookup of all queries, repeated rounds times. Returns the
+    // nanoseconds per lookup. The number of non-empty names found is
+    // added to found, so the lookups can't be optimized away.
+    template <typename TLookup>
+    double time_lookups(const std::vector<std::int64_t>& queries, std::size_t rounds, std::size_t& found, TLookup&& lookup) {
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t round = 0; round < rounds; ++round) {
+            for (const auto id : queries) {
+                if (*lookup(id) != '\0') {
+                    ++found;
+                }
+            }
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() * 1e9 / static_cast<double>(queries.size() * rounds);
+    }
+
+    std::size_t gcd(std::size_t a, std::size_t b) noexcept {
+        while (b != 0) {
+            const std::size_t r = a % b;
+            a = b;
+            b = r;
+        }
+        return a;
+    }
+
+    // Write the rows for the ids 0 to num_rows-1 (times 3, so they are not
+    // dense). If shuffled, the rows are written in the order i * step
+    // modulo num_rows, which is a permutation if step and num_rows are
+    // coprime. This needs no memory for a shuffled id list.
+    void write_bench_csv(const std::string& filename, std::size_t num_rows, bool shuffled) {
+        std::size_t step = 1;
+        if (shuffled) {
+            step = num_rows / 2 + num_rows / 8 + 1;
+            while (gcd(step, num_rows) != 1) {
+                ++step;
+            }
+        }
+
+        BufferedWriter out;
+        out.open(filename);
+        out.write("id,rsystem\n");
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < num_rows; ++i) {
+            out.write_int(static_cast<std::int64_t>(n) * 3);
+            out.write(",river_");
+            out.write_int(static_cast<std::int64_t>(n % bench_names));
+            out.put('\n');
+            n = (n + step) % num_rows;
+        }
+        out.close();
+    }
+
+} // anonymous namespace
+
+void bench_lookup(const RiversystemMap& map) {
+    if (map.size() == 0) {
+        std::cerr << "No river system ids to look up\n";
+        return;
+    }
+
+    std::vector<std::int64_t> queries;
+    queries.reserve(map.size());
+    for (std::size_t i = 0; i < map.size(); ++i) {
+        queries.push_back(map.id(i));
+    }
+    std::mt19937_64 random{42};
+    std::shuffle(queries.begin(), queries.end(), random);
+
+    const std::size_t rounds = std::max(min_lookups / queries.size(), static_cast<std::size_t>(1));
+
+    std::size_t found = 0;
+    const double flat_ns = time_lookups(queries, rounds, found, [&map](std::int64_t id) {
+        return map.getName(id);
+    });
+
+    std::map<std::int64_t, const char*> tree;
+    for (std::size_t i = 0; i < map.size(); ++i) {
+        tree.emplace(map.id(i), map.getName(map.id(i)));
+    }
+    static const char empty = '\0';
+    const double tree_ns = time_lookups(queries, rounds, found, [&tree](std::int64_t id) {
+        const auto it = tree.find(id);
+        return it == tree.end() ? &empty : it->second;
+    });
+
+    std::cerr << "Looked up " << queries.size() << " ids " << rounds << " times in random order ("
+              << found << " names found):\n"
+              << "  flat arrays: " << flat_ns << " ns/lookup\n"
+              << "  std::map:    " << tree_ns << " ns/lookup\n";
+}
+
+void bench_load(std::size_t num_rows, const std::string& filename) {
+    if (num_rows == 0) {
+        std::cerr << "Number of rows for --bench-load must be greater than 0\n";
+        return;
+    }
+
+    const unsigned int max_threads = std::max(std::thread::hardware_concurrency(), 1U);
+    std::vector<unsigned int> thread_counts;
+    for (unsigned int threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    for (const bool shuffled : {false, true}) {
+        write_bench_csv(filename, num_rows, shuffled);
+        std::cerr << "Loading " << num_rows << (shuffled ? " shuffled" : " sorted") << " rows:\n";
+        for (const auto threads : thread_counts) {
+            const auto start = std::chrono::steady_clock::now();
+            RiversystemMap map;
+            map.load(filename, threads);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr << "  " << threads << " threads: " << elapsed.count() << " s ("
+                      << (static_cast<double>(map.size()) / elapsed.count() / 1e6) << " million rows/s)\n";
+        }
+    }
+
+    std::remove(filename.c_str());
+}
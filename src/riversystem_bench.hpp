@@ -0,0 +1,31 @@
+#ifndef RIVERSYSTEM_BENCH_HPP
+#define RIVERSYSTEM_BENCH_HPP
+
+/*
+
+  Micro-benchmarks for the river system map used by osmium_rivermap.
+
+*/
+
+#include "riversystem_map.hpp"
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Look up all ids of the map in random order and print the time per
+ * lookup. For comparison the same lookups are done in a
+ * std::map<std::int64_t, const char*> with the same content, which is
+ * how the map was stored before.
+ */
+void bench_lookup(const RiversystemMap& map);
+
+/**
+ * Write num_rows synthetic rows into the CSV file with the given name,
+ * once sorted by id and once shuffled, and time loading them with 1, 2,
+ * 4, ... threads up to the number of hardware threads. The file is
+ * removed at the end.
+ */
+void bench_load(std::size_t num_rows, const std::string& filename);
+
+#endif // RIVERSYSTEM_BENCH_HPP
@@ -0,0 +1,378 @@
+/*
+
+  Map from way id to the name of the river system the way belongs to.
+
+*/
+
+#include "riversystem_map.hpp"
+#include "buffered_writer.hpp"
+
+#include <osmium/io/detail/read_write.hpp>
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    constexpr const char index_magic[8] = {'R', 'S', 'Y', 'S', 'I', 'D', 'X', 1};
+
+    struct index_header {
+        char magic[8];
+        std::uint64_t num_ids;
+        std::uint64_t num_names;
+        std::uint64_t arena_size;
+    };
+
+    struct csv_chunk {
+        std::vector<std::pair<std::int64_t, std::uint32_t>> entries;
+        std::vector<std::string> names;
+        std::exception_ptr error;
+    };
+
+    // Add count elements of element_size bytes to size. Returns false if
+    // the result doesn't fit.
+    bool add_array_size(std::size_t& size, std::uint64_t count, std::size_t element_size) noexcept {
+        const std::size_t max = std::numeric_limits<std::size_t>::max();
+        if (count > (max - size) / element_size) {
+            return false;
+        }
+        size += static_cast<std::size_t>(count) * element_size;
+        return true;
+    }
+
+    // getName() relies on all of this, so it is checked once when an
+    // index file is loaded instead of on every lookup. The arena starts
+    // with the empty name, which is returned for unknown ids, and every
+    // name must be null-terminated.
+    bool is_valid_index(const std::int64_t* ids, const std::uint32_t* name_indexes, std::size_t num_ids,
+                        const std::uint32_t* name_offsets, std::size_t num_names,
+                        const char* arena, std::size_t arena_size) noexcept {
+        if (arena[0] != '\0' || arena[arena_size - 1] != '\0') {
+            return false;
+        }
+        for (std::size_t i = 0; i < num_names; ++i) {
+            if (name_offsets[i] >= arena_size) {
+                return false;
+            }
+        }
+        for (std::size_t i = 0; i < num_ids; ++i) {
+            if (name_indexes[i] >= num_names || (i > 0 && ids[i - 1] >= ids[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_space(char c) noexcept {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    [[noreturn]] void throw_invalid_line(const char* line, const char* end) {
+        throw std::runtime_error(std::string("Invalid line in csv file: ") +
+                                 std::string(line, std::find(line, end, '\n')));
+    }
+
+    // Parse the lines between begin and end. Each line has the form
+    // "id,name", blanks after the comma are skipped. Like istream
+    // extraction the name ends at the first whitespace. The name indexes
+    // in the result are local to the chunk.
+    void parse_csv_chunk(const char* begin, const char* end, csv_chunk& chunk) {
+        try {
+            std::unordered_map<std::string, std::uint32_t> name_index;
+            std::string name;
+
+            const char* p = begin;
+            while (p != end) {
+                while (p != end && is_space(*p)) {
+                    ++p;
+                }
+                if (p == end) {
+                    break;
+                }
+
+                const char* const line = p;
+                bool negative = false;
+                if (*p == '-') {
+                    negative = true;
+                    ++p;
+                }
+                constexpr const std::uint64_t max_id = static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max());
+                std::uint64_t value = 0;
+                const char* const digits = p;
+                while (p != end && *p >= '0' && *p <= '9') {
+                    const auto digit = static_cast<std::uint64_t>(*p - '0');
+                    if (value > (max_id - digit) / 10) {
+                        throw_invalid_line(line, end);
+                    }
+                    value = value * 10 + digit;
+                    ++p;
+                }
+                if (p == digits || p == end || *p != ',') {
+                    throw_invalid_line(line, end);
+                }
+                ++p;
+                while (p != end && (*p == ' ' || *p == '\t')) {
+                    ++p;
+                }
+
+                const char* const name_begin = p;
+                while (p != end && !is_space(*p)) {
+                    ++p;
+                }
+                name.assign(name_begin, p);
+
+                auto it = name_index.find(name);
+                if (it == name_index.end()) {
+                    it = name_index.emplace(name, static_cast<std::uint32_t>(chunk.names.size())).first;
+                    chunk.names.push_back(name);
+                }
+
+                const auto id = negative ? -static_cast<std::int64_t>(value) : static_cast<std::int64_t>(value);
+                chunk.entries.emplace_back(id, it->second);
+
+                // ignore anything else up to the end of the line
+                p = std::find(p, end, '\n');
+            }
+        } catch (...) {
+            chunk.error = std::current_exception();
+        }
+    }
+
+} // anonymous namespace
+
+RiversystemMap::RiversystemMap() :
+    m_name_offsets(1, 0),
+    m_arena(1, '\0') {
+    // name index 0 is the empty name at the start of the arena
+    set_views();
+}
+
+void RiversystemMap::set_views() noexcept {
+    m_id_data = m_ids.data();
+    m_name_index_data = m_name_indexes.data();
+    m_name_offset_data = m_name_offsets.data();
+    m_arena_data = m_arena.data();
+    m_size = m_ids.size();
+    m_num_names = m_name_offsets.size();
+    m_arena_size = m_arena.size();
+}
+
+void RiversystemMap::build(std::vector<std::pair<std::int64_t, std::uint32_t>>& entries) {
+    const auto compare_ids = [](const std::pair<std::int64_t, std::uint32_t>& a,
+                                const std::pair<std::int64_t, std::uint32_t>& b) {
+        return a.first < b.first;
+    };
+
+    // Files written from OSM data usually are sorted by id already.
+    if (!std::is_sorted(entries.begin(), entries.end(), compare_ids)) {
+        std::stable_sort(entries.begin(), entries.end(), compare_ids);
+    }
+
+    m_ids.clear();
+    m_name_indexes.clear();
+    m_ids.reserve(entries.size());
+    m_name_indexes.reserve(entries.size());
+
+    for (const auto& entry : entries) {
+        if (!m_ids.empty() && m_ids.back() == entry.first) {
+            continue;
+        }
+        m_ids.push_back(entry.first);
+        m_name_indexes.push_back(entry.second);
+    }
+
+    m_ids.shrink_to_fit();
+    m_name_indexes.shrink_to_fit();
+    m_name_offsets.shrink_to_fit();
+    m_arena.shrink_to_fit();
+
+    set_views();
+}
+
+void RiversystemMap::load(const std::string& filename, unsigned int num_threads) {
+    char magic[sizeof(index_magic)] = {0};
+    {
+        std::ifstream ifs{filename, std::ios::binary};
+        if (!ifs) {
+            throw std::runtime_error(std::string("Can't read from file ") + filename);
+        }
+        ifs.read(magic, sizeof(magic));
+    }
+
+    if (std::memcmp(magic, index_magic, sizeof(index_magic)) == 0) {
+        load_index(filename);
+    } else {
+        load_csv(filename, num_threads);
+    }
+}
+
+void RiversystemMap::load_index(const std::string& filename) {
+    const int fd = osmium::io::detail::open_for_reading(filename);
+    const std::size_t file_size = osmium::file_size(fd);
+
+    if (file_size < sizeof(index_header)) {
+        osmium::io::detail::reliable_close(fd);
+        throw std::runtime_error(std::string("Index file too short: ") + filename);
+    }
+
+    std::unique_ptr<osmium::util::MemoryMapping> mapping{
+        new osmium::util::MemoryMapping{file_size, osmium::util::MemoryMapping::mapping_mode::readonly, fd}};
+    osmium::io::detail::reliable_close(fd);
+
+    const char* data = mapping->get_addr<char>();
+    index_header header;
+    std::memcpy(&header, data, sizeof(header));
+
+    // Check the sizes in the header without overflowing, a corrupt file
+    // could have any numbers in there.
+    std::size_t expected_size = sizeof(index_header);
+    if (header.num_names == 0 || header.arena_size == 0 ||
+        !add_array_size(expected_size, header.num_ids, sizeof(std::int64_t) + sizeof(std::uint32_t)) ||
+        !add_array_size(expected_size, header.num_names, sizeof(std::uint32_t)) ||
+        !add_array_size(expected_size, header.arena_size, 1) ||
+        file_size != expected_size) {
+        throw std::runtime_error(std::string("Index file corrupt: ") + filename);
+    }
+
+    const std::size_t num_ids = static_cast<std::size_t>(header.num_ids);
+    const std::size_t num_names = static_cast<std::size_t>(header.num_names);
+    const std::size_t arena_size = static_cast<std::size_t>(header.arena_size);
+
+    // The header size is a multiple of 8, so the id array is aligned.
+    const auto* ids = reinterpret_cast<const std::int64_t*>(data + sizeof(index_header));
+    const auto* name_indexes = reinterpret_cast<const std::uint32_t*>(ids + num_ids);
+    const auto* name_offsets = name_indexes + num_ids;
+    const auto* arena = reinterpret_cast<const char*>(name_offsets + num_names);
+
+    if (!is_valid_index(ids, name_indexes, num_ids, name_offsets, num_names, arena, arena_size)) {
+        throw std::runtime_error(std::string("Index file corrupt: ") + filename);
+    }
+
+    m_ids.clear();
+    m_name_indexes.clear();
+    m_name_offsets.clear();
+    m_arena.clear();
+
+    m_size = num_ids;
+    m_num_names = num_names;
+    m_arena_size = arena_size;
+    m_id_data = ids;
+    m_name_index_data = name_indexes;
+    m_name_offset_data = name_offsets;
+    m_arena_data = arena;
+    m_mapping = std::move(mapping);
+}
+
+void RiversystemMap::write_index(const std::string& filename) const {
+    index_header header;
+    std::memcpy(header.magic, index_magic, sizeof(index_magic));
+    header.num_ids = m_size;
+    header.num_names = m_num_names;
+    header.arena_size = m_arena_size;
+
+    BufferedWriter out;
+    out.open(filename);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(m_id_data), m_size * sizeof(std::int64_t));
+    out.write(reinterpret_cast<const char*>(m_name_index_data), m_size * sizeof(std::uint32_t));
+    out.write(reinterpret_cast<const char*>(m_name_offset_data), m_num_names * sizeof(std::uint32_t));
+    out.write(m_arena_data, header.arena_size);
+    out.close();
+}
+
+void RiversystemMap::load_csv(const std::string& filename, unsigned int num_threads) {
+    const int fd = osmium::io::detail::open_for_reading(filename);
+    const std::size_t file_size = osmium::file_size(fd);
+    if (file_size == 0) {
+        osmium::io::detail::reliable_close(fd);
+        throw std::runtime_error(std::string("Can't read from file ") + filename);
+    }
+    osmium::util::MemoryMapping mapping{file_size, osmium::util::MemoryMapping::mapping_mode::readonly, fd};
+    osmium::io::detail::reliable_close(fd);
+
+    const char* const begin = mapping.get_addr<char>();
+    const char* const end = begin + file_size;
+
+    const char* body = std::find(begin, end, '\n');
+    std::string header{begin, body};
+    if (!header.empty() && header.back() == '\r') {
+        header.pop_back();
+    }
+    if (header != "id,rsystem") {
+        throw std::runtime_error(std::string("Wrong csv header: ") + header);
+    }
+    if (body != end) {
+        ++body;
+    }
+
+    // Split the body into line-aligned chunks, one per thread.
+    num_threads = std::max(num_threads, 1U);
+    const std::size_t chunk_size = static_cast<std::size_t>(end - body) / num_threads + 1;
+    std::vector<const char*> bounds{body};
+    while (bounds.back() != end) {
+        const char* next = bounds.back() + std::min(chunk_size, static_cast<std::size_t>(end - bounds.back()));
+        next = std::find(next, end, '\n');
+        if (next != end) {
+            ++next;
+        }
+        bounds.push_back(next);
+    }
+
+    std::vector<csv_chunk> chunks(bounds.size() - 1);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < chunks.size(); ++i) {
+        threads.emplace_back(parse_csv_chunk, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Merge the per-chunk results in file order, so that the first entry
+    // still wins for duplicate ids.
+    std::unordered_map<std::string, std::uint32_t> name_index;
+    std::vector<std::pair<std::int64_t, std::uint32_t>> entries;
+    std::size_t num_entries = 0;
+    for (const auto& chunk : chunks) {
+        if (chunk.error) {
+            std::rethrow_exception(chunk.error);
+        }
+        num_entries += chunk.entries.size();
+    }
+    entries.reserve(num_entries);
+
+    for (auto& chunk : chunks) {
+        std::vector<std::uint32_t> global_index;
+        global_index.reserve(chunk.names.size());
+        for (const auto& name : chunk.names) {
+            const auto result = name_index.emplace(name, static_cast<std::uint32_t>(m_name_offsets.size()));
+            if (result.second) {
+                if (m_arena.size() + name.size() + 1 > std::numeric_limits<std::uint32_t>::max()) {
+                    throw std::runtime_error(std::string("Too many river system names in ") + filename);
+                }
+                m_name_offsets.push_back(static_cast<std::uint32_t>(m_arena.size()));
+                m_arena.append(name);
+                m_arena.push_back('\0');
+            }
+            global_index.push_back(result.first->second);
+        }
+        for (const auto& entry : chunk.entries) {
+            entries.emplace_back(entry.first, global_index[entry.second]);
+        }
+        chunk.entries.clear();
+        chunk.entries.shrink_to_fit();
+    }
+
+    build(entries);
+}
@@ -0,0 +1,144 @@
+#ifndef RIVERSYSTEM_MAP_HPP
+#define RIVERSYSTEM_MAP_HPP
+
+/*
+
+  Map from way id to the name of the river system the way belongs to.
+
+  The ids are kept in a sorted contiguous array with a parallel array of
+  name indexes. All names are interned into one string arena, each one
+  terminated by a null byte.
+
+  The map can be loaded from the "id,rsystem" CSV file or from a binary
+  index file which is memory-mapped without any parsing. The index file
+  is written in native byte order:
+
+    char     magic[8]   "RSYSIDX\0" with the version (1) in the last byte
+    uint64   number of ids (n)
+    uint64   number of names (m)
+    uint64   size of string arena in bytes (a)
+    int64    ids[n]             sorted
+    uint32   name_indexes[n]
+    uint32   name_offsets[m]    offsets into the arena
+    char     arena[a]
+
+*/
+
+#include <osmium/util/memory_mapping.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class RiversystemMap {
+
+    std::vector<std::int64_t> m_ids;
+    std::vector<std::uint32_t> m_name_indexes;
+    std::vector<std::uint32_t> m_name_offsets;
+    std::string m_arena;
+
+    // If the map was loaded from an index file, the data lives here.
+    std::unique_ptr<osmium::util::MemoryMapping> m_mapping;
+
+    // Views on the data, either in the vectors above or in the mapping.
+    const std::int64_t* m_id_data = nullptr;
+    const std::uint32_t* m_name_index_data = nullptr;
+    const std::uint32_t* m_name_offset_data = nullptr;
+    const char* m_arena_data = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_num_names = 0;
+    std::size_t m_arena_size = 0;
+
+    void set_views() noexcept;
+
+    // Build the arrays from unsorted (id, name index) pairs. If an id is
+    // in there several times, the first one wins.
+    void build(std::vector<std::pair<std::int64_t, std::uint32_t>>& entries);
+
+    void load_csv(const std::string& filename, unsigned int num_threads);
+    void load_index(const std::string& filename);
+
+public:
+
+    RiversystemMap();
+
+    RiversystemMap(const RiversystemMap&) = delete;
+    RiversystemMap& operator=(const RiversystemMap&) = delete;
+
+    /**
+     * Load the map from a CSV file with the header "id,rsystem" or from
+     * an index file written by write_index(). The type of file is
+     * detected automatically. A CSV file is memory-mapped and parsed in
+     * line-aligned chunks by the given number of threads.
+     */
+    void load(const std::string& filename, unsigned int num_threads = 1);
+
+    /**
+     * Write the map as binary index file.
+     */
+    void write_index(const std::string& filename) const;
+
+    /**
+     * Get the name of the river system for the way with the given id.
+     * Returns an empty string if the id is unknown.
+     */
+    const char* getName(std::int64_t id) const noexcept {
+        const std::int64_t* base = m_id_data;
+        std::size_t n = m_size;
+        if (n == 0) {
+            return m_arena_data;
+        }
+
+        // Branchless binary search, the compiler turns the conditional
+        // into a conditional move.
+        while (n > 1) {
+            const std::size_t half = n / 2;
+            base = (base[half] <= id) ? base + half : base;
+            n -= half;
+        }
+
+        if (*base != id) {
+            return m_arena_data;
+        }
+        return m_arena_data + m_name_offset_data[m_name_index_data[static_cast<std::size_t>(base - m_id_data)]];
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    /**
+     * The id at position n, the ids are sorted.
+     */
+    std::int64_t id(std::size_t n) const noexcept {
+        return m_id_data[n];
+    }
+
+    std::size_t num_names() const noexcept {
+        return m_num_names - 1;
+    }
+
+    bool is_mapped() const noexcept {
+        return static_cast<bool>(m_mapping);
+    }
+
+    /**
+     * Memory used by the map in bytes. For a memory-mapped index this is
+     * the size of the mapping, which is shared with the page cache.
+     */
+    std::size_t used_memory() const noexcept {
+        if (m_mapping) {
+            return m_mapping->size();
+        }
+        return m_ids.capacity() * sizeof(std::int64_t) +
+               m_name_indexes.capacity() * sizeof(std::uint32_t) +
+               m_name_offsets.capacity() * sizeof(std::uint32_t) +
+               m_arena.capacity();
+    }
+
+}; // class RiversystemMap
+
+#endif // RIVERSYSTEM_MAP_HPP
@@ -0,0 +1,174 @@
+/*
+
+  Compute river systems from connected waterways.
+
+*/
+
+#include "riversystems.hpp"
+#include "buffered_writer.hpp"
+
+#include <osmium/osm/way.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // The names end up in a CSV file which osmium_rivermap reads with
+    // istream extraction, so they must not contain whitespace or commas.
+    std::string sanitize_name(const std::string& name) {
+        std::string result{name};
+        for (auto& c : result) {
+            if (c == ',' || std::isspace(static_cast<unsigned char>(c))) {
+                c = '_';
+            }
+        }
+        return result;
+    }
+
+    constexpr const std::uint32_t river_weight = 1U << 31U;
+
+} // anonymous namespace
+
+RiversystemBuilder::RiversystemBuilder(unsigned int num_threads) :
+    m_node_ways(std::max(num_threads, 1U)) {
+    // index 0 is reserved for "no name"
+    m_names.emplace_back();
+}
+
+std::uint32_t RiversystemBuilder::intern(const char* name) {
+    if (name == nullptr || *name == '\0') {
+        return 0;
+    }
+    const auto result = m_name_index.emplace(name, static_cast<std::uint32_t>(m_names.size()));
+    if (result.second) {
+        m_names.push_back(sanitize_name(result.first->first));
+    }
+    return result.first->second;
+}
+
+void RiversystemBuilder::add_way(const osmium::Way& way) {
+    if (m_ways.size() >= std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error{"Too many waterways for river system computation"};
+    }
+    const auto index = static_cast<std::uint32_t>(m_ways.size());
+
+    const char* waterway = way.tags().get_value_by_key("waterway");
+    std::uint32_t weight = static_cast<std::uint32_t>(std::min<std::size_t>(way.nodes().size(), river_weight - 1));
+    if (waterway && !std::strcmp(waterway, "river")) {
+        weight |= river_weight;
+    }
+
+    m_ways.push_back(way_info{way.id(), intern(way.tags().get_value_by_key("name")), weight});
+
+    const auto num_buckets = m_node_ways.size();
+    for (const auto& nr : way.nodes()) {
+        const auto ref = nr.positive_ref();
+        m_node_ways[ref % num_buckets].push_back(node_way{ref, index});
+    }
+}
+
+std::vector<std::uint32_t> RiversystemBuilder::components_single_threaded() {
+    UnionFind components;
+    for (std::size_t i = 0; i < m_ways.size(); ++i) {
+        components.add();
+    }
+
+    // All ways sharing a node end up next to each other after sorting.
+    auto& node_ways = m_node_ways.front();
+    std::sort(node_ways.begin(), node_ways.end());
+    for (std::size_t i = 1; i < node_ways.size(); ++i) {
+        if (node_ways[i].node == node_ways[i - 1].node) {
+            components.unite(node_ways[i].way, node_ways[i - 1].way);
+        }
+    }
+
+    std::vector<std::uint32_t> roots(m_ways.size());
+    for (std::uint32_t i = 0; i < m_ways.size(); ++i) {
+        roots[i] = components.find(i);
+    }
+    return roots;
+}
+
+std::vector<std::uint32_t> RiversystemBuilder::components_multi_threaded() {
+    ConcurrentUnionFind components{m_ways.size()};
+
+    // Each thread sorts one bucket and unites the ways sharing a node.
+    std::vector<std::thread> threads;
+    for (auto& bucket : m_node_ways) {
+        threads.emplace_back([&components, &bucket]() {
+            std::sort(bucket.begin(), bucket.end());
+            for (std::size_t i = 1; i < bucket.size(); ++i) {
+                if (bucket[i].node == bucket[i - 1].node) {
+                    components.unite(bucket[i].way, bucket[i - 1].way);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<std::uint32_t> roots(m_ways.size());
+    for (std::uint32_t i = 0; i < m_ways.size(); ++i) {
+        roots[i] = components.find(i);
+    }
+    return roots;
+}
+
+void RiversystemBuilder::write_csv(const std::string& filename) {
+    const auto roots = m_node_ways.size() > 1 ? components_multi_threaded()
+                                              : components_single_threaded();
+    m_node_ways.clear();
+    m_node_ways.shrink_to_fit();
+
+    // Find the most important way of each river system. Named ways win
+    // over unnamed ones, then rivers over other waterways, then the
+    // longer way, then the smaller id. The root is the smallest index of
+    // its river system, so it is always visited first.
+    std::vector<std::uint32_t> best(m_ways.size());
+    for (std::uint32_t i = 0; i < m_ways.size(); ++i) {
+        const auto root = roots[i];
+        if (root == i) {
+            best[root] = i;
+            continue;
+        }
+        const auto& candidate = m_ways[i];
+        const auto& current = m_ways[best[root]];
+        if ((candidate.name != 0) != (current.name != 0)) {
+            if (candidate.name != 0) {
+                best[root] = i;
+            }
+        } else if (candidate.weight != current.weight) {
+            if (candidate.weight > current.weight) {
+                best[root] = i;
+            }
+        } else if (candidate.id < current.id) {
+            best[root] = i;
+        }
+    }
+
+    BufferedWriter out;
+    out.open(filename);
+    out.write("id,rsystem\n");
+    for (std::uint32_t i = 0; i < m_ways.size(); ++i) {
+        const auto& way = m_ways[best[roots[i]]];
+        out.write_int(m_ways[i].id);
+        out.put(',');
+        if (way.name != 0) {
+            out.write(m_names[way.name]);
+        } else {
+            // unnamed river system, use id of its main way
+            out.put('w');
+            out.write_int(way.id);
+        }
+        out.put('\n');
+    }
+    out.close();
+}
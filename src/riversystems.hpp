@@ -0,0 +1,182 @@
+#ifndef RIVERSYSTEMS_HPP
+#define RIVERSYSTEMS_HPP
+
+/*
+
+  Compute river systems, i.e. the sets of waterways connected through
+  shared nodes, and write them as the "id,rsystem" CSV file read by
+  osmium_rivermap.
+
+*/
+
+#include <osmium/osm/types.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace osmium {
+    class Way;
+} // namespace osmium
+
+/**
+ * Union-find (disjoint set) over dense indexes. The smaller index always
+ * becomes the root, so the result does not depend on the order of the
+ * unite() calls.
+ */
+class UnionFind {
+
+    std::vector<std::uint32_t> m_parent;
+
+public:
+
+    std::uint32_t add() {
+        const auto index = static_cast<std::uint32_t>(m_parent.size());
+        m_parent.push_back(index);
+        return index;
+    }
+
+    std::size_t size() const noexcept {
+        return m_parent.size();
+    }
+
+    std::uint32_t find(std::uint32_t index) noexcept {
+        while (m_parent[index] != index) {
+            // path halving
+            m_parent[index] = m_parent[m_parent[index]];
+            index = m_parent[index];
+        }
+        return index;
+    }
+
+    void unite(std::uint32_t a, std::uint32_t b) noexcept {
+        a = find(a);
+        b = find(b);
+        if (a < b) {
+            m_parent[b] = a;
+        } else if (b < a) {
+            m_parent[a] = b;
+        }
+    }
+
+}; // class UnionFind
+
+/**
+ * Lock-free union-find for use from several threads at once. Parent
+ * links are only ever changed with compare-and-swap and always point to
+ * a smaller index. So the root of every set is its smallest index, no
+ * matter in which order the threads unite the sets.
+ */
+class ConcurrentUnionFind {
+
+    std::unique_ptr<std::atomic<std::uint32_t>[]> m_parent;
+
+public:
+
+    explicit ConcurrentUnionFind(std::size_t size) :
+        m_parent(new std::atomic<std::uint32_t>[size]) {
+        for (std::size_t i = 0; i < size; ++i) {
+            m_parent[i].store(static_cast<std::uint32_t>(i), std::memory_order_relaxed);
+        }
+    }
+
+    std::uint32_t find(std::uint32_t index) noexcept {
+        while (true) {
+            auto parent = m_parent[index].load(std::memory_order_acquire);
+            if (parent == index) {
+                return index;
+            }
+            const auto grandparent = m_parent[parent].load(std::memory_order_acquire);
+            if (grandparent != parent) {
+                // path halving, it doesn't matter if this fails
+                m_parent[index].compare_exchange_weak(parent, grandparent, std::memory_order_release, std::memory_order_relaxed);
+            }
+            index = grandparent;
+        }
+    }
+
+    void unite(std::uint32_t a, std::uint32_t b) noexcept {
+        while (true) {
+            a = find(a);
+            b = find(b);
+            if (a == b) {
+                return;
+            }
+            if (b < a) {
+                std::swap(a, b);
+            }
+            // Link the larger root below the smaller one. If another
+            // thread changed it in the meantime, start again.
+            auto expected = b;
+            if (m_parent[b].compare_exchange_strong(expected, a, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+}; // class ConcurrentUnionFind
+
+class RiversystemBuilder {
+
+    struct node_way {
+        osmium::unsigned_object_id_type node;
+        std::uint32_t way;
+
+        bool operator<(const node_way& other) const noexcept {
+            return node < other.node || (node == other.node && way < other.way);
+        }
+    };
+
+    struct way_info {
+        osmium::object_id_type id;
+        std::uint32_t name;    // index into m_names, 0 if unnamed
+        std::uint32_t weight;  // number of nodes, rivers count extra
+    };
+
+    std::vector<way_info> m_ways;
+
+    // The (node, way) pairs are distributed over one bucket per thread
+    // by node id, so that all pairs of a node end up in the same bucket.
+    std::vector<std::vector<node_way>> m_node_ways;
+
+    std::vector<std::string> m_names;
+    std::unordered_map<std::string, std::uint32_t> m_name_index;
+
+    std::uint32_t intern(const char* name);
+
+    std::vector<std::uint32_t> components_single_threaded();
+    std::vector<std::uint32_t> components_multi_threaded();
+
+public:
+
+    /**
+     * Create builder. The connected components are computed with the
+     * given number of threads.
+     */
+    explicit RiversystemBuilder(unsigned int num_threads = 1);
+
+    /**
+     * Remember the way for the river system computation. The way must
+     * have a "waterway" tag.
+     */
+    void add_way(const osmium::Way& way);
+
+    std::size_t num_ways() const noexcept {
+        return m_ways.size();
+    }
+
+    /**
+     * Compute the river systems and write them as CSV file with the
+     * header "id,rsystem". Each river system is named after its most
+     * important named waterway. The result does not depend on the
+     * number of threads.
+     */
+    void write_csv(const std::string& filename);
+
+}; // class RiversystemBuilder
+
+#endif // RIVERSYSTEMS_HPP
@@ -0,0 +1,179 @@
+/*
+
+  Statistics of a run written as JSON file with --stats.
+
+*/
+
+#include "run_stats.hpp"
+
+#include "util.hpp"
+
+#include <osmium/util/memory.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+    std::string json_string(const std::string& str) {
+        std::string out{"\""};
+        for (const char c : str) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buffer[8];
+                        std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned int>(c));
+                        out += buffer;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+        return out;
+    }
+
+    void write_counters(std::ostream& out, const char* name, const std::vector<std::pair<std::string, std::uint64_t>>& counters) {
+        out << "  " << json_string(name) << ": {";
+        const char* separator = "\n";
+        for (const auto& counter : counters) {
+            out << separator << "    " << json_string(counter.first) << ": " << counter.second;
+            separator = ",\n";
+        }
+        out << (counters.empty() ? "}" : "\n  }");
+    }
+
+} // anonymous namespace
+
+RunStats::RunStats(const std::string& tool) :
+    m_tool(tool),
+    m_start(std::chrono::steady_clock::now()),
+    m_cpu_start(process_cpu_seconds()) {
+}
+
+void RunStats::set_input(const osmium::io::File& file) {
+    m_input = file.filename().empty() ? "-" : file.filename();
+    m_input_bytes = file_size(file);
+}
+
+StageTime& RunStats::find_stage(const std::string& name) {
+    for (auto& s : m_stages) {
+        if (s.name == name) {
+            return s.time;
+        }
+    }
+    m_stages.push_back(stage{name, StageTime{}});
+    return m_stages.back().time;
+}
+
+void RunStats::add_counter(counters_type& counters, const std::string& name, std::uint64_t value) {
+    for (auto& counter : counters) {
+        if (counter.first == name) {
+            counter.second += value;
+            return;
+        }
+    }
+    counters.emplace_back(name, value);
+}
+
+void RunStats::begin_stage(const std::string& name) {
+    end_stage();
+    m_current_stage = name;
+    m_stage_start = std::chrono::steady_clock::now();
+    m_stage_cpu_start = process_cpu_seconds();
+}
+
+void RunStats::end_stage() {
+    if (m_current_stage.empty()) {
+        return;
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_stage_start;
+    find_stage(m_current_stage).add(elapsed.count(), process_cpu_seconds() - m_stage_cpu_start);
+    m_current_stage.clear();
+}
+
+void RunStats::add_stage(const std::string& name, const StageTime& time) {
+    find_stage(name) += time;
+}
+
+void RunStats::set_location_index(const std::string& store, std::size_t entries, std::size_t used_memory) {
+    m_location_store = store;
+    m_location_entries = entries;
+    m_location_memory = used_memory;
+}
+
+void RunStats::add_objects(const std::string& type, std::uint64_t count) {
+    add_counter(m_objects, type, count);
+}
+
+void RunStats::add_features(const std::string& layer, std::uint64_t count) {
+    add_counter(m_features, layer, count);
+}
+
+void RunStats::add_errors(const std::string& kind, std::uint64_t count) {
+    add_counter(m_errors, kind, count);
+}
+
+void RunStats::write(const std::string& filename) {
+    end_stage();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+    const double cpu = process_cpu_seconds() - m_cpu_start;
+    const osmium::MemoryUsage memory;
+
+    std::ofstream out{filename};
+    if (!out.is_open()) {
+        throw std::runtime_error{"Could not open file '" + filename + "'"};
+    }
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\n"
+        << "  \"tool\": " << json_string(m_tool) << ",\n"
+        << "  \"input\": " << json_string(m_input) << ",\n"
+        << "  \"input_bytes\": " << m_input_bytes << ",\n"
+        << "  \"wall_seconds\": " << elapsed.count() << ",\n"
+        << "  \"cpu_seconds\": " << cpu << ",\n"
+        << "  \"peak_rss_mbytes\": " << memory.peak() << ",\n";
+
+    out << "  \"stages\": [";
+    const char* separator = "\n";
+    for (const auto& s : m_stages) {
+        out << separator << "    {\"name\": " << json_string(s.name)
+            << ", \"wall_seconds\": " << s.time.seconds()
+            << ", \"cpu_seconds\": " << s.time.cpu_seconds() << "}";
+        separator = ",\n";
+    }
+    out << (m_stages.empty() ? "],\n" : "\n  ],\n");
+
+    out << "  \"location_index\": {"
+        << "\"store\": " << json_string(m_location_store)
+        << ", \"entries\": " << m_location_entries
+        << ", \"used_memory_bytes\": " << m_location_memory << "},\n";
+
+    write_counters(out, "objects", m_objects);
+    out << ",\n";
+    write_counters(out, "features", m_features);
+    out << ",\n";
+    write_counters(out, "errors", m_errors);
+    out << "\n}\n";
+
+    out.close();
+    if (!out) {
+        throw std::runtime_error{"Error writing file '" + filename + "'"};
+    }
+}
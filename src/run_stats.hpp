@@ -0,0 +1,199 @@
+#ifndef RUN_STATS_HPP
+#define RUN_STATS_HPP
+
+/*
+
+  Statistics of a run written as JSON file with --stats.
+
+  The run is divided into stages. Most stages follow each other on the
+  main thread (begin_stage() ends the stage before), their CPU time is
+  that of the whole process, including the threads working for them.
+  Other stages, like the OGR writes, happen in small pieces during the
+  ways pass, they are measured with a StageTime and added with
+  add_stage(), their CPU time is only that of the threads doing the work.
+  Stages with the same name are added up.
+
+  StatsHandler counts the objects read and starts the "node_pass",
+  "way_pass" and "relation_pass" stages when the first object of the
+  type comes along. Without RunStats it does nothing. In a second pass
+  that reads the relations again (like with --read=all), call
+  ignore_relations(), so they aren't counted twice.
+
+*/
+
+#include <osmium/area/stats.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+
+#include "stage_time.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class RunStats {
+
+    struct stage {
+        std::string name;
+        StageTime time;
+    };
+
+    using counters_type = std::vector<std::pair<std::string, std::uint64_t>>;
+
+    std::string m_tool;
+    std::string m_input;
+    std::size_t m_input_bytes = 0;
+
+    std::chrono::steady_clock::time_point m_start;
+    double m_cpu_start;
+
+    std::vector<stage> m_stages;
+    std::string m_current_stage;
+    std::chrono::steady_clock::time_point m_stage_start;
+    double m_stage_cpu_start = 0.0;
+
+    std::string m_location_store;
+    std::size_t m_location_entries = 0;
+    std::size_t m_location_memory = 0;
+
+    counters_type m_objects;
+    counters_type m_features;
+    counters_type m_errors;
+
+    StageTime& find_stage(const std::string& name);
+    static void add_counter(counters_type& counters, const std::string& name, std::uint64_t value);
+
+public:
+
+    explicit RunStats(const std::string& tool);
+
+    void set_input(const osmium::io::File& file);
+
+    /**
+     * Start a stage on the main thread, ending the current one.
+     */
+    void begin_stage(const std::string& name);
+
+    /**
+     * End the current stage, if there is one.
+     */
+    void end_stage();
+
+    /**
+     * Add time measured for a stage done in pieces.
+     */
+    void add_stage(const std::string& name, const StageTime& time);
+
+    void set_location_index(const std::string& store, std::size_t entries, std::size_t used_memory);
+
+    // These are added up if called several times with the same name.
+    void add_objects(const std::string& type, std::uint64_t count);
+    void add_features(const std::string& layer, std::uint64_t count);
+    void add_errors(const std::string& kind, std::uint64_t count);
+
+    /**
+     * End the current stage and write all statistics, together with
+     * the total time and the peak memory use, to the JSON file.
+     */
+    void write(const std::string& filename);
+
+}; // class RunStats
+
+class StatsHandler : public osmium::handler::Handler {
+
+    RunStats* m_stats;
+    osmium::item_type m_type = osmium::item_type::undefined;
+
+    std::uint64_t m_nodes = 0;
+    std::uint64_t m_ways = 0;
+    std::uint64_t m_relations = 0;
+    std::uint64_t m_areas = 0;
+
+    bool m_ignore_relations = false;
+
+    void enter(osmium::item_type type, const char* stage) {
+        if (m_type != type) {
+            m_type = type;
+            m_stats->begin_stage(stage);
+        }
+    }
+
+public:
+
+    explicit StatsHandler(RunStats* stats) noexcept :
+        m_stats(stats) {
+    }
+
+    void node(const osmium::Node& /*node*/) {
+        if (m_stats) {
+            enter(osmium::item_type::node, "node_pass");
+            ++m_nodes;
+        }
+    }
+
+    void way(const osmium::Way& /*way*/) {
+        if (m_stats) {
+            enter(osmium::item_type::way, "way_pass");
+            ++m_ways;
+        }
+    }
+
+    /**
+     * Don't count relations and don't start the "relation_pass" stage for
+     * them, they are already counted in an earlier pass.
+     */
+    void ignore_relations() noexcept {
+        m_ignore_relations = true;
+    }
+
+    void relation(const osmium::Relation& /*relation*/) {
+        if (m_stats && !m_ignore_relations) {
+            enter(osmium::item_type::relation, "relation_pass");
+            ++m_relations;
+        }
+    }
+
+    // Areas don't start a stage, they come along with the ways.
+    void area(const osmium::Area& /*area*/) {
+        if (m_stats) {
+            ++m_areas;
+        }
+    }
+
+    /**
+     * End the current stage and add the counts to the stats. Call after
+     * each pass.
+     */
+    void finish() {
+        if (!m_stats) {
+            return;
+        }
+        m_stats->end_stage();
+        m_stats->add_objects("nodes", m_nodes);
+        m_stats->add_objects("ways", m_ways);
+        m_stats->add_objects("relations", m_relations);
+        m_stats->add_objects("areas", m_areas);
+        m_nodes = m_ways = m_relations = m_areas = 0;
+        m_type = osmium::item_type::undefined;
+    }
+
+}; // class StatsHandler
+
+/**
+ * Add the problems found by the multipolygon assembler to the errors.
+ */
+inline void add_area_errors(RunStats& stats, const osmium::area::area_stats& area_stats) {
+    stats.add_errors("open_rings", area_stats.open_rings);
+    stats.add_errors("intersections", area_stats.intersections);
+    stats.add_errors("duplicate_segments", area_stats.duplicate_segments);
+}
+
+#endif // RUN_STATS_HPP
@@ -0,0 +1,321 @@
+/*
+
+  Writer that inserts features directly into a table of a Spatialite
+  database with the sqlite3 library, bypassing OGR.
+
+*/
+
+#include "spatialite_writer.hpp"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Marks the start of a geometry inside a collection in a Spatialite
+    // blob. It takes the place of the byte order byte in WKB.
+    constexpr const char spatialite_entity = 0x69;
+
+    constexpr const std::uint32_t wkb_point              = 1;
+    constexpr const std::uint32_t wkb_linestring         = 2;
+    constexpr const std::uint32_t wkb_polygon            = 3;
+    constexpr const std::uint32_t wkb_multipoint         = 4;
+    constexpr const std::uint32_t wkb_multilinestring    = 5;
+    constexpr const std::uint32_t wkb_multipolygon       = 6;
+    constexpr const std::uint32_t wkb_geometrycollection = 7;
+
+    char native_byte_order() noexcept {
+        const std::uint16_t one = 1;
+        char byte;
+        std::memcpy(&byte, &one, 1);
+        return byte; // 1 for little endian (NDR), 0 for big endian (XDR)
+    }
+
+    template <typename T>
+    void append(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // Copies the WKB into the Spatialite blob format, which uses the
+    // same layout for coordinates and counts, and tracks the MBR.
+    class wkb_converter {
+
+        const char* m_data;
+        const char* m_end;
+        std::string& m_out;
+
+        double m_min_x = std::numeric_limits<double>::max();
+        double m_min_y = std::numeric_limits<double>::max();
+        double m_max_x = std::numeric_limits<double>::lowest();
+        double m_max_y = std::numeric_limits<double>::lowest();
+
+        template <typename T>
+        T read() {
+            if (m_end - m_data < static_cast<std::ptrdiff_t>(sizeof(T))) {
+                throw std::runtime_error{"Truncated WKB"};
+            }
+            T value;
+            std::memcpy(&value, m_data, sizeof(T));
+            m_data += sizeof(T);
+            return value;
+        }
+
+        std::uint32_t copy_count() {
+            const auto count = read<std::uint32_t>();
+            append(m_out, count);
+            return count;
+        }
+
+        void copy_points(std::uint32_t count) {
+            for (std::uint32_t i = 0; i < count; ++i) {
+                const auto x = read<double>();
+                const auto y = read<double>();
+                m_min_x = std::min(m_min_x, x);
+                m_min_y = std::min(m_min_y, y);
+                m_max_x = std::max(m_max_x, x);
+                m_max_y = std::max(m_max_y, y);
+                append(m_out, x);
+                append(m_out, y);
+            }
+        }
+
+        std::uint32_t read_header() {
+            if (read<char>() != native_byte_order()) {
+                throw std::runtime_error{"WKB not in native byte order"};
+            }
+            return read<std::uint32_t>();
+        }
+
+    public:
+
+        wkb_converter(const std::string& wkb, std::string& out) :
+            m_data(wkb.data()),
+            m_end(wkb.data() + wkb.size()),
+            m_out(out) {
+        }
+
+        std::uint32_t type() {
+            return read_header();
+        }
+
+        void body(std::uint32_t type) {
+            switch (type) {
+                case wkb_point:
+                    copy_points(1);
+                    break;
+                case wkb_linestring:
+                    copy_points(copy_count());
+                    break;
+                case wkb_polygon: {
+                        const auto rings = copy_count();
+                        for (std::uint32_t i = 0; i < rings; ++i) {
+                            copy_points(copy_count());
+                        }
+                    }
+                    break;
+                case wkb_multipoint:
+                case wkb_multilinestring:
+                case wkb_multipolygon:
+                case wkb_geometrycollection: {
+                        const auto count = copy_count();
+                        for (std::uint32_t i = 0; i < count; ++i) {
+                            const auto member_type = read_header();
+                            m_out.push_back(spatialite_entity);
+                            append(m_out, member_type);
+                            body(member_type);
+                        }
+                    }
+                    break;
+                default:
+                    throw std::runtime_error{"Unsupported WKB geometry type " + std::to_string(type)};
+            }
+        }
+
+        void mbr(double* values) const noexcept {
+            values[0] = m_min_x;
+            values[1] = m_min_y;
+            values[2] = m_max_x;
+            values[3] = m_max_y;
+        }
+
+    }; // class wkb_converter
+
+} // anonymous namespace
+
+void wkb_to_spatialite(const std::string& wkb, int srid, std::string& blob) {
+    // The header has a fixed size, the MBR is filled in at the end.
+    //   0x00, byte order, int32 srid, 4 doubles MBR, 0x7C, int32 class type
+    constexpr const std::size_t mbr_offset = 6;
+    constexpr const std::size_t header_size = mbr_offset + 4 * sizeof(double) + 1;
+
+    blob.clear();
+    blob.resize(header_size);
+    blob[0] = 0x00;
+    blob[1] = native_byte_order();
+    const auto srid32 = static_cast<std::int32_t>(srid);
+    std::memcpy(&blob[2], &srid32, sizeof(srid32));
+    blob[header_size - 1] = 0x7C;
+
+    wkb_converter converter{wkb, blob};
+    const auto type = converter.type();
+    append(blob, type);
+    converter.body(type);
+    blob.push_back(static_cast<char>(0xFE));
+
+    double mbr[4];
+    converter.mbr(mbr);
+    std::memcpy(&blob[mbr_offset], mbr, sizeof(mbr));
+}
+
+SpatialiteWriter::SpatialiteWriter(const std::string& filename,
+                                   const std::string& table,
+                                   const std::vector<std::string>& columns,
+                                   std::uint64_t tx_batch) :
+    m_tx_batch(tx_batch) {
+    if (sqlite3_open_v2(filename.c_str(), &m_db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+        const std::string message = m_db ? sqlite3_errmsg(m_db) : "out of memory";
+        sqlite3_close(m_db);
+        m_db = nullptr;
+        throw std::runtime_error{"Can't open database " + filename + ": " + message};
+    }
+
+    try {
+        exec("PRAGMA synchronous = OFF");
+
+        // Find name and SRID of the geometry column.
+        sqlite3_stmt* query = nullptr;
+        check(sqlite3_prepare_v2(m_db,
+                                 "SELECT f_geometry_column, srid FROM geometry_columns WHERE lower(f_table_name) = lower(?)",
+                                 -1, &query, nullptr), "prepare");
+        sqlite3_bind_text(query, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+        std::string geometry_column;
+        if (sqlite3_step(query) == SQLITE_ROW) {
+            geometry_column = reinterpret_cast<const char*>(sqlite3_column_text(query, 0));
+            m_srid = sqlite3_column_int(query, 1);
+        }
+        sqlite3_finalize(query);
+        if (geometry_column.empty()) {
+            throw std::runtime_error{"No geometry column for table " + table + " in " + filename};
+        }
+
+        std::string sql = "INSERT INTO \"" + table + "\" (\"" + geometry_column + "\"";
+        for (const auto& column : columns) {
+            sql += ", \"" + column + "\"";
+        }
+        sql += ") VALUES (?";
+        for (std::size_t i = 0; i < columns.size(); ++i) {
+            sql += ", ?";
+        }
+        sql += ")";
+
+        exec("BEGIN");
+        drop_triggers(table);
+        check(sqlite3_prepare_v2(m_db, sql.c_str(), -1, &m_insert, nullptr), "prepare");
+    } catch (...) {
+        sqlite3_finalize(m_insert);
+        m_insert = nullptr;
+        sqlite3_close(m_db);
+        m_db = nullptr;
+        throw;
+    }
+}
+
+SpatialiteWriter::~SpatialiteWriter() noexcept {
+    try {
+        close();
+    } catch (...) {
+        // ignore exceptions in destructor
+    }
+}
+
+void SpatialiteWriter::drop_triggers(const std::string& table) {
+    sqlite3_stmt* query = nullptr;
+    check(sqlite3_prepare_v2(m_db,
+                             "SELECT name, sql FROM sqlite_master WHERE type = 'trigger' AND lower(tbl_name) = lower(?)",
+                             -1, &query, nullptr), "prepare");
+    sqlite3_bind_text(query, 1, table.c_str(), -1, SQLITE_TRANSIENT);
+    while (sqlite3_step(query) == SQLITE_ROW) {
+        m_triggers.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(query, 0)),
+                                reinterpret_cast<const char*>(sqlite3_column_text(query, 1)));
+    }
+    sqlite3_finalize(query);
+
+    for (const auto& trigger : m_triggers) {
+        exec(("DROP TRIGGER \"" + trigger.first + "\"").c_str());
+    }
+}
+
+void SpatialiteWriter::exec(const char* sql) {
+    check(sqlite3_exec(m_db, sql, nullptr, nullptr, nullptr), sql);
+}
+
+void SpatialiteWriter::check(int result, const char* what) {
+    if (result != SQLITE_OK && result != SQLITE_DONE) {
+        throw std::runtime_error{std::string{"Sqlite error ("} + what + "): " + sqlite3_errmsg(m_db)};
+    }
+}
+
+void SpatialiteWriter::set_geometry(const std::string& wkb) {
+    wkb_to_spatialite(wkb, m_srid, m_blob);
+    check(sqlite3_bind_blob(m_insert, 1, m_blob.data(), static_cast<int>(m_blob.size()), SQLITE_STATIC), "bind");
+}
+
+void SpatialiteWriter::set_field(int column, double value) {
+    check(sqlite3_bind_double(m_insert, column + 2, value), "bind");
+}
+
+void SpatialiteWriter::set_field(int column, const char* value) {
+    if (value) {
+        check(sqlite3_bind_text(m_insert, column + 2, value, -1, SQLITE_STATIC), "bind");
+    } else {
+        check(sqlite3_bind_null(m_insert, column + 2), "bind");
+    }
+}
+
+void SpatialiteWriter::add_row() {
+    const int result = sqlite3_step(m_insert);
+    sqlite3_reset(m_insert);
+    sqlite3_clear_bindings(m_insert);
+    check(result, "insert");
+
+    if (m_tx_batch > 0 && ++m_rows_in_tx >= m_tx_batch) {
+        exec("COMMIT");
+        exec("BEGIN");
+        m_rows_in_tx = 0;
+    }
+}
+
+void SpatialiteWriter::close() {
+    if (!m_db) {
+        return;
+    }
+
+    sqlite3_finalize(m_insert);
+    m_insert = nullptr;
+
+    sqlite3* db = m_db;
+    const char* what = "COMMIT";
+    int result = sqlite3_exec(db, what, nullptr, nullptr, nullptr);
+    for (const auto& trigger : m_triggers) {
+        if (result != SQLITE_OK) {
+            break;
+        }
+        what = "CREATE TRIGGER";
+        result = sqlite3_exec(db, trigger.second.c_str(), nullptr, nullptr, nullptr);
+    }
+    const std::string message = sqlite3_errmsg(db);
+    m_db = nullptr;
+    sqlite3_close(db);
+
+    if (result != SQLITE_OK) {
+        throw std::runtime_error{std::string{"Sqlite error ("} + what + "): " + message};
+    }
+}
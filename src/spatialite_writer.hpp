@@ -0,0 +1,109 @@
+#ifndef SPATIALITE_WRITER_HPP
+#define SPATIALITE_WRITER_HPP
+
+/*
+
+  Writer that inserts features directly into a table of a Spatialite
+  database with the sqlite3 library, bypassing OGR.
+
+  The table must already exist with its entry in the geometry_columns
+  table, usually it is created through OGR. The Spatialite extension
+  isn't loaded here, but the triggers Spatialite puts on the table call
+  its functions: GeometryConstraints() in the ggi_ and ggu_ triggers and
+  the R-tree functions of a spatial index. So all triggers of the table
+  are dropped while writing and created again by close(). The geometry
+  constraints are met by the blobs written here anyway. The table must
+  not have a spatial index yet, it would miss the new rows.
+
+  Geometries are given as WKB in native byte order (as created by the
+  osmium WKBFactory) and converted into Spatialite geometry blobs.
+
+*/
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+/**
+ * Convert a 2D WKB geometry in native byte order into a Spatialite
+ * geometry blob with the given SRID. The result is written into blob.
+ */
+void wkb_to_spatialite(const std::string& wkb, int srid, std::string& blob);
+
+class SpatialiteWriter {
+
+    sqlite3* m_db = nullptr;
+    sqlite3_stmt* m_insert = nullptr;
+
+    int m_srid = 0;
+
+    std::uint64_t m_tx_batch;
+    std::uint64_t m_rows_in_tx = 0;
+
+    // reused for every row
+    std::string m_blob;
+
+    // Name and SQL of the triggers dropped while writing.
+    std::vector<std::pair<std::string, std::string>> m_triggers;
+
+    void drop_triggers(const std::string& table);
+
+    void exec(const char* sql);
+    void check(int result, const char* what);
+
+public:
+
+    /**
+     * Open the database and prepare the INSERT statement for the given
+     * table and (non-geometry) columns. The rows are written in
+     * transactions of tx_batch rows, 0 means one transaction for all.
+     */
+    SpatialiteWriter(const std::string& filename,
+                     const std::string& table,
+                     const std::vector<std::string>& columns,
+                     std::uint64_t tx_batch = 0);
+
+    SpatialiteWriter(const SpatialiteWriter&) = delete;
+    SpatialiteWriter& operator=(const SpatialiteWriter&) = delete;
+
+    ~SpatialiteWriter() noexcept;
+
+    int srid() const noexcept {
+        return m_srid;
+    }
+
+    /**
+     * Set the geometry of the current row from WKB.
+     */
+    void set_geometry(const std::string& wkb);
+
+    /**
+     * Set the column with the given index (in the order given to the
+     * constructor) of the current row. Columns not set are NULL.
+     */
+    void set_field(int column, double value);
+
+    /**
+     * Set the column with the given index of the current row. The value
+     * must stay valid until add_row() is called. A nullptr sets NULL.
+     */
+    void set_field(int column, const char* value);
+
+    /**
+     * Insert the current row.
+     */
+    void add_row();
+
+    /**
+     * Commit the last transaction, create the triggers of the table
+     * again and close the database.
+     */
+    void close();
+
+}; // class SpatialiteWriter
+
+#endif // SPATIALITE_WRITER_HPP
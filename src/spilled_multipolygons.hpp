@@ -0,0 +1,266 @@
+#ifndef SPILLED_MULTIPOLYGONS_HPP
+#define SPILLED_MULTIPOLYGONS_HPP
+
+/*
+
+  Multipolygon handling with the relations in a temporary file.
+
+  The MultipolygonManager keeps all multipolygon relations and the
+  bookkeeping for their members in memory from the first pass until the
+  end of the second pass. This handler writes the relations into a
+  RelationSpill in the first pass and only keeps a set with the ids of
+  the member ways in memory. In the second pass, which needs the ways
+  sorted by id, the relations are paged in as chunks shortly before their
+  first member way comes along, each chunk with its own small
+  MultipolygonManager. A chunk is dropped as soon as the ways are past
+  the largest member way id of all its relations. Closed ways which are
+  not a member of any relation go to a manager without relations.
+
+  The areas are handed to a ParallelAreaAssembly, which gives them to its
+  callback. They are the same as with one MultipolygonManager, but they
+  may come in a different order.
+
+  Usage:
+
+    using assembler_type = ParallelAssembler<osmium::area::Assembler>;
+    assembler_type::config_type config;
+    // ... set assembler options in config
+    ParallelAreaAssembly<osmium::area::Assembler> assembly{num_threads, config};
+    config.assembly = &assembly;
+    SpilledMultipolygons<osmium::area::Assembler> spilled{filename, config};
+    spilled.read_relations(input_file);
+    ...
+    assembly.set_callback([](osmium::memory::Buffer&& buffer) { ... });
+    osmium::apply(reader, location_handler, spilled);
+    spilled.finish();
+    assembly.finish();
+
+*/
+
+#include <osmium/area/multipolygon_manager.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/tags/taglist.hpp>
+#include <osmium/tags/tags_filter.hpp>
+#include <osmium/visitor.hpp>
+
+#include "node_prefilter.hpp"
+#include "parallel_areas.hpp"
+#include "progress.hpp"
+#include "relation_spill.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename TAssembler>
+class SpilledMultipolygons : public osmium::handler::Handler {
+
+public:
+
+    using assembler_type = ParallelAssembler<TAssembler>;
+    using config_type = typename assembler_type::config_type;
+    using manager_type = osmium::area::MultipolygonManager<assembler_type>;
+
+private:
+
+    using handler_type = typename std::remove_reference<decltype(std::declval<manager_type&>().handler())>::type;
+
+    // Relations read from the spill file at least, so a chunk isn't paged
+    // in for every member way.
+    static constexpr const std::size_t min_chunk_size = 1024;
+
+    struct chunk {
+        std::unique_ptr<manager_type> manager;
+        handler_type* handler = nullptr;
+        osmium::object_id_type max_way = 0;
+        std::size_t num_relations = 0;
+    };
+
+    config_type m_way_config;
+    config_type m_relation_config;
+    osmium::TagsFilter m_filter;
+
+    RelationSpill m_spill;
+    id_set_type m_member_ways;
+
+    // Without relations, assembles the closed ways not in any relation.
+    manager_type m_way_manager;
+    handler_type* m_way_handler;
+
+    std::vector<std::unique_ptr<chunk>> m_chunks;
+    std::size_t m_relations_in_memory = 0;
+    std::size_t m_peak_relations_in_memory = 0;
+    osmium::object_id_type m_last_way = std::numeric_limits<osmium::object_id_type>::min();
+
+    std::vector<osmium::object_id_type> m_incomplete_relations;
+
+    // Same test as in MultipolygonManager::new_relation().
+    bool wanted(const osmium::Relation& relation) const {
+        const char* type = relation.tags().get_value_by_key("type");
+        if (!type || (std::strcmp(type, "multipolygon") != 0 && std::strcmp(type, "boundary") != 0)) {
+            return false;
+        }
+        if (!osmium::tags::match_any_of(relation.tags(), m_filter)) {
+            return false;
+        }
+        return std::any_of(relation.members().cbegin(), relation.members().cend(), [](const osmium::RelationMember& member) {
+            return member.type() == osmium::item_type::way;
+        });
+    }
+
+    void page_in(osmium::object_id_type way_id) {
+        // The manager copies the relations it wants, so the buffer is only
+        // needed while they are added.
+        osmium::memory::Buffer buffer{1024UL * 1024UL, osmium::memory::Buffer::auto_grow::yes};
+        std::unique_ptr<chunk> c{new chunk{}};
+        c->max_way = m_spill.read(way_id, min_chunk_size, buffer);
+        c->manager.reset(new manager_type{m_relation_config, m_filter});
+        for (const auto& relation : buffer.select<osmium::Relation>()) {
+            c->manager->relation(relation);
+            ++c->num_relations;
+        }
+        c->manager->prepare_for_lookup();
+        c->handler = &c->manager->handler();
+
+        m_relations_in_memory += c->num_relations;
+        m_peak_relations_in_memory = std::max(m_peak_relations_in_memory, m_relations_in_memory);
+        m_chunks.push_back(std::move(c));
+    }
+
+    void retire(chunk& c) {
+        c.manager->for_each_incomplete_relation([this](const osmium::relations::RelationHandle& handle) {
+            m_incomplete_relations.push_back(handle->id());
+        });
+        m_relations_in_memory -= c.num_relations;
+    }
+
+    // Drop the chunks with no member ways left at or after way_id.
+    void retire_chunks(osmium::object_id_type way_id) {
+        const auto it = std::partition(m_chunks.begin(), m_chunks.end(), [way_id](const std::unique_ptr<chunk>& c) {
+            return c->max_way >= way_id;
+        });
+        for (auto c = it; c != m_chunks.end(); ++c) {
+            retire(**c);
+        }
+        m_chunks.erase(it, m_chunks.end());
+    }
+
+public:
+
+    /**
+     * The relations are spilled into the named file, which is removed
+     * when this object is destroyed. The config must have the assembly
+     * set.
+     */
+    SpilledMultipolygons(const std::string& filename, const config_type& config, const osmium::TagsFilter& filter = osmium::TagsFilter{true}) :
+        m_way_config(config),
+        m_relation_config(config),
+        m_filter(filter),
+        m_spill(filename),
+        m_member_ways(),
+        m_way_manager(m_way_config, m_filter),
+        m_way_handler(&m_way_manager.handler()) {
+        m_relation_config.way_areas = false;
+        m_way_manager.prepare_for_lookup();
+    }
+
+    /**
+     * First pass: write the multipolygon relations of the file into the
+     * spill file. Reported as phase "Pass 1" if there is a progress
+     * reporter. All relations are also given to the handlers.
+     */
+    template <typename... THandlers>
+    void read_relations(const osmium::io::File& file, ProgressReporter* progress = nullptr, THandlers&... handlers) {
+        if (progress) {
+            progress->start("Pass 1", file_size(file));
+        }
+        osmium::io::Reader reader{file, osmium::osm_entity_bits::relation, osmium::io::read_meta::no};
+        ProgressHandler progress_handler{progress, &reader};
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            if (progress || sizeof...(THandlers) > 0) {
+                osmium::apply(buffer, progress_handler, handlers...);
+            }
+            for (const auto& relation : buffer.select<osmium::Relation>()) {
+                if (!wanted(relation)) {
+                    continue;
+                }
+                m_spill.add(relation);
+                for (const auto& member : relation.members()) {
+                    if (member.type() == osmium::item_type::way) {
+                        m_member_ways.set(member.positive_ref());
+                    }
+                }
+            }
+        }
+        progress_handler.publish();
+        reader.close();
+        if (progress) {
+            progress->stop();
+        }
+        m_spill.finish();
+    }
+
+    std::size_t num_relations() const noexcept {
+        return m_spill.size();
+    }
+
+    std::size_t spill_bytes() const noexcept {
+        return m_spill.bytes_written();
+    }
+
+    std::size_t peak_relations_in_memory() const noexcept {
+        return m_peak_relations_in_memory;
+    }
+
+    void way(const osmium::Way& way) {
+        if (way.id() < m_last_way) {
+            throw std::runtime_error{"Ways must be sorted by id when spilling relations (way " +
+                                     std::to_string(way.id()) + " after " + std::to_string(m_last_way) + ")"};
+        }
+        m_last_way = way.id();
+
+        if (!m_member_ways.get(way.positive_id())) {
+            m_way_handler->way(way);
+            return;
+        }
+
+        retire_chunks(way.id());
+        if (m_spill.next_min_way() <= way.id()) {
+            page_in(way.id());
+        }
+        for (auto& c : m_chunks) {
+            c->handler->way(way);
+        }
+    }
+
+    /**
+     * Drop all remaining chunks. Call after the second pass.
+     */
+    void finish() {
+        retire_chunks(std::numeric_limits<osmium::object_id_type>::max());
+    }
+
+    /**
+     * The ids of the relations with member ways missing. Only complete
+     * after finish().
+     */
+    const std::vector<osmium::object_id_type>& incomplete_relations() const noexcept {
+        return m_incomplete_relations;
+    }
+
+}; // class SpilledMultipolygons
+
+#endif // SPILLED_MULTIPOLYGONS_HPP
@@ -0,0 +1,237 @@
+/*
+
+  Output for BaseLayersHandler writing every layer into its own dataset.
+
+*/
+
+#include "split_layers.hpp"
+
+#include "base_layers_handler.hpp"
+#include "ogr_output.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+    // Features handed over to a writer thread in one go.
+    constexpr const std::size_t batch_size = 1000;
+
+    // Batches waiting for a writer thread before the handler blocks.
+    constexpr const std::size_t max_queued_batches = 16;
+
+} // anonymous namespace
+
+void SplitLayersOutput::queued_feature::add_to_layer(gdalcpp::Layer& layer) const {
+    gdalcpp::Feature feature{layer, geometry_from_wkb(m_wkb)};
+    int n = 0;
+    for (const auto& field : m_fields) {
+        switch (field.type) {
+            case field_value::kind::none:
+                break;
+            case field_value::kind::integer:
+                feature.set_field(n, field.integer);
+                break;
+            case field_value::kind::real:
+                feature.set_field(n, field.real);
+                break;
+            case field_value::kind::string:
+                feature.set_field(n, field.string.c_str());
+                break;
+        }
+        ++n;
+    }
+    feature.add_to_layer();
+}
+
+SplitLayersOutput::layer_writer::layer_writer(const std::string& format, const std::string& filename, const LayerConfig::layer& layer,
+                                              std::uint64_t tx_batch, const std::vector<std::string>& options, bool create_index) :
+    m_filename(filename),
+    m_dataset(format, filename, gdalcpp::SRS{}, { "SPATIALITE=TRUE", "INIT_WITH_EPSG=no" }),
+    m_layer(),
+    m_create_index(create_index),
+    m_batch(),
+    m_queue(max_queued_batches, "layer_writer"),
+    m_error() {
+    setup_transactions(m_dataset, tx_batch);
+    m_layer = create_config_layer(m_dataset, layer, options);
+    m_batch.reserve(batch_size);
+    m_thread = std::thread{&layer_writer::run, this};
+}
+
+SplitLayersOutput::layer_writer::~layer_writer() noexcept {
+    try {
+        finish();
+    } catch (...) {
+        // ignore exceptions in destructor
+    }
+}
+
+void SplitLayersOutput::layer_writer::run() {
+    while (true) {
+        batch_type batch;
+        m_queue.wait_and_pop(batch);
+        if (batch.empty()) {
+            break;
+        }
+
+        // After an error keep taking batches from the queue, so the
+        // handler thread doesn't block forever.
+        if (m_error) {
+            continue;
+        }
+        try {
+            StageTime::scope timer{&m_write_time};
+            for (const auto& feature : batch) {
+                feature.add_to_layer(*m_layer);
+            }
+        } catch (...) {
+            m_error = std::current_exception();
+        }
+    }
+
+    if (m_error) {
+        return;
+    }
+    try {
+        finish_transactions(m_dataset);
+        if (m_create_index) {
+            create_spatial_index(m_dataset, *m_layer);
+        }
+    } catch (...) {
+        m_error = std::current_exception();
+    }
+}
+
+void SplitLayersOutput::layer_writer::add(queued_feature&& feature) {
+    m_batch.push_back(std::move(feature));
+    if (m_batch.size() >= batch_size) {
+        m_queue.push(std::move(m_batch));
+        m_batch = batch_type{};
+        m_batch.reserve(batch_size);
+    }
+}
+
+void SplitLayersOutput::layer_writer::finish() {
+    if (m_thread.joinable()) {
+        if (!m_batch.empty()) {
+            m_queue.push(std::move(m_batch));
+            m_batch = batch_type{};
+        }
+        m_queue.push(batch_type{});
+        m_thread.join();
+    }
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+std::string SplitLayersOutput::layer_filename(const std::string& filename, const std::string& layer_name) {
+    auto slash = filename.find_last_of('/');
+    if (slash == std::string::npos) {
+        slash = 0;
+    }
+    const auto dot = filename.find_last_of('.');
+    if (dot == std::string::npos || dot <= slash) {
+        return filename + "_" + layer_name;
+    }
+    return filename.substr(0, dot) + "_" + layer_name + filename.substr(dot);
+}
+
+SplitLayersOutput::SplitLayersOutput(const std::string& format, const std::string& filename, const LayerConfig& config,
+                                     std::uint64_t tx_batch, bool defer_index, bool merge) {
+    // Merged layers get their index in the merged dataset.
+    const bool create_index = !merge && setup_deferred_index(format, defer_index);
+    const auto options = layer_options(merge || create_index);
+
+    for (const auto& layer : config.layers()) {
+        m_writers.emplace_back(new layer_writer{format, layer_filename(filename, layer.name), layer, tx_batch, options, create_index});
+    }
+}
+
+void SplitLayersOutput::add_point(std::size_t index, const LayerConfig::layer& layer, const osmium::Node& node, const char* const* values) {
+    queued_feature feature{m_factory.create_point(node), layer.fields.size()};
+    set_layer_fields(feature, layer, values, node.id());
+    m_writers[index]->add(std::move(feature));
+}
+
+void SplitLayersOutput::add_linestring(std::size_t index, const LayerConfig::layer& layer, const osmium::Way& way, const char* const* values) {
+    queued_feature feature{m_factory.create_linestring(way), layer.fields.size()};
+    set_layer_fields(feature, layer, values, way.id());
+    m_writers[index]->add(std::move(feature));
+}
+
+void SplitLayersOutput::finish() {
+    // Wait for all writers, even if one of them failed.
+    std::exception_ptr error;
+    for (auto& writer : m_writers) {
+        try {
+            writer->finish();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+StageTime SplitLayersOutput::write_time() const noexcept {
+    StageTime time;
+    for (const auto& writer : m_writers) {
+        time += writer->write_time();
+    }
+    return time;
+}
+
+void SplitLayersOutput::merge(gdalcpp::Dataset& dataset, bool defer_index) {
+    const auto options = layer_options(defer_index);
+    std::vector<char*> option_ptrs;
+    for (const auto& option : options) {
+        option_ptrs.push_back(const_cast<char*>(option.c_str()));
+    }
+    option_ptrs.push_back(nullptr);
+
+    const bool transactions = dataset.get().TestCapability(ODsCTransactions);
+
+    for (auto& writer : m_writers) {
+        const std::string filename = writer->filename();
+        const std::string layer_name = writer->layer_name();
+        writer.reset(); // closes the layer dataset
+
+        GDALDataset* source = static_cast<GDALDataset*>(GDALOpenEx(filename.c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY, nullptr, nullptr, nullptr));
+        if (!source) {
+            throw std::runtime_error{"Can't open dataset " + filename};
+        }
+
+        OGRLayer* source_layer = source->GetLayerByName(layer_name.c_str());
+        if (!source_layer) {
+            GDALClose(source);
+            throw std::runtime_error{"No layer " + layer_name + " in dataset " + filename};
+        }
+
+        if (transactions) {
+            dataset.get().StartTransaction();
+        }
+        OGRLayer* layer = dataset.get().CopyLayer(source_layer, layer_name.c_str(), option_ptrs.data());
+        if (transactions) {
+            dataset.get().CommitTransaction();
+        }
+        if (!layer) {
+            GDALClose(source);
+            throw std::runtime_error{"Can't copy layer " + layer_name + " from " + filename};
+        }
+        if (defer_index) {
+            dataset.exec(create_spatial_index_sql(layer_name.c_str(), layer->GetGeometryColumn()));
+        }
+
+        GDALClose(source);
+        std::remove(filename.c_str());
+    }
+    m_writers.clear();
+}
@@ -0,0 +1,190 @@
+#ifndef SPLIT_LAYERS_HPP
+#define SPLIT_LAYERS_HPP
+
+/*
+
+  Output for BaseLayersHandler writing every layer into its own dataset.
+
+  With one dataset the inserts into all layers queue up behind the one
+  SQLite connection. Here each layer has its own dataset and a writer
+  thread. The thread running the handler builds the geometries as WKB,
+  copies the field values and hands the features over in batches through
+  a bounded queue, so it blocks if a writer falls too far behind.
+
+  At the end the layers can be merged into one dataset, which then looks
+  like the one written without splitting.
+
+*/
+
+#include <gdalcpp.hpp>
+
+#include <osmium/geom/wkb.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/thread/queue.hpp>
+
+#include "layer_config.hpp"
+#include "stage_time.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SplitLayersOutput {
+
+    // A feature with its geometry and field values copied out of the
+    // input buffer.
+    class queued_feature {
+
+        struct field_value {
+            enum class kind {
+                none,
+                integer,
+                real,
+                string
+            };
+
+            kind type = kind::none;
+            int integer = 0;
+            double real = 0.0;
+            std::string string;
+        };
+
+        std::string m_wkb;
+        std::vector<field_value> m_fields;
+
+    public:
+
+        queued_feature(std::string&& wkb, std::size_t num_fields) :
+            m_wkb(std::move(wkb)),
+            m_fields(num_fields) {
+        }
+
+        void set_field(int n, int value) {
+            auto& field = m_fields[static_cast<std::size_t>(n)];
+            field.type = field_value::kind::integer;
+            field.integer = value;
+        }
+
+        void set_field(int n, double value) {
+            auto& field = m_fields[static_cast<std::size_t>(n)];
+            field.type = field_value::kind::real;
+            field.real = value;
+        }
+
+        void set_field(int n, const char* value) {
+            auto& field = m_fields[static_cast<std::size_t>(n)];
+            field.type = field_value::kind::string;
+            field.string = value;
+        }
+
+        void add_to_layer(gdalcpp::Layer& layer) const;
+
+    }; // class queued_feature
+
+    using batch_type = std::vector<queued_feature>;
+
+    // One layer in its own dataset with its writer thread.
+    class layer_writer {
+
+        std::string m_filename;
+        gdalcpp::Dataset m_dataset;
+        std::unique_ptr<gdalcpp::Layer> m_layer;
+        bool m_create_index;
+
+        // Filled by the handler thread and pushed to the queue when full.
+        batch_type m_batch;
+
+        // An empty batch marks the end of the features.
+        osmium::thread::Queue<batch_type> m_queue;
+
+        // Time spent adding features to the layer, on the writer thread.
+        StageTime m_write_time;
+
+        std::exception_ptr m_error;
+        std::thread m_thread;
+
+        void run();
+
+    public:
+
+        // With create_index set, the spatial index is built by the writer
+        // thread after the last feature.
+        layer_writer(const std::string& format, const std::string& filename, const LayerConfig::layer& layer,
+                     std::uint64_t tx_batch, const std::vector<std::string>& options, bool create_index);
+
+        layer_writer(const layer_writer&) = delete;
+        layer_writer& operator=(const layer_writer&) = delete;
+
+        ~layer_writer() noexcept;
+
+        const std::string& filename() const noexcept {
+            return m_filename;
+        }
+
+        const char* layer_name() const {
+            return m_layer->name();
+        }
+
+        // Only valid after finish().
+        const StageTime& write_time() const noexcept {
+            return m_write_time;
+        }
+
+        void add(queued_feature&& feature);
+
+        // Write the rest of the features and wait for the thread. Rethrows
+        // exceptions from the writer thread.
+        void finish();
+
+    }; // class layer_writer
+
+    std::vector<std::unique_ptr<layer_writer>> m_writers;
+
+    osmium::geom::WKBFactory<> m_factory;
+
+public:
+
+    /**
+     * The name of the dataset file for one layer: the layer name is added
+     * to the output file name before its suffix.
+     */
+    static std::string layer_filename(const std::string& filename, const std::string& layer_name);
+
+    /**
+     * Create a dataset for every layer of the config. If the layers are
+     * merged later, they are written without spatial index.
+     */
+    SplitLayersOutput(const std::string& format, const std::string& filename, const LayerConfig& config,
+                      std::uint64_t tx_batch, bool defer_index, bool merge);
+
+    void add_point(std::size_t index, const LayerConfig::layer& layer, const osmium::Node& node, const char* const* values);
+
+    void add_linestring(std::size_t index, const LayerConfig::layer& layer, const osmium::Way& way, const char* const* values);
+
+    /**
+     * Wait until all features are written. Deferred spatial indexes are
+     * created by the writer threads, so in parallel.
+     */
+    void finish();
+
+    /**
+     * Time the writer threads spent adding features to their layers,
+     * added up over all threads. Must be called after finish() and
+     * before merge().
+     */
+    StageTime write_time() const noexcept;
+
+    /**
+     * Copy all layers into one dataset and remove the layer datasets.
+     * Must be called after finish().
+     */
+    void merge(gdalcpp::Dataset& dataset, bool defer_index);
+
+}; // class SplitLayersOutput
+
+#endif // SPLIT_LAYERS_HPP
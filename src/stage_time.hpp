@@ -0,0 +1,142 @@
+#ifndef STAGE_TIME_HPP
+#define STAGE_TIME_HPP
+
+/*
+
+  Wall and CPU time of work done in many small pieces, for example the
+  features written or the area batches assembled while the ways are
+  read. The CPU time is that of the thread doing the work, so other
+  threads running at the same time don't count. With MSVC the CPU times
+  come from GetProcessTimes() and GetThreadTimes().
+
+  Usage:
+
+    StageTime write_time;
+    ...
+    {
+        StageTime::scope timer{&write_time};
+        // ... the work
+    }
+
+*/
+
+#include <chrono>
+
+#ifndef _MSC_VER
+# include <time.h> // for clock_gettime
+#else
+# include <cstdint>
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h> // for GetProcessTimes, GetThreadTimes
+#endif
+
+#ifndef _MSC_VER
+inline double clock_seconds(clockid_t clock) noexcept {
+    timespec ts{};
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0.0;
+    }
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+#else
+// Kernel plus user time, a FILETIME counts in units of 100 ns.
+inline double filetime_seconds(const FILETIME& kernel, const FILETIME& user) noexcept {
+    const auto ticks = [](const FILETIME& time) {
+        return (static_cast<std::uint64_t>(time.dwHighDateTime) << 32U) | time.dwLowDateTime;
+    };
+    return static_cast<double>(ticks(kernel) + ticks(user)) / 1e7;
+}
+#endif
+
+/**
+ * CPU time of all threads of the process in seconds.
+ */
+inline double process_cpu_seconds() noexcept {
+#ifndef _MSC_VER
+    return clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+#else
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    return filetime_seconds(kernel, user);
+#endif
+}
+
+/**
+ * CPU time of the calling thread in seconds.
+ */
+inline double thread_cpu_seconds() noexcept {
+#ifndef _MSC_VER
+    return clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+#else
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    return filetime_seconds(kernel, user);
+#endif
+}
+
+class StageTime {
+
+    double m_seconds = 0.0;
+    double m_cpu_seconds = 0.0;
+
+public:
+
+    /**
+     * Adds the time from its construction to its destruction to the
+     * StageTime, if there is one.
+     */
+    class scope {
+
+        StageTime* m_time;
+        std::chrono::steady_clock::time_point m_start;
+        double m_cpu_start = 0.0;
+
+    public:
+
+        explicit scope(StageTime* time) noexcept :
+            m_time(time) {
+            if (m_time) {
+                m_start = std::chrono::steady_clock::now();
+                m_cpu_start = thread_cpu_seconds();
+            }
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        ~scope() noexcept {
+            if (m_time) {
+                const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+                m_time->add(elapsed.count(), thread_cpu_seconds() - m_cpu_start);
+            }
+        }
+
+    }; // class scope
+
+    void add(double seconds, double cpu_seconds) noexcept {
+        m_seconds += seconds;
+        m_cpu_seconds += cpu_seconds;
+    }
+
+    StageTime& operator+=(const StageTime& other) noexcept {
+        add(other.m_seconds, other.m_cpu_seconds);
+        return *this;
+    }
+
+    double seconds() const noexcept {
+        return m_seconds;
+    }
+
+    double cpu_seconds() const noexcept {
+        return m_cpu_seconds;
+    }
+
+}; // class StageTime
+
+#endif // STAGE_TIME_HPP
@@ -0,0 +1,157 @@
+/*
+
+  Classification of OSM objects by their tags in one pass over the tag
+  list.
+
+*/
+
+#include "tag_dispatch.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+void TagDispatcher::hash_table::build(const std::vector<std::uint64_t>& hashes) {
+    slots.clear();
+    if (hashes.empty()) {
+        return;
+    }
+
+    std::vector<std::uint64_t> sorted{hashes};
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        throw std::runtime_error{"Duplicate entry in tag dispatch table"};
+    }
+
+    // Start with a load factor of at most 1/2, if no seed is found
+    // double the table size.
+    std::size_t size = 1;
+    while (size < hashes.size() * 2) {
+        size <<= 1U;
+    }
+
+    constexpr const std::uint64_t seeds_per_size = 10000;
+    while (true) {
+        mask = size - 1;
+        for (seed = 0; seed < seeds_per_size; ++seed) {
+            slots.assign(size, 0);
+            bool collision = false;
+            for (std::size_t i = 0; i < hashes.size(); ++i) {
+                auto& entry = slots[slot(hashes[i], seed, mask)];
+                if (entry != 0) {
+                    collision = true;
+                    break;
+                }
+                entry = static_cast<std::uint32_t>(i + 1);
+            }
+            if (!collision) {
+                return;
+            }
+        }
+        size <<= 1U;
+    }
+}
+
+constexpr const int TagDispatcher::no_target;
+constexpr const std::uint32_t TagDispatcher::no_rule;
+
+int TagDispatcher::add_attribute(const char* key) {
+    for (std::size_t i = 0; i < m_keys.size(); ++i) {
+        if (m_keys[i].key == key) {
+            return static_cast<int>(i);
+        }
+    }
+    m_keys.push_back(key_entry{key, false, no_rule});
+    return static_cast<int>(m_keys.size() - 1);
+}
+
+void TagDispatcher::add_rule(const char* key, const char* value, int target) {
+    const auto rule = static_cast<std::uint32_t>(m_targets.size());
+    m_targets.push_back(target);
+
+    key_entry& entry = m_keys[static_cast<std::size_t>(add_attribute(key))];
+    if (value == nullptr) {
+        entry.any_value_rule = std::min(entry.any_value_rule, rule);
+        return;
+    }
+
+    for (const auto& value_rule : m_value_rules) {
+        if (value_rule.key == key && value_rule.value == value) {
+            return; // the earlier rule wins anyway
+        }
+    }
+    entry.has_value_rules = true;
+    m_value_rules.push_back(value_rule{key, value, rule});
+}
+
+void TagDispatcher::add_rule(const osmium::TagMatcher& matcher, int target) {
+    m_matcher_rules.push_back(matcher_rule{matcher, static_cast<std::uint32_t>(m_targets.size())});
+    m_targets.push_back(target);
+}
+
+void TagDispatcher::build() {
+    std::vector<std::uint64_t> hashes;
+    for (const auto& entry : m_keys) {
+        hashes.push_back(hash_string(entry.key.c_str()));
+    }
+    m_key_table.build(hashes);
+
+    hashes.clear();
+    for (const auto& rule : m_value_rules) {
+        hashes.push_back(hash_tag(hash_string(rule.key.c_str()), rule.value.c_str()));
+    }
+    m_rule_table.build(hashes);
+}
+
+int TagDispatcher::classify(const osmium::TagList& tags, const char** values) const {
+    if (values) {
+        std::fill(values, values + m_keys.size(), nullptr);
+    }
+
+    std::uint32_t best_rule = no_rule;
+    for (const osmium::Tag& tag : tags) {
+        for (const auto& rule : m_matcher_rules) {
+            if (rule.rule < best_rule && rule.matcher(tag)) {
+                best_rule = rule.rule;
+            }
+        }
+
+        const std::uint64_t key_hash = hash_string(tag.key());
+        const std::uint32_t key_index = m_key_table.find(key_hash);
+        if (key_index == 0) {
+            continue;
+        }
+
+        const key_entry& entry = m_keys[key_index - 1];
+        if (std::strcmp(entry.key.c_str(), tag.key()) != 0) {
+            continue;
+        }
+
+        if (values) {
+            const char*& value = values[key_index - 1];
+            if (value) {
+                continue; // only the first tag with this key counts
+            }
+            value = tag.value();
+        }
+
+        best_rule = std::min(best_rule, entry.any_value_rule);
+
+        if (entry.has_value_rules) {
+            const std::uint32_t rule_index = m_rule_table.find(hash_tag(key_hash, tag.value()));
+            if (rule_index != 0) {
+                const value_rule& rule = m_value_rules[rule_index - 1];
+                if (rule.rule < best_rule && rule.key == tag.key() && rule.value == tag.value()) {
+                    best_rule = rule.rule;
+                }
+            }
+        }
+    }
+
+    if (best_rule == no_rule) {
+        return no_target;
+    }
+    return m_targets[best_rule];
+}
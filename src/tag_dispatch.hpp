@@ -0,0 +1,151 @@
+#ifndef TAG_DISPATCH_HPP
+#define TAG_DISPATCH_HPP
+
+/*
+
+  Classification of OSM objects by their tags in one pass over the tag
+  list.
+
+  The dispatcher knows a set of keys whose values are needed (the
+  attributes) and a list of rules "key=value goes to target". Both are
+  put into perfect hash tables when the dispatcher is built: the seed of
+  the hash function is chosen so that no two entries share a slot. Each
+  tag then costs one hash computation of the key, one table probe and
+  at most one string compare, only tags with a key used by a rule also
+  need the hash of the value.
+
+  Rules that can't be hashed, because they use prefix or substring
+  matching or are inverted, are kept as osmium::TagMatcher and checked
+  against every tag. They should be rare.
+
+*/
+
+#include <osmium/osm/tag.hpp>
+#include <osmium/tags/matcher.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class TagDispatcher {
+
+    static constexpr const std::uint32_t no_rule = 0xffffffffU;
+
+    struct key_entry {
+        std::string key;
+        bool has_value_rules;
+        std::uint32_t any_value_rule; // first rule matching any value
+    };
+
+    struct value_rule {
+        std::string key;
+        std::string value;
+        std::uint32_t rule;
+    };
+
+    struct matcher_rule {
+        osmium::TagMatcher matcher;
+        std::uint32_t rule;
+    };
+
+    // A perfect hash table, each slot has the index + 1 of its entry
+    // or 0 if empty.
+    struct hash_table {
+        std::vector<std::uint32_t> slots;
+        std::uint64_t seed = 0;
+        std::uint64_t mask = 0;
+
+        void build(const std::vector<std::uint64_t>& hashes);
+
+        std::uint32_t find(std::uint64_t hash) const noexcept {
+            if (slots.empty()) {
+                return 0;
+            }
+            return slots[slot(hash, seed, mask)];
+        }
+
+        static std::size_t slot(std::uint64_t hash, std::uint64_t seed, std::uint64_t mask) noexcept {
+            // the finalizer of MurmurHash3
+            hash ^= seed;
+            hash ^= hash >> 33U;
+            hash *= 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 33U;
+            hash *= 0xc4ceb9fe1a85ec53ULL;
+            hash ^= hash >> 33U;
+            return static_cast<std::size_t>(hash & mask);
+        }
+    };
+
+    std::vector<key_entry> m_keys;
+    std::vector<value_rule> m_value_rules;
+    std::vector<matcher_rule> m_matcher_rules;
+
+    // The target of every rule in the order the rules were added.
+    std::vector<int> m_targets;
+
+    hash_table m_key_table;
+    hash_table m_rule_table;
+
+    // FNV-1a
+    static std::uint64_t hash_string(const char* str, std::uint64_t hash = 0xcbf29ce484222325ULL) noexcept {
+        for (; *str; ++str) {
+            hash ^= static_cast<unsigned char>(*str);
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    static std::uint64_t hash_tag(std::uint64_t key_hash, const char* value) noexcept {
+        // continue the key hash with a separator, so "a"="bc" and
+        // "ab"="c" differ
+        return hash_string(value, (key_hash ^ 0xffU) * 0x100000001b3ULL);
+    }
+
+public:
+
+    static constexpr const int no_target = -1;
+
+    /**
+     * Add a key whose value is needed. Returns the index of the value in
+     * the values given to classify(). Keys used in rules are added
+     * automatically.
+     */
+    int add_attribute(const char* key);
+
+    /**
+     * Objects with the tag key=value go to the given target. If value is
+     * nullptr, any value matches. If several rules match, the one added
+     * first wins.
+     */
+    void add_rule(const char* key, const char* value, int target);
+
+    /**
+     * Objects with a tag matching the matcher go to the given target.
+     * These rules are checked against every tag, use the rule above
+     * where possible.
+     */
+    void add_rule(const osmium::TagMatcher& matcher, int target);
+
+    /**
+     * Build the hash tables. Must be called after all attributes and
+     * rules are added and before classify().
+     */
+    void build();
+
+    std::size_t num_attributes() const noexcept {
+        return m_keys.size();
+    }
+
+    /**
+     * Walk the tag list once. The values of all attributes are written
+     * into values (nullptr if the object doesn't have the key), which
+     * must have room for num_attributes() entries or be nullptr if only
+     * the target is needed. Returns the target of the matching rule or
+     * no_target.
+     */
+    int classify(const osmium::TagList& tags, const char** values) const;
+
+}; // class TagDispatcher
+
+#endif // TAG_DISPATCH_HPP
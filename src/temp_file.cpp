@@ -0,0 +1,27 @@
+/*
+
+  Helpers for the temporary files of the tools.
+
+*/
+
+#include "temp_file.hpp"
+
+#ifndef _MSC_VER
+# include <unistd.h>
+#else
+# include <process.h>
+#endif
+
+std::string temp_file_name(const std::string& output, const char* tool, const char* suffix) {
+    if (!output.empty() && output != "-") {
+        return output + suffix;
+    }
+
+#ifndef _MSC_VER
+    const long pid = static_cast<long>(::getpid());
+#else
+    const long pid = static_cast<long>(::_getpid());
+#endif
+
+    return std::string{tool} + "." + std::to_string(pid) + suffix;
+}
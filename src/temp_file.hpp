@@ -0,0 +1,62 @@
+#ifndef TEMP_FILE_HPP
+#define TEMP_FILE_HPP
+
+/*
+
+  Helpers for the temporary files of the tools, like the location index
+  on disk or the spooled waterways. These can be many GBytes, so they
+  must not be left behind if the tool stops with an exception.
+
+*/
+
+#include <cstdio>
+#include <string>
+
+/**
+ * Removes the file with the given name when it goes out of scope. Does
+ * nothing if no name is set.
+ */
+class FileRemover {
+
+    std::string m_filename;
+
+public:
+
+    FileRemover() = default;
+
+    explicit FileRemover(const std::string& filename) :
+        m_filename(filename) {
+    }
+
+    FileRemover(const FileRemover&) = delete;
+    FileRemover& operator=(const FileRemover&) = delete;
+
+    ~FileRemover() noexcept {
+        remove();
+    }
+
+    void set(const std::string& filename) {
+        m_filename = filename;
+    }
+
+    /**
+     * Remove the file now.
+     */
+    void remove() noexcept {
+        if (!m_filename.empty()) {
+            std::remove(m_filename.c_str());
+            m_filename.clear();
+        }
+    }
+
+}; // class FileRemover
+
+/**
+ * Name of a temporary file for the given output file: the output name
+ * with the suffix appended. If there is no output name or it is "-"
+ * (stdout), the name is built from the tool name and the process id, so
+ * concurrent runs in the same directory don't use the same file.
+ */
+std::string temp_file_name(const std::string& output, const char* tool, const char* suffix);
+
+#endif // TEMP_FILE_HPP
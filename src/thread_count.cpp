@@ -0,0 +1,30 @@
+/*
+
+  Parsing of the thread count options (--threads, --area-threads).
+
+*/
+
+#include "thread_count.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+bool parse_thread_count(const char* str, const char* option_name, int min_threads, int& threads) {
+    char* end = nullptr;
+    errno = 0;
+    const long value = std::strtol(str, &end, 10);
+    if (end == str || *end != '\0' || value < min_threads) {
+        std::cerr << "Invalid value '" << str << "' for " << option_name
+                  << ": need a number of at least " << min_threads << "\n";
+        return false;
+    }
+
+    if (errno == ERANGE || value > max_thread_count) {
+        std::cerr << "Using " << max_thread_count << " threads for " << option_name << "\n";
+        threads = max_thread_count;
+    } else {
+        threads = static_cast<int>(value);
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef THREAD_COUNT_HPP
+#define THREAD_COUNT_HPP
+
+/*
+
+  Parsing of the thread count options (--threads, --area-threads).
+
+*/
+
+/**
+ * More threads than this are never started, larger values are clamped.
+ */
+constexpr const int max_thread_count = 256;
+
+/**
+ * Parse the thread count str of the given option into threads. The
+ * value must be a number not smaller than min_threads, larger values
+ * than max_thread_count are clamped. Returns false and prints an error
+ * to stderr if the value is invalid.
+ */
+bool parse_thread_count(const char* str, const char* option_name, int min_threads, int& threads);
+
+#endif // THREAD_COUNT_HPP
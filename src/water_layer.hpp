@@ -0,0 +1,193 @@
+#ifndef WATER_LAYER_HPP
+#define WATER_LAYER_HPP
+
+/*
+
+  Building and writing the features of the "water" layer, used by
+  osmium_toogr2 and osmium_export_all.
+
+*/
+
+#include <gdalcpp.hpp>
+
+#include <osmium/geom/mercator_projection.hpp>
+#include <osmium/geom/wkb.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/tag.hpp>
+
+#include "flatgeobuf_writer.hpp"
+#include "ogr_output.hpp"
+#include "region.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Is this an object for the "water" layer?
+inline bool is_water(const osmium::TagList& tags) {
+    const char* natural = tags["natural"];
+    return natural && 0 == std::strcmp(natural, "water");
+}
+
+// Choose one of the following:
+
+// 1. Use WGS84, do not project coordinates.
+using factory_type = osmium::geom::WKBFactory<>;
+
+// 2. Project coordinates into "Web Mercator".
+//using factory_type = osmium::geom::WKBFactory<osmium::geom::MercatorProjection>;
+
+// 3. Use any projection that the proj library can handle.
+//    (Initialize projection with EPSG code or proj string in
+//    build_water_features()).
+//    In addition you need to link with "-lproj" and add
+//    #include <osmium/geom/projection.hpp>.
+//using factory_type = osmium::geom::WKBFactory<osmium::geom::Projection>;
+
+// The geometry is either WKB or, for the OGR writer, an OGR geometry
+// already created from it on the worker thread.
+struct water_feature {
+    std::string wkb;
+    std::unique_ptr<OGRGeometry> geometry;
+    osmium::object_id_type id;
+    std::string type;
+    std::string name;
+    bool has_name;
+};
+
+// Water features from one buffer of areas, built on a worker thread.
+struct water_features {
+    std::vector<water_feature> features;
+    std::string errors;
+    std::size_t areas = 0; // areas in the buffer, for progress reporting
+    std::size_t geometry_errors = 0;
+};
+
+// Areas outside the region, if there is one, are dropped before their
+// geometry is built. With ogr_geometry set, the OGR geometries are
+// created here, so the writer thread only has to add them to the layer.
+inline water_features build_water_features(const osmium::memory::Buffer& area_buffer, const Region* region, bool ogr_geometry) {
+    // Geometry factories are not thread safe, so each call gets its own.
+    factory_type factory{};
+
+    water_features result;
+    for (auto it = area_buffer.begin<osmium::Area>(); it != area_buffer.end<osmium::Area>(); ++it) {
+        const osmium::Area& area = *it;
+        ++result.areas;
+        if (is_water(area.tags()) && (!region || region->intersects(area))) {
+            try {
+                const char* name = area.tags()["name"];
+                water_feature water{
+                    factory.create_multipolygon(area),
+                    nullptr,
+                    area.id(),
+                    area.tags()["natural"],
+                    name ? name : "",
+                    name != nullptr
+                };
+                if (ogr_geometry) {
+                    water.geometry = geometry_from_wkb(water.wkb);
+                    water.wkb.clear();
+                }
+                result.features.push_back(std::move(water));
+            } catch (const osmium::geometry_error&) {
+                ++result.geometry_errors;
+                result.errors += "Ignoring illegal geometry for area " +
+                                 std::to_string(area.id()) +
+                                 " created from " +
+                                 (area.from_way() ? "way" : "relation") +
+                                 " with id=" +
+                                 std::to_string(area.orig_id()) + ".\n";
+            }
+        }
+    }
+    return result;
+}
+
+class WaterLayerWriter {
+
+    gdalcpp::Layer m_layer_polygon;
+
+    std::uint64_t m_features = 0;
+
+public:
+
+    // Build the features with OGR geometries.
+    static constexpr const bool ogr_geometry = true;
+
+    WaterLayerWriter(gdalcpp::Dataset& dataset, bool defer_index) :
+        m_layer_polygon(dataset, "water", wkbMultiPolygon, layer_options(defer_index)) {
+        m_layer_polygon.add_field("id", OFTReal, 10);
+        m_layer_polygon.add_field("type", OFTString, 32);
+        m_layer_polygon.add_field("name", OFTString, 32);
+    }
+
+    std::uint64_t features() const noexcept {
+        return m_features;
+    }
+
+    void create_spatial_indexes(gdalcpp::Dataset& dataset) {
+        create_spatial_index(dataset, m_layer_polygon);
+    }
+
+    void write(water_features& result) {
+        std::cerr << result.errors;
+        for (auto& water : result.features) {
+            gdalcpp::Feature feature{m_layer_polygon, std::move(water.geometry)};
+            feature.set_field("id", static_cast<double>(water.id));
+            feature.set_field("type", water.type.c_str());
+            if (water.has_name) {
+                feature.set_field("name", water.name.c_str());
+            }
+            feature.add_to_layer();
+            ++m_features;
+        }
+    }
+
+}; // class WaterLayerWriter
+
+// Writes the water features into a FlatGeobuf file without OGR.
+class FlatGeobufWaterWriter {
+
+    FlatGeobufWriter m_writer;
+
+public:
+
+    // Build the features with WKB geometries.
+    static constexpr const bool ogr_geometry = false;
+
+    FlatGeobufWaterWriter(const std::string& filename, int epsg) :
+        m_writer(filename, "water", 6 /* MultiPolygon */, {
+            {"id",   FlatGeobufWriter::column_type::double_type},
+            {"type", FlatGeobufWriter::column_type::string_type},
+            {"name", FlatGeobufWriter::column_type::string_type}
+        }, epsg) {
+    }
+
+    std::uint64_t features() const noexcept {
+        return m_writer.features();
+    }
+
+    void write(water_features& result) {
+        std::cerr << result.errors;
+        for (const auto& water : result.features) {
+            m_writer.set_geometry(water.wkb);
+            m_writer.set_field(0, static_cast<double>(water.id));
+            m_writer.set_field(1, water.type.c_str());
+            m_writer.set_field(2, water.has_name ? water.name.c_str() : nullptr);
+            m_writer.add_feature();
+        }
+    }
+
+    void close() {
+        m_writer.close();
+    }
+
+}; // class FlatGeobufWaterWriter
+
+#endif // WATER_LAYER_HPP
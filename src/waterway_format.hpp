@@ -0,0 +1,205 @@
+#ifndef WATERWAY_FORMAT_HPP
+#define WATERWAY_FORMAT_HPP
+
+/*
+
+  Binary format for the waterway node lists written by osmium_waterway_ids.
+
+  The file starts with the 7 byte magic "WWIDS\0\0" followed by the
+  format version byte (currently 1). After that a sequence of entries
+  follows, each starting with a single type byte:
+
+    's'  String definition: varint length followed by the bytes of the
+         string. Strings are numbered in the order they appear, starting
+         with 0.
+    'r'  Record: zigzag varint way or area id, varint index of the tag
+         value string, varint number of node refs, then the node refs
+         as zigzag varints, each one relative to the previous one
+         (the first one relative to 0).
+    'e'  End of file.
+
+  All varints are encoded in the LEB128 style also used by protobuf.
+
+  This header is self-contained so that downstream tools can read the
+  format without depending on libosmium.
+
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace waterway_format {
+
+    constexpr const char magic[8] = {'W', 'W', 'I', 'D', 'S', '\0', '\0', 1};
+
+    constexpr const char string_entry = 's';
+    constexpr const char record_entry = 'r';
+    constexpr const char end_entry    = 'e';
+
+    inline std::uint64_t encode_zigzag(std::int64_t value) noexcept {
+        return (static_cast<std::uint64_t>(value) << 1U) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    inline std::int64_t decode_zigzag(std::uint64_t value) noexcept {
+        return static_cast<std::int64_t>(value >> 1U) ^ -static_cast<std::int64_t>(value & 1U);
+    }
+
+    /**
+     * Encode value as varint into out, which must have room for at least
+     * 10 bytes. Returns the number of bytes written.
+     */
+    inline std::size_t encode_varint(std::uint64_t value, char* out) noexcept {
+        std::size_t n = 0;
+        while (value >= 0x80U) {
+            out[n++] = static_cast<char>((value & 0x7fU) | 0x80U);
+            value >>= 7U;
+        }
+        out[n++] = static_cast<char>(value);
+        return n;
+    }
+
+    struct Record {
+        std::int64_t id = 0;
+        std::uint64_t value_index = 0;
+        std::vector<std::int64_t> nodes;
+    };
+
+    /**
+     * Sequential reader for the binary waterway format.
+     */
+    class Reader {
+
+        struct file_closer {
+            void operator()(std::FILE* file) const noexcept {
+                std::fclose(file);
+            }
+        };
+
+        std::unique_ptr<std::FILE, file_closer> m_file;
+        std::vector<std::string> m_strings;
+        std::string m_filename;
+
+        // Size of the file or -1 if it isn't known (not seekable).
+        long m_size = -1;
+
+        [[noreturn]] void error(const char* message) const {
+            throw std::runtime_error{"Invalid waterway file '" + m_filename + "': " + message};
+        }
+
+        int get() {
+            const int c = std::getc(m_file.get());
+            if (c == EOF) {
+                error("unexpected end of file");
+            }
+            return c;
+        }
+
+        std::uint64_t get_varint() {
+            std::uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7) {
+                const auto c = static_cast<std::uint64_t>(get());
+                value |= (c & 0x7fU) << shift;
+                if ((c & 0x80U) == 0) {
+                    return value;
+                }
+            }
+            error("varint too long");
+        }
+
+        // Read a string of the given length, which must not be longer
+        // than the rest of the file, so a broken length doesn't make us
+        // allocate huge amounts of memory. If the file size isn't known,
+        // the string is read in chunks and only grows with the data read.
+        std::string get_string(std::uint64_t length) {
+            if (m_size >= 0) {
+                const long pos = std::ftell(m_file.get());
+                if (pos < 0 || length > static_cast<std::uint64_t>(m_size - pos)) {
+                    error("string longer than the rest of the file");
+                }
+            }
+            constexpr const std::uint64_t chunk_size = 1024UL * 1024UL;
+            std::string str;
+            while (str.size() < length) {
+                const std::size_t old_size = str.size();
+                const auto n = static_cast<std::size_t>(std::min(length - old_size, chunk_size));
+                str.resize(old_size + n);
+                if (std::fread(&str[old_size], 1, n, m_file.get()) != n) {
+                    error("unexpected end of file");
+                }
+            }
+            return str;
+        }
+
+    public:
+
+        explicit Reader(const std::string& filename) :
+            m_file(std::fopen(filename.c_str(), "rb")),
+            m_filename(filename) {
+            if (!m_file) {
+                throw std::runtime_error{"Could not open file '" + filename + "'"};
+            }
+            std::setvbuf(m_file.get(), nullptr, _IOFBF, 1024UL * 1024UL);
+
+            if (std::fseek(m_file.get(), 0, SEEK_END) == 0) {
+                m_size = std::ftell(m_file.get());
+                if (std::fseek(m_file.get(), 0, SEEK_SET) != 0) {
+                    error("can not seek");
+                }
+            }
+
+            char header[sizeof(magic)];
+            if (std::fread(header, 1, sizeof(header), m_file.get()) != sizeof(header) ||
+                !std::equal(header, header + sizeof(header), magic)) {
+                error("wrong header");
+            }
+        }
+
+        /**
+         * Read the next record. Returns false at the end of the file.
+         */
+        bool next(Record& record) {
+            while (true) {
+                const int type = get();
+                if (type == end_entry) {
+                    return false;
+                }
+                if (type == string_entry) {
+                    m_strings.push_back(get_string(get_varint()));
+                } else if (type == record_entry) {
+                    record.id = decode_zigzag(get_varint());
+                    record.value_index = get_varint();
+                    if (record.value_index >= m_strings.size()) {
+                        error("undefined string index");
+                    }
+                    const auto count = get_varint();
+                    record.nodes.clear();
+                    std::int64_t ref = 0;
+                    for (std::uint64_t i = 0; i < count; ++i) {
+                        ref += decode_zigzag(get_varint());
+                        record.nodes.push_back(ref);
+                    }
+                    return true;
+                } else {
+                    error("unknown entry type");
+                }
+            }
+        }
+
+        /**
+         * The tag value of a record returned by next().
+         */
+        const std::string& value(const Record& record) const {
+            return m_strings[record.value_index];
+        }
+
+    }; // class Reader
+
+} // namespace waterway_format
+
+#endif // WATERWAY_FORMAT_HPP
@@ -0,0 +1,302 @@
+#ifndef WATERWAY_IDS_HANDLER_HPP
+#define WATERWAY_IDS_HANDLER_HPP
+
+/*
+
+  Handler writing the ids of waterways and water areas and their nodes,
+  used by osmium_waterway_ids and osmium_export_all.
+
+*/
+
+#include <osmium/handler.hpp>
+#include <osmium/osm/area.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/tags/tags_filter.hpp>
+
+#include "buffered_writer.hpp"
+#include "progress.hpp"
+#include "riversystems.hpp"
+#include "util.hpp"
+#include "waterway_format.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Writes waterway records either as CSV lines or in the binary format
+ * described in waterway_format.hpp.
+ */
+class WaterwayWriter {
+
+    BufferedWriter m_out;
+    std::unordered_map<std::string, std::uint64_t> m_strings;
+    std::vector<osmium::object_id_type> m_nodes;
+    osmium::object_id_type m_id = 0;
+    std::uint64_t m_value_index = 0;
+    bool m_binary = false;
+    std::uint64_t m_records = 0;
+    ProgressCounter* m_progress = nullptr;
+
+    // Time spent formatting and writing records, from begin_record() to
+    // end_record() and in close(). The caller's work is not included.
+    std::chrono::steady_clock::time_point m_record_start;
+    std::chrono::steady_clock::duration m_write_time{0};
+
+    void write_varint(std::uint64_t value) {
+        char buffer[10];
+        m_out.write(buffer, waterway_format::encode_varint(value, buffer));
+    }
+
+public:
+
+    void open(const std::string& filename, bool binary) {
+        m_binary = binary;
+        m_strings.clear();
+        m_records = 0;
+        m_write_time = std::chrono::steady_clock::duration{0};
+        m_out.open(filename);
+        if (m_binary) {
+            m_out.write(waterway_format::magic, sizeof(waterway_format::magic));
+        }
+    }
+
+    void close() {
+        const auto start = std::chrono::steady_clock::now();
+        if (m_binary && m_out.is_open()) {
+            m_out.put(waterway_format::end_entry);
+        }
+        m_out.close();
+        m_write_time += std::chrono::steady_clock::now() - start;
+    }
+
+    std::size_t bytes_written() const noexcept {
+        return m_out.bytes_written();
+    }
+
+    std::uint64_t records() const noexcept {
+        return m_records;
+    }
+
+    // Seconds spent in the writer itself.
+    double write_seconds() const noexcept {
+        return std::chrono::duration<double>(m_write_time).count();
+    }
+
+    // Also count the records written for the progress reporter.
+    void set_progress_counter(ProgressCounter* counter) noexcept {
+        m_progress = counter;
+    }
+
+    void begin_record(osmium::object_id_type id, const char* value) {
+        m_record_start = std::chrono::steady_clock::now();
+        if (!m_binary) {
+            m_out.write_int(id);
+            m_out.put(',');
+            m_out.write(value);
+            return;
+        }
+
+        m_id = id;
+        m_nodes.clear();
+
+        // Tag values are interned, each one is written only once.
+        const auto result = m_strings.emplace(value, m_strings.size());
+        if (result.second) {
+            const auto& str = result.first->first;
+            m_out.put(waterway_format::string_entry);
+            write_varint(str.size());
+            m_out.write(str);
+        }
+        m_value_index = result.first->second;
+    }
+
+    void add_node(osmium::object_id_type ref) {
+        if (!m_binary) {
+            m_out.put(',');
+            m_out.write_int(ref);
+            return;
+        }
+        m_nodes.push_back(ref);
+    }
+
+    void end_record() {
+        ++m_records;
+        if (m_progress) {
+            m_progress->add();
+        }
+        if (m_binary) {
+            m_out.put(waterway_format::record_entry);
+            write_varint(waterway_format::encode_zigzag(m_id));
+            write_varint(m_value_index);
+            write_varint(m_nodes.size());
+            osmium::object_id_type last = 0;
+            for (const auto ref : m_nodes) {
+                write_varint(waterway_format::encode_zigzag(ref - last));
+                last = ref;
+            }
+        } else {
+            m_out.put('\n');
+        }
+        m_write_time += std::chrono::steady_clock::now() - m_record_start;
+    }
+
+}; // class WaterwayWriter
+
+class WaterHandler : public osmium::handler::Handler {
+
+    static void output_waterway(const osmium::Way& way, const char* tag_key, WaterwayWriter & out) {
+        const osmium::TagList& tags = way.tags();
+        const char* tag_value = tags.get_value_by_key(tag_key);
+        if (nullptr != tag_value) {
+            // Print id of the waterway and the tagname of the pub if it is set.
+            out.begin_record(way.id(), tag_value);
+
+            // Print ids of nodes of the ways
+            for (const osmium::NodeRef& nr : way.nodes()) {
+              out.add_node(nr.ref());
+            }
+
+            out.end_record();
+        }
+    }
+
+    static void output_area(const osmium::Area& area, const char* tag_key, WaterwayWriter & out) {
+        const osmium::TagList& tags = area.tags();
+        const char* tag_value = tags.get_value_by_key(tag_key);
+        if (nullptr != tag_value) {
+            // Print id of the waterway and the tagname of the pub if it is set.
+            out.begin_record(area.orig_id(), tag_value);
+
+            // Because we set
+            // create_empty_areas = false in the assembler config, we can
+            // be sure there will always be at least one outer ring.
+
+            // Print ids of nodes of the outer rings
+            for (auto& ring : area.outer_rings()) {
+                for (const osmium::NodeRef& nr : ring) {
+                  out.add_node(nr.ref());
+                }
+            }
+
+            out.end_record();
+        }
+    }
+
+public:
+
+    WaterHandler(const std::string& wayfile, const std::string& areafile, bool binary = false)
+        : m_filter(false)
+    {
+      waystream.open(wayfile, binary);
+      areastream.open(areafile, binary);
+    }
+
+    void close() {
+      waystream.close();
+      areastream.close();
+    }
+
+    std::size_t bytes_written() const noexcept {
+        return waystream.bytes_written() + areastream.bytes_written();
+    }
+
+    // Seconds spent formatting and writing the way and area files.
+    double write_seconds() const noexcept {
+        return waystream.write_seconds() + areastream.write_seconds();
+    }
+
+    // Records written to the way and area files.
+    std::uint64_t way_records() const noexcept {
+        return waystream.records();
+    }
+
+    std::uint64_t area_records() const noexcept {
+        return areastream.records();
+    }
+
+    // Add counters for the records in the way and area files to the
+    // progress reporter.
+    void add_progress_counters(ProgressReporter& progress) {
+        waystream.set_progress_counter(&progress.add_layer("waterways"));
+        areastream.set_progress_counter(&progress.add_layer("water"));
+    }
+
+    void way(const osmium::Way& way) {
+        const osmium::TagList& tags = way.tags();
+        if (osmium::tags::match_any_of(tags, m_filter)) {
+            if (tags.has_key("waterway")) {
+              output_waterway(way, "waterway", waystream);
+              if (m_rsystems) {
+                m_rsystems->add_way(way);
+              }
+            } else if (tags.has_key("natural")) {
+              output_waterway(way, "natural", areastream);
+            } else if (tags.has_key("landuse")) {
+              output_waterway(way, "landuse", areastream);
+            }
+        }
+    }
+
+    void area(const osmium::Area& area) {
+        const osmium::TagList& tags = area.tags();
+        if (osmium::tags::match_any_of(tags, m_filter)) {
+            if (tags.has_key("natural")) {
+              output_area(area, "natural", areastream);
+            } else if (tags.has_key("landuse")) {
+              output_area(area, "landuse", areastream);
+            }
+        }
+    }
+
+    void parse_and_add_expression(const std::string& expression) {
+        const auto p = get_filter_expression(expression);
+        std::cout << "adding filter rule " << p.second << std::endl;
+        m_filter.add_rule(true, get_tag_matcher(p.second));
+    }
+
+    void read_expressions_file(const std::string& file_name) {
+        // Reading filter expressions file
+
+        std::ifstream file{file_name};
+        if (!file.is_open()) {
+            throw std::runtime_error{"Could not open file '" + file_name + "'"};
+        }
+
+        for (std::string line; std::getline(file, line);) {
+            const auto pos = line.find_first_of('#');
+            if (pos != std::string::npos) {
+                line.erase(pos);
+            }
+            if (!line.empty()) {
+                if (line.back() == '\r') {
+                    line.resize(line.size() - 1);
+                }
+                parse_and_add_expression(line);
+            }
+        }
+    }
+
+    const osmium::TagsFilter & getTagsFilter() {
+        return m_filter;
+    }
+
+    // Also collect waterways for the river system computation.
+    void set_riversystem_builder(RiversystemBuilder* rsystems) {
+        m_rsystems = rsystems;
+    }
+
+private:
+    WaterwayWriter waystream;
+    WaterwayWriter areastream;
+    osmium::TagsFilter m_filter;
+    RiversystemBuilder* m_rsystems = nullptr;
+
+}; // class WaterHandler
+
+#endif // WATERWAY_IDS_HANDLER_HPP
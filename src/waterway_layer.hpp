@@ -0,0 +1,189 @@
+#ifndef WATERWAY_LAYER_HPP
+#define WATERWAY_LAYER_HPP
+
+/*
+
+  Writing the "waterway" layer with the names of the river systems,
+  used by osmium_rivermap and osmium_export_all.
+
+*/
+
+#include <gdalcpp.hpp>
+
+#include <osmium/geom/ogr.hpp>
+#include <osmium/geom/wkb.hpp>
+#include <osmium/handler.hpp>
+#include <osmium/osm/way.hpp>
+
+#include "flatgeobuf_writer.hpp"
+#include "ogr_output.hpp"
+#include "progress.hpp"
+#include "riversystem_map.hpp"
+#include "spatialite_writer.hpp"
+#include "stage_time.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+inline bool is_waterway(const osmium::Way& way) {
+    return way.tags().has_key("waterway");
+}
+
+inline void add_waterway_fields(gdalcpp::Layer& layer) {
+    layer.add_field("id", OFTReal, 10);
+    layer.add_field("name", OFTString, 30);
+    layer.add_field("type", OFTString, 30);
+    layer.add_field("rsystem", OFTString, 30);
+}
+
+// Writes the waterways through OGR.
+class OGRWaterwayOutput {
+
+    gdalcpp::Layer m_layer_linestring;
+
+    osmium::geom::OGRFactory<> m_factory;
+
+public:
+
+    OGRWaterwayOutput(gdalcpp::Dataset& dataset, bool defer_index) :
+        m_layer_linestring(dataset, "waterway", wkbLineString, layer_options(defer_index)) {
+        add_waterway_fields(m_layer_linestring);
+    }
+
+    void add(const osmium::Way& way, const char* name, const char* waterway, const char* riversystem) {
+        gdalcpp::Feature feature{m_layer_linestring, m_factory.create_linestring(way)};
+        feature.set_field("id", static_cast<double>(way.id()));
+        if (name) {
+            feature.set_field("name", name);
+        }
+        feature.set_field("type", waterway);
+        feature.set_field("rsystem", riversystem);
+        feature.add_to_layer();
+    }
+
+    void create_spatial_indexes(gdalcpp::Dataset& dataset) {
+        create_spatial_index(dataset, m_layer_linestring);
+    }
+
+}; // class OGRWaterwayOutput
+
+// Writes the waterways directly into the Spatialite table, which has to
+// be created through OGR before.
+class NativeWaterwayOutput {
+
+    SpatialiteWriter m_writer;
+
+    osmium::geom::WKBFactory<> m_factory;
+
+public:
+
+    NativeWaterwayOutput(const std::string& filename, std::uint64_t tx_batch) :
+        m_writer(filename, "waterway", {"id", "name", "type", "rsystem"}, tx_batch) {
+    }
+
+    void add(const osmium::Way& way, const char* name, const char* waterway, const char* riversystem) {
+        m_writer.set_geometry(m_factory.create_linestring(way));
+        m_writer.set_field(0, static_cast<double>(way.id()));
+        m_writer.set_field(1, name);
+        m_writer.set_field(2, waterway);
+        m_writer.set_field(3, riversystem);
+        m_writer.add_row();
+    }
+
+    void close() {
+        m_writer.close();
+    }
+
+}; // class NativeWaterwayOutput
+
+// Writes the waterways into a FlatGeobuf file without OGR.
+class FlatGeobufWaterwayOutput {
+
+    FlatGeobufWriter m_writer;
+
+    osmium::geom::WKBFactory<> m_factory;
+
+public:
+
+    explicit FlatGeobufWaterwayOutput(const std::string& filename) :
+        m_writer(filename, "waterway", 2 /* LineString */, {
+            {"id",      FlatGeobufWriter::column_type::double_type},
+            {"name",    FlatGeobufWriter::column_type::string_type},
+            {"type",    FlatGeobufWriter::column_type::string_type},
+            {"rsystem", FlatGeobufWriter::column_type::string_type}
+        }) {
+    }
+
+    void add(const osmium::Way& way, const char* name, const char* waterway, const char* riversystem) {
+        m_writer.set_geometry(m_factory.create_linestring(way));
+        m_writer.set_field(0, static_cast<double>(way.id()));
+        m_writer.set_field(1, name);
+        m_writer.set_field(2, waterway);
+        m_writer.set_field(3, riversystem);
+        m_writer.add_feature();
+    }
+
+    void close() {
+        m_writer.close();
+    }
+
+}; // class FlatGeobufWaterwayOutput
+
+template <typename TOutput>
+class WaterwayLayerHandler : public osmium::handler::Handler {
+
+    TOutput& m_output;
+    RiversystemMap& m_rsystems;
+
+    std::uint64_t m_features = 0;
+    std::uint64_t m_geometry_errors = 0;
+    ProgressCounter* m_progress = nullptr;
+    StageTime* m_write_time = nullptr;
+
+public:
+    WaterwayLayerHandler(TOutput& output, RiversystemMap& rsystems) :
+        m_output(output),
+        m_rsystems(rsystems) {
+    }
+
+    // Also count the features written for the progress reporter.
+    void set_progress_counter(ProgressCounter* counter) noexcept {
+        m_progress = counter;
+    }
+
+    // Measure the time spent writing features for --stats.
+    void set_write_time(StageTime* time) noexcept {
+        m_write_time = time;
+    }
+
+    void way(const osmium::Way& way) {
+        const char* waterway = way.tags().get_value_by_key("waterway");
+        if (waterway) {
+            try {
+                const char* name = way.tags().get_value_by_key("name");
+                const char* riversystem = m_rsystems.getName(way.id());
+                StageTime::scope timer{m_write_time};
+                m_output.add(way, name, waterway, riversystem);
+                ++m_features;
+                if (m_progress) {
+                    m_progress->add();
+                }
+            } catch (const osmium::geometry_error&) {
+                ++m_geometry_errors;
+                std::cerr << "Ignoring illegal geometry for way " << way.id() << ".\n";
+            }
+        }
+    }
+
+    std::uint64_t features() const noexcept {
+        return m_features;
+    }
+
+    std::uint64_t geometry_errors() const noexcept {
+        return m_geometry_errors;
+    }
+
+}; // class WaterwayLayerHandler
+
+#endif // WATERWAY_LAYER_HPP